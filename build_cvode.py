@@ -42,7 +42,7 @@ os.mkdir('sundials-5.3.0/static')
 # build CVode as static library
 check_call([
     'cmake',
-    '-DBUILD_ARKODE=OFF',
+    '-DBUILD_ARKODE=ON',
     '-DBUILD_CVODES=OFF',
     '-DBUILD_IDA=OFF',
     '-DBUILD_IDAS=OFF',
@@ -61,7 +61,7 @@ check_call(['cmake', '--build', 'sundials-5.3.0/static', '--target', 'install',
 # build CVode as dynamic library
 check_call([
     'cmake',
-    '-DBUILD_ARKODE=OFF',
+    '-DBUILD_ARKODE=ON',
     '-DBUILD_CVODES=OFF',
     '-DBUILD_IDA=OFF',
     '-DBUILD_IDAS=OFF',
@@ -86,7 +86,8 @@ for name in ['sundials_cvode', 'sundials_nvecserial', 'sundials_sunlinsoldense',
     dst = os.path.join(sundials_binary_dir, name + sl_suffix)
     shutil.copy(src, dst)
 
-# build cswrapper
+# build cswrapper (without the sparse linear solver that requires SUNDIALS and the wrapper to be
+# built with KLU from SuiteSparse, see CSWRAPPER_KLU in cswrapper/CMakeLists.txt)
 os.mkdir('cswrapper/build')
 
 check_call([
@@ -13,19 +13,52 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>   /* for fabs() */
+#include <stdint.h>
+#include <time.h>
 
 #include <cvode/cvode.h>               /* prototypes for CVODE fcts., consts.  */
 #include <nvector/nvector_serial.h>    /* access to serial N_Vector            */
 #include <sunmatrix/sunmatrix_dense.h> /* access to dense SUNMatrix            */
 #include <sunlinsol/sunlinsol_dense.h> /* access to dense SUNLinearSolver      */
+#include <sunmatrix/sunmatrix_band.h>  /* access to band SUNMatrix             */
+#include <sunlinsol/sunlinsol_band.h>  /* access to band SUNLinearSolver       */
+#include <sunmatrix/sunmatrix_sparse.h> /* access to sparse SUNMatrix          */
+#ifdef CSWRAPPER_KLU
+#include <sunlinsol/sunlinsol_klu.h>   /* access to KLU sparse direct solver   */
+#endif
+#include <sunlinsol/sunlinsol_spgmr.h> /* access to SPGMR SUNLinearSolver      */
+#include <sunnonlinsol/sunnonlinsol_fixedpoint.h> /* access to the fixed-point SUNNonlinearSolver */
+#include <arkode/arkode_erkstep.h>     /* prototypes for the explicit RK methods */
+#include <arkode/arkode_arkstep.h>     /* prototypes for the additive RK methods */
 #include <sundials/sundials_types.h>   /* defs. of realtype, sunindextype      */
 
 #include "fmi2Functions.h"
 
 
+#if defined(_WIN32)
+#define PATH_LENGTH MAX_PATH
+#else
+#include <limits.h>
+#define PATH_LENGTH PATH_MAX
+#endif
+
 #define EPSILON 1e-14
+
+/* use a banded or sparse linear solver for models with at least SPARSE_MIN_STATES states
+   and at most SPARSE_MAX_DENSITY non-zero elements in the Jacobian */
+#define SPARSE_MIN_STATES  100
+#define SPARSE_MAX_DENSITY 0.1
+
+/* use a banded linear solver if the band has at most BAND_MAX_FILL times the non-zero elements */
+#define BAND_MAX_FILL 4
+
 #define RTOL  RCONST(1.0e-4)   /* scalar relative tolerance            */
 
+/* switch from Adams to BDF if the fixed-point iteration fails to converge in more than
+   STIFFNESS_MAX_FAILURES of at least STIFFNESS_MIN_STEPS steps */
+#define STIFFNESS_MIN_STEPS    20
+#define STIFFNESS_MAX_FAILURES 0.1
+
 #if defined(_WIN32)
 #define SHARED_LIBRARY_EXTENSION ".dll"
 #elif defined(__APPLE__)
@@ -34,6 +67,132 @@
 #define SHARED_LIBRARY_EXTENSION ".so"
 #endif
 
+typedef enum {
+    METHOD_AUTO,  /* start with ADAMS and switch to BDF if the model is stiff */
+    METHOD_ADAMS, /* CVODE Adams-Moulton with fixed-point iteration */
+    METHOD_BDF,   /* CVODE BDF with Newton iteration */
+    METHOD_ERK,   /* ARKODE explicit Runge-Kutta */
+    METHOD_ARK    /* ARKODE diagonally implicit Runge-Kutta */
+} Method;
+
+static const char *methodNames[] = { "auto", "adams", "bdf", "erk", "ark" };
+
+typedef enum {
+    LINEAR_SOLVER_AUTO,  /* dense, band or sparse depending on the sparsity pattern */
+    LINEAR_SOLVER_DENSE,
+    LINEAR_SOLVER_BAND,
+    LINEAR_SOLVER_SPARSE,
+    LINEAR_SOLVER_SPGMR  /* matrix-free Krylov solver */
+} LinearSolverType;
+
+static const char *linearSolverNames[] = { "auto", "dense", "band", "sparse", "spgmr" };
+
+/* Structure of the Jacobian d der(x) / d x read from resources/cswrapper.txt */
+typedef struct {
+
+    fmi2Boolean providesDirectionalDerivative;
+
+    fmi2ValueReference *states;
+    fmi2ValueReference *derivatives;
+
+    /* sparsity pattern in compressed sparse column format */
+    size_t nnz;
+    size_t *columnPointers;
+    size_t *rowIndices;
+
+    /* columns that don't share a row are evaluated with a single directional derivative */
+    size_t nColors;
+    size_t *colorPointers;
+    size_t *colorColumns;
+    fmi2ValueReference *knownReferences;
+
+    /* rows that are affected by the columns of a color */
+    size_t *unknownPointers;
+    size_t *unknownRows;
+    fmi2ValueReference *unknownReferences;
+
+    fmi2Real *seed;
+    fmi2Real *directionalDerivatives;
+    fmi2Real *column;
+
+} Structure;
+
+/* The point (t, x) that has been set in the model and the values evaluated at that point */
+typedef struct {
+
+    fmi2Boolean valid;
+    realtype time;
+    realtype *states;
+
+    fmi2Boolean derivativesValid;
+    realtype *derivatives;
+
+    fmi2Boolean eventIndicatorsValid;
+    realtype *eventIndicators;
+
+    /* number of points that have been set and skipped */
+    size_t nSets;
+    size_t nSkippedSets;
+
+    /* number of evaluations of the derivatives and event indicators that have been reused */
+    size_t nReusedDerivatives;
+    size_t nReusedEventIndicators;
+
+} Cache;
+
+/* Vendor specific status kinds for fmi2GetIntegerStatus() */
+typedef enum {
+    STATUS_NUMBER_OF_STEPS = 1000,
+    STATUS_NUMBER_OF_RHS_EVALUATIONS,
+    STATUS_NUMBER_OF_LINEAR_SOLVER_SETUPS,
+    STATUS_NUMBER_OF_ERROR_TEST_FAILURES,
+    STATUS_NUMBER_OF_CONVERGENCE_FAILURES,
+    STATUS_NUMBER_OF_JACOBIAN_EVALUATIONS,
+    STATUS_NUMBER_OF_ROOT_EVALUATIONS,
+    STATUS_NUMBER_OF_STATE_EVENTS,
+    STATUS_NUMBER_OF_TIME_EVENTS,
+    STATUS_NUMBER_OF_STEP_EVENTS,
+    STATUS_NUMBER_OF_REINITIALIZATIONS,
+    STATUS_NUMBER_OF_SKIPPED_SETS,
+    STATUS_NUMBER_OF_REUSED_DERIVATIVES,
+    STATUS_NUMBER_OF_REUSED_EVENT_INDICATORS
+} IntegerStatusKind;
+
+/* Vendor specific status kinds for fmi2GetRealStatus() */
+typedef enum {
+    STATUS_MODEL_TIME = 1100,  /* wall time in the model during fmi2DoStep() in seconds */
+    STATUS_SOLVER_TIME         /* wall time outside of the model during fmi2DoStep() in seconds */
+} RealStatusKind;
+
+/* Counters of an integrator that are reset by a re-initialization */
+typedef struct {
+
+    long nSteps;
+    long nRhsEvaluations;
+    long nLinearSolverSetups;
+    long nErrorTestFailures;
+    long nConvergenceFailures;
+    long nJacobianEvaluations;
+    long nRootEvaluations;
+
+} IntegratorCounters;
+
+typedef struct {
+
+    /* counters before the last re-initialization or switch of the integrator */
+    IntegratorCounters previous;
+
+    long nStateEvents;
+    long nTimeEvents;
+    long nStepEvents;
+    long nReinitializations;
+
+    /* wall time in nanoseconds */
+    uint64_t modelTime;
+    uint64_t stepTime;
+
+} Statistics;
+
 typedef struct {
 
 #if defined(_WIN32)
@@ -45,16 +204,40 @@ typedef struct {
     fmi2Component c;
     fmi2EventInfo eventInfo;
 	fmi2CallbackLogger logger;
+	fmi2ComponentEnvironment componentEnvironment;
 	const char *instanceName;
+	fmi2Boolean loggingOn;
     
     size_t nx;
     size_t nz;
+
+    realtype reltol;
+    realtype startTime;
+
+    /* configured and current integration method */
+    Method method;
+    Method currentMethod;
+    LinearSolverType linearSolver;
+
+    /* counters of the Adams method at the last check for stiffness */
+    long stiffnessSteps;
+    long stiffnessFailures;
     
     void *cvode_mem;
+    void *arkode_mem;
     N_Vector x;
     N_Vector abstol;
 	SUNMatrix A;
 	SUNLinearSolver LS;
+	SUNNonlinearSolver NLS;
+
+	Structure *structure;
+
+	Cache cache;
+
+	Statistics statistics;
+
+	realtype lastSuccessfulTime;
 
     /***************************************************
     Common Functions
@@ -102,43 +285,749 @@ typedef struct {
 
 } Model;
 
+static uint64_t wallClock(void) {
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* Add the wall time of the statement S to the time in the model */
+#define MODEL_TIME(m, S) { const uint64_t modelStart = wallClock(); S; (m)->statistics.modelTime += wallClock() - modelStart; }
+
+/* Mark the values in the cache as invalid after the model has been changed from outside */
+static void invalidateCache(Model *m, fmi2Boolean point) {
+
+    if (point) m->cache.valid = fmi2False;
+
+    m->cache.derivativesValid = fmi2False;
+    m->cache.eventIndicatorsValid = fmi2False;
+}
+
+/* Set the time and continuous states unless the model is already at (t, y) */
+static fmi2Status setPoint(Model *m, realtype t, N_Vector y) {
+
+    Cache *cache = &m->cache;
+
+    if (cache->valid && cache->time == t && (m->nx == 0 || !memcmp(cache->states, NV_DATA_S(y), m->nx * sizeof(realtype)))) {
+        cache->nSkippedSets++;
+        return fmi2OK;
+    }
+
+    invalidateCache(m, fmi2True);
+
+    fmi2Status status = m->fmi2SetTime(m->c, t);
+    if (status > fmi2Warning) return status;
+
+    if (m->nx > 0) {
+        status = m->fmi2SetContinuousStates(m->c, NV_DATA_S(y), m->nx);
+        if (status > fmi2Warning) return status;
+        memcpy(cache->states, NV_DATA_S(y), m->nx * sizeof(realtype));
+    }
+
+    cache->valid = fmi2True;
+    cache->time = t;
+    cache->nSets++;
+
+    return status;
+}
+
 static int f(realtype t, N_Vector y, N_Vector ydot, void *user_data) {
     
     Model *m = (Model *)user_data;
+    Cache *cache = &m->cache;
         
     if (m->nx > 0) {
+
         fmi2Status status;
-        status = m->fmi2SetTime(m->c, t);
-        status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(y), NV_LENGTH_S(y));
-        status = m->fmi2GetDerivatives(m->c, NV_DATA_S(ydot), NV_LENGTH_S(ydot));
+
+        MODEL_TIME(m, status = setPoint(m, t, y))
+        if (status > fmi2Warning) return -1;
+
+        if (cache->derivativesValid) {
+            cache->nReusedDerivatives++;
+        } else {
+            MODEL_TIME(m, status = m->fmi2GetDerivatives(m->c, cache->derivatives, m->nx))
+            if (status > fmi2Warning) return -1;
+            cache->derivativesValid = fmi2True;
+        }
+
+        memcpy(NV_DATA_S(ydot), cache->derivatives, m->nx * sizeof(realtype));
+    }
+        
+    return 0;
+    
+}
+
+static int g(realtype t, N_Vector y, realtype *gout, void *user_data) {
+
+    Model *m = (Model *)user_data;
+    Cache *cache = &m->cache;
+    
+    fmi2Status status;
+
+    MODEL_TIME(m, status = setPoint(m, t, y))
+    if (status > fmi2Warning) return -1;
+
+    if (cache->eventIndicatorsValid) {
+        cache->nReusedEventIndicators++;
+    } else {
+        MODEL_TIME(m, status = m->fmi2GetEventIndicators(m->c, cache->eventIndicators, m->nz))
+        if (status > fmi2Warning) return -1;
+        cache->eventIndicatorsValid = fmi2True;
+    }
+
+    memcpy(gout, cache->eventIndicators, m->nz * sizeof(realtype));
+
+    return 0;
+}
+
+/* Get the counters of the current integrator since the last re-initialization */
+static void getIntegratorCounters(Model *m, IntegratorCounters *counters) {
+
+    memset(counters, 0, sizeof(IntegratorCounters));
+
+    long nfi = 0;
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        if (!m->arkode_mem) return;
+        ERKStepGetNumSteps(m->arkode_mem, &counters->nSteps);
+        ERKStepGetNumRhsEvals(m->arkode_mem, &counters->nRhsEvaluations);
+        ERKStepGetNumErrTestFails(m->arkode_mem, &counters->nErrorTestFailures);
+        ERKStepGetNumGEvals(m->arkode_mem, &counters->nRootEvaluations);
+        break;
+    case METHOD_ARK:
+        if (!m->arkode_mem) return;
+        ARKStepGetNumSteps(m->arkode_mem, &counters->nSteps);
+        ARKStepGetNumRhsEvals(m->arkode_mem, &counters->nRhsEvaluations, &nfi);
+        counters->nRhsEvaluations += nfi;
+        ARKStepGetNumLinSolvSetups(m->arkode_mem, &counters->nLinearSolverSetups);
+        ARKStepGetNumErrTestFails(m->arkode_mem, &counters->nErrorTestFailures);
+        ARKStepGetNumNonlinSolvConvFails(m->arkode_mem, &counters->nConvergenceFailures);
+        ARKStepGetNumJacEvals(m->arkode_mem, &counters->nJacobianEvaluations);
+        ARKStepGetNumGEvals(m->arkode_mem, &counters->nRootEvaluations);
+        break;
+    default:
+        if (!m->cvode_mem) return;
+        CVodeGetNumSteps(m->cvode_mem, &counters->nSteps);
+        CVodeGetNumRhsEvals(m->cvode_mem, &counters->nRhsEvaluations);
+        CVodeGetNumLinSolvSetups(m->cvode_mem, &counters->nLinearSolverSetups);
+        CVodeGetNumErrTestFails(m->cvode_mem, &counters->nErrorTestFailures);
+        CVodeGetNumNonlinSolvConvFails(m->cvode_mem, &counters->nConvergenceFailures);
+        if (m->LS) CVodeGetNumJacEvals(m->cvode_mem, &counters->nJacobianEvaluations);
+        CVodeGetNumGEvals(m->cvode_mem, &counters->nRootEvaluations);
+        break;
+    }
+}
+
+/* Get the counters of all integrators since the instantiation or reset */
+static void getTotalCounters(Model *m, IntegratorCounters *counters) {
+
+    getIntegratorCounters(m, counters);
+
+    const IntegratorCounters *previous = &m->statistics.previous;
+
+    counters->nSteps               += previous->nSteps;
+    counters->nRhsEvaluations      += previous->nRhsEvaluations;
+    counters->nLinearSolverSetups  += previous->nLinearSolverSetups;
+    counters->nErrorTestFailures   += previous->nErrorTestFailures;
+    counters->nConvergenceFailures += previous->nConvergenceFailures;
+    counters->nJacobianEvaluations += previous->nJacobianEvaluations;
+    counters->nRootEvaluations     += previous->nRootEvaluations;
+}
+
+/* Re-initialize the integrator at time t with the states x */
+static int reinitIntegrator(Model *m, realtype t) {
+
+    // the counters are reset by the integrator
+    getTotalCounters(m, &m->statistics.previous);
+
+    m->stiffnessSteps = 0;
+    m->stiffnessFailures = 0;
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        return ERKStepReInit(m->arkode_mem, f, t, m->x);
+    case METHOD_ARK:
+        return ARKStepReInit(m->arkode_mem, NULL, f, t, m->x);
+    default:
+        return CVodeReInit(m->cvode_mem, t, m->x);
+    }
+}
+
+static int setIntegratorTolerances(Model *m) {
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        return ERKStepSVtolerances(m->arkode_mem, m->reltol, m->abstol);
+    case METHOD_ARK:
+        return ARKStepSVtolerances(m->arkode_mem, m->reltol, m->abstol);
+    default:
+        return CVodeSVtolerances(m->cvode_mem, m->reltol, m->abstol);
+    }
+}
+
+static int setStopTime(Model *m, realtype tstop) {
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        return ERKStepSetStopTime(m->arkode_mem, tstop);
+    case METHOD_ARK:
+        return ARKStepSetStopTime(m->arkode_mem, tstop);
+    default:
+        return CVodeSetStopTime(m->cvode_mem, tstop);
+    }
+}
+
+/* Integrate to tout and return CV_ROOT_RETURN if a root has been found */
+static int integrate(Model *m, realtype tout, realtype *tret) {
+
+    int flag;
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        flag = ERKStepEvolve(m->arkode_mem, tout, m->x, tret, ARK_NORMAL);
+        return flag == ARK_ROOT_RETURN ? CV_ROOT_RETURN : flag;
+    case METHOD_ARK:
+        flag = ARKStepEvolve(m->arkode_mem, tout, m->x, tret, ARK_NORMAL);
+        return flag == ARK_ROOT_RETURN ? CV_ROOT_RETURN : flag;
+    default:
+        return CVode(m->cvode_mem, tout, m->x, tret, CV_NORMAL);
+    }
+}
+
+static int getErrWeights(Model *m, N_Vector weights) {
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        return ERKStepGetErrWeights(m->arkode_mem, weights);
+    case METHOD_ARK:
+        return ARKStepGetErrWeights(m->arkode_mem, weights);
+    default:
+        return CVodeGetErrWeights(m->cvode_mem, weights);
+    }
+}
+
+static int getCurrentStep(Model *m, realtype *h) {
+
+    switch (m->currentMethod) {
+    case METHOD_ERK:
+        return ERKStepGetCurrentStep(m->arkode_mem, h);
+    case METHOD_ARK:
+        return ARKStepGetCurrentStep(m->arkode_mem, h);
+    default:
+        return CVodeGetCurrentStep(m->cvode_mem, h);
+    }
+}
+
+/* Set the entries of column j of the Jacobian J from the entries of the column vector */
+static void setColumn(SUNMatrix J, const Structure *s, size_t j, const realtype column[], realtype scale) {
+
+    switch (SUNMatGetID(J)) {
+
+    case SUNMATRIX_DENSE:
+        for (size_t l = s->columnPointers[j]; l < s->columnPointers[j + 1]; l++) {
+            const size_t i = s->rowIndices[l];
+            SM_ELEMENT_D(J, i, j) = column[i] * scale;
+        }
+        break;
+
+    case SUNMATRIX_BAND:
+        for (size_t l = s->columnPointers[j]; l < s->columnPointers[j + 1]; l++) {
+            const size_t i = s->rowIndices[l];
+            SM_ELEMENT_B(J, i, j) = column[i] * scale;
+        }
+        break;
+
+    case SUNMATRIX_SPARSE:
+        // the pattern has been set by setSparsePattern()
+        for (size_t l = s->columnPointers[j]; l < s->columnPointers[j + 1]; l++) {
+            SM_DATA_S(J)[l] = column[s->rowIndices[l]] * scale;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Set the compressed sparse columns of a sparse Jacobian */
+static void setSparsePattern(SUNMatrix J, const Structure *s, size_t nx) {
+
+    sunindextype *indexPointers = SM_INDEXPTRS_S(J);
+    sunindextype *indexValues = SM_INDEXVALS_S(J);
+
+    for (size_t j = 0; j <= nx; j++) {
+        indexPointers[j] = (sunindextype)s->columnPointers[j];
+    }
+
+    for (size_t l = 0; l < s->nnz; l++) {
+        indexValues[l] = (sunindextype)s->rowIndices[l];
+    }
+}
+
+/* Evaluate the Jacobian with one directional derivative or difference quotient per color */
+static int jac(realtype t, N_Vector y, N_Vector fy, SUNMatrix J, void *user_data, N_Vector tmp1, N_Vector tmp2, N_Vector tmp3) {
+
+    Model *m = (Model *)user_data;
+    Structure *s = m->structure;
+
+    if (SUNMatGetID(J) == SUNMATRIX_SPARSE) {
+        setSparsePattern(J, s, m->nx);
+    } else {
+        SUNMatZero(J);
+    }
+
+    if (!s->providesDirectionalDerivative) {
+
+        // difference quotients with the increments of CVODE's dense difference quotient Jacobian
+        realtype *x = NV_DATA_S(y);
+        realtype *xp = NV_DATA_S(tmp1);
+        realtype *weights = NV_DATA_S(tmp3);
+        realtype h;
+
+        if (getErrWeights(m, tmp3) != 0 || getCurrentStep(m, &h) != 0) return -1;
+
+        const realtype srur = sqrt(UNIT_ROUNDOFF);
+        const realtype fnorm = N_VWrmsNorm(fy, tmp3);
+        const realtype minInc = fnorm != 0 ? 1000 * fabs(h) * UNIT_ROUNDOFF * m->nx * fnorm : 1;
+
+        for (size_t i = 0; i < s->nColors; i++) {
+
+            memcpy(xp, x, m->nx * sizeof(realtype));
+
+            for (size_t k = s->colorPointers[i]; k < s->colorPointers[i + 1]; k++) {
+                const size_t j = s->colorColumns[k];
+                xp[j] += fmax(srur * fabs(x[j]), minInc / weights[j]);
+            }
+
+            int flag = f(t, tmp1, tmp2, m);
+            if (flag != 0) return flag;
+
+            for (size_t k = 0; k < m->nx; k++) {
+                s->column[k] = NV_DATA_S(tmp2)[k] - NV_DATA_S(fy)[k];
+            }
+
+            for (size_t k = s->colorPointers[i]; k < s->colorPointers[i + 1]; k++) {
+                const size_t j = s->colorColumns[k];
+                setColumn(J, s, j, s->column, 1 / (xp[j] - x[j]));
+            }
+        }
+
+        return 0;
+    }
+
+    fmi2Status status;
+
+    MODEL_TIME(m, status = setPoint(m, t, y))
+    if (status > fmi2Warning) return -1;
+
+    for (size_t i = 0; i < s->nColors; i++) {
+
+        const size_t nKnown = s->colorPointers[i + 1] - s->colorPointers[i];
+        const size_t nUnknown = s->unknownPointers[i + 1] - s->unknownPointers[i];
+
+        MODEL_TIME(m, status = m->fmi2GetDirectionalDerivative(m->c,
+            &s->unknownReferences[s->unknownPointers[i]], nUnknown,
+            &s->knownReferences[s->colorPointers[i]], nKnown,
+            s->seed, s->directionalDerivatives))
+
+        if (status > fmi2Warning) return -1;
+
+        // scatter the directional derivative to the columns of the color
+        for (size_t k = 0; k < nUnknown; k++) {
+            s->column[s->unknownRows[s->unknownPointers[i] + k]] = s->directionalDerivatives[k];
+        }
+
+        for (size_t k = s->colorPointers[i]; k < s->colorPointers[i + 1]; k++) {
+            setColumn(J, s, s->colorColumns[k], s->column, 1);
+        }
+    }
+
+    return 0;
+}
+
+static void ehfun(int error_code, const char *module, const char *function, char *msg, void *user_data) {
+	
+	Model *m = (Model *)user_data;
+
+	m->logger(m->componentEnvironment, m->instanceName, fmi2Error, "logError", "CVode error(code %d) in module %s, function %s: %s.", error_code, module, function, msg);
+}
+
+
+static void freeStructure(Structure *s) {
+
+    if (!s) return;
+
+    free(s->states);
+    free(s->derivatives);
+    free(s->columnPointers);
+    free(s->rowIndices);
+    free(s->colorPointers);
+    free(s->colorColumns);
+    free(s->knownReferences);
+    free(s->unknownPointers);
+    free(s->unknownRows);
+    free(s->unknownReferences);
+    free(s->seed);
+    free(s->directionalDerivatives);
+    free(s->column);
+
+    free(s);
+}
+
+/* Group the columns that don't share a row (greedy coloring of the column intersection graph) */
+static void colorColumns(Structure *s, size_t nx, size_t *const rows[], const size_t rowLengths[]) {
+
+    size_t *colors = calloc(nx, sizeof(size_t));
+    size_t *forbidden = malloc(nx * sizeof(size_t));
+
+    for (size_t i = 0; i < nx; i++) {
+        forbidden[i] = (size_t)-1;
+    }
+
+    for (size_t j = 0; j < nx; j++) {
+
+        // mark the colors of the columns that share a row with column j
+        for (size_t l = s->columnPointers[j]; l < s->columnPointers[j + 1]; l++) {
+
+            const size_t i = s->rowIndices[l];
+
+            for (size_t k = 0; k < rowLengths[i]; k++) {
+                if (rows[i][k] < j) {
+                    forbidden[colors[rows[i][k]]] = j;
+                }
+            }
+        }
+
+        size_t color = 0;
+
+        while (forbidden[color] == j) color++;
+
+        colors[j] = color;
+
+        if (color + 1 > s->nColors) s->nColors = color + 1;
+    }
+
+    // sort the columns by color
+    s->colorPointers = calloc(s->nColors + 1, sizeof(size_t));
+    s->colorColumns = calloc(nx, sizeof(size_t));
+    s->knownReferences = calloc(nx, sizeof(fmi2ValueReference));
+
+    for (size_t j = 0; j < nx; j++) {
+        s->colorPointers[colors[j] + 1]++;
+    }
+
+    for (size_t i = 0; i < s->nColors; i++) {
+        s->colorPointers[i + 1] += s->colorPointers[i];
+    }
+
+    size_t *next = forbidden;
+
+    memcpy(next, s->colorPointers, s->nColors * sizeof(size_t));
+
+    for (size_t j = 0; j < nx; j++) {
+        const size_t k = next[colors[j]]++;
+        s->colorColumns[k] = j;
+        s->knownReferences[k] = s->states[j];
+    }
+
+    // collect the rows that are affected by the columns of each color
+    size_t *marks = colors;
+
+    for (size_t i = 0; i < nx; i++) {
+        marks[i] = (size_t)-1;
+    }
+
+    s->unknownPointers = calloc(s->nColors + 1, sizeof(size_t));
+    s->unknownRows = calloc(s->nnz > 0 ? s->nnz : 1, sizeof(size_t));
+    s->unknownReferences = calloc(s->nnz > 0 ? s->nnz : 1, sizeof(fmi2ValueReference));
+
+    size_t n = 0;
+
+    for (size_t c = 0; c < s->nColors; c++) {
+
+        for (size_t k = s->colorPointers[c]; k < s->colorPointers[c + 1]; k++) {
+
+            const size_t j = s->colorColumns[k];
+
+            for (size_t l = s->columnPointers[j]; l < s->columnPointers[j + 1]; l++) {
+
+                const size_t i = s->rowIndices[l];
+
+                if (marks[i] != c) {
+                    marks[i] = c;
+                    s->unknownRows[n] = i;
+                    s->unknownReferences[n] = s->derivatives[i];
+                    n++;
+                }
+            }
+        }
+
+        s->unknownPointers[c + 1] = n;
+    }
+
+    free(colors);
+    free(forbidden);
+}
+
+/* Return the index of value in names or -1 if it is not found */
+static int findName(const char *const names[], size_t nNames, const char *value) {
+
+    for (size_t i = 0; i < nNames; i++) {
+        if (!strcmp(names[i], value)) return (int)i;
+    }
+
+    return -1;
+}
+
+/* Read the options and the structure of the Jacobian written by fmpy.cswrapper.add_cswrapper() */
+static Structure *readConfiguration(Model *m, const char *filename) {
+
+    FILE *file = fopen(filename, "r");
+
+    if (!file) return NULL;
+
+    const size_t nx = m->nx;
+
+    Structure *s = calloc(1, sizeof(Structure));
+
+    // dependencies of the derivatives on the states
+    size_t **rows = calloc(nx, sizeof(size_t *));
+    size_t *rowLengths = calloc(nx, sizeof(size_t));
+
+    char key[64];
+    int valid = 1;
+
+    while (valid && fscanf(file, "%63s", key) == 1) {
+
+        if (!strcmp(key, "providesDirectionalDerivative")) {
+
+            int value;
+            valid = fscanf(file, "%d", &value) == 1;
+            s->providesDirectionalDerivative = value != 0;
+
+        } else if (!strcmp(key, "states") || !strcmp(key, "derivatives")) {
+
+            size_t n;
+            valid = fscanf(file, "%zu", &n) == 1 && n == nx;
+
+            fmi2ValueReference *vrs = calloc(nx, sizeof(fmi2ValueReference));
+
+            for (size_t i = 0; valid && i < nx; i++) {
+                valid = fscanf(file, "%u", &vrs[i]) == 1;
+            }
+
+            fmi2ValueReference **target = key[0] == 's' ? &s->states : &s->derivatives;
+
+            free(*target);
+            *target = vrs;
+
+        } else if (!strcmp(key, "solver")) {
+
+            char value[16];
+            int index = -1;
+            valid = fscanf(file, "%15s", value) == 1 && (index = findName(methodNames, 5, value)) >= 0;
+            if (valid) m->method = (Method)index;
+
+        } else if (!strcmp(key, "linearSolver")) {
+
+            char value[16];
+            int index = -1;
+            valid = fscanf(file, "%15s", value) == 1 && (index = findName(linearSolverNames, 5, value)) >= 0;
+            if (valid) m->linearSolver = (LinearSolverType)index;
+
+        } else if (!strcmp(key, "dependencies")) {
+
+            size_t row, n;
+            valid = fscanf(file, "%zu %zu", &row, &n) == 2 && row < nx && n <= nx && !rows[row];
+
+            if (valid) {
+
+                rows[row] = calloc(n > 0 ? n : 1, sizeof(size_t));
+                rowLengths[row] = n;
+
+                for (size_t k = 0; valid && k < n; k++) {
+                    valid = fscanf(file, "%zu", &rows[row][k]) == 1 && rows[row][k] < nx;
+                }
+            }
+
+        } else {
+            // skip comments and unknown entries
+            if (fscanf(file, "%*[^\n]") < 0) break;
+        }
+    }
+
+    fclose(file);
+
+    if (!valid || !s->states || !s->derivatives || nx == 0) {
+        if (!valid) {
+            m->logger(m->componentEnvironment, m->instanceName, fmi2Warning, "logWarning", "Failed to read %s.", filename);
+        }
+        for (size_t i = 0; i < nx; i++) free(rows[i]);
+        free(rows);
+        free(rowLengths);
+        freeStructure(s);
+        return NULL;
+    }
+
+    // derivatives without dependencies may depend on all states
+    for (size_t i = 0; i < nx; i++) {
+        if (!rows[i]) {
+            rows[i] = calloc(nx, sizeof(size_t));
+            rowLengths[i] = nx;
+            for (size_t j = 0; j < nx; j++) rows[i][j] = j;
+        }
+        s->nnz += rowLengths[i];
+    }
+
+    // transpose the rows to compressed sparse columns
+    s->columnPointers = calloc(nx + 1, sizeof(size_t));
+    s->rowIndices = calloc(s->nnz > 0 ? s->nnz : 1, sizeof(size_t));
+
+    for (size_t i = 0; i < nx; i++) {
+        for (size_t k = 0; k < rowLengths[i]; k++) {
+            s->columnPointers[rows[i][k] + 1]++;
+        }
+    }
+
+    for (size_t j = 0; j < nx; j++) {
+        s->columnPointers[j + 1] += s->columnPointers[j];
+    }
+
+    size_t *next = calloc(nx > 0 ? nx : 1, sizeof(size_t));
+
+    memcpy(next, s->columnPointers, nx * sizeof(size_t));
+
+    for (size_t i = 0; i < nx; i++) {
+        for (size_t k = 0; k < rowLengths[i]; k++) {
+            s->rowIndices[next[rows[i][k]]++] = i;
+        }
+    }
+
+    free(next);
+
+    colorColumns(s, nx, rows, rowLengths);
+
+    for (size_t i = 0; i < nx; i++) free(rows[i]);
+    free(rows);
+    free(rowLengths);
+
+    s->seed = calloc(nx, sizeof(fmi2Real));
+    s->directionalDerivatives = calloc(nx, sizeof(fmi2Real));
+    s->column = calloc(nx, sizeof(fmi2Real));
+
+    for (size_t i = 0; i < nx; i++) {
+        s->seed[i] = 1;
+    }
+
+    return s;
+}
+
+/* Get the path of the file in the resources from the resource location */
+static int resourcePath(const char *resourceLocation, const char *name, char *path) {
+
+    const char *scheme1 = "file:///";
+    const char *scheme2 = "file:/";
+
+    if (!resourceLocation) {
+        return 0;
+    } else if (strncmp(resourceLocation, scheme1, strlen(scheme1)) == 0) {
+        resourceLocation = &resourceLocation[strlen(scheme1) - 1];
+    } else if (strncmp(resourceLocation, scheme2, strlen(scheme2)) == 0) {
+        resourceLocation = &resourceLocation[strlen(scheme2) - 1];
+    } else {
+        return 0;
+    }
+
+#ifdef _WIN32
+    // strip any leading slashes
+    while (resourceLocation[0] == '/') {
+        resourceLocation++;
+    }
+#endif
+
+    if (strlen(resourceLocation) + strlen(name) + 2 > PATH_LENGTH) {
+        return 0;
     }
-        
-    return 0;
-    
+
+    strcpy(path, resourceLocation);
+
+    if (path[0] != '\0' && path[strlen(path) - 1] != '/') {
+        strcat(path, "/");
+    }
+
+    strcat(path, name);
+
+    return 1;
 }
 
-static int g(realtype t, N_Vector y, realtype *gout, void *user_data) {
 
-    Model *m = (Model *)user_data;
-    
-    fmi2Status status = m->fmi2SetTime(m->c, t);
+/* Set the relative tolerance and the absolute tolerances scaled by the nominal values of the states */
+static fmi2Status setTolerances(Model *m) {
+
+    fmi2Status status = fmi2OK;
+
+    realtype *abstol = NV_DATA_S(m->abstol);
 
     if (m->nx > 0) {
-        status = m->fmi2SetContinuousStates(m->c, NV_DATA_S(y), NV_LENGTH_S(y));
+
+        status = m->fmi2GetNominalsOfContinuousStates(m->c, abstol, m->nx);
+        if (status > fmi2Warning) return status;
+
+        for (size_t i = 0; i < m->nx; i++) {
+            abstol[i] = m->reltol * (abstol[i] != 0 ? fabs(abstol[i]) : 1);
+        }
+
+    } else {
+        abstol[0] = m->reltol;
     }
-    
-    status = m->fmi2GetEventIndicators(m->c, gout, m->nz);
 
-    return 0;
+    if (setIntegratorTolerances(m) != 0) return fmi2Error;
+
+    return status;
 }
 
-static void ehfun(int error_code, const char *module, const char *function, char *msg, void *user_data) {
-	
-	Model *m = (Model *)user_data;
+/* Update the discrete states at an event and return whether the continuous states have changed */
+static fmi2Status handleEvent(Model *m, fmi2Boolean *statesChanged) {
 
-	m->logger(m, m->instanceName, fmi2Error, "logError", "CVode error(code %d) in module %s, function %s: %s.", error_code, module, function, msg);
-}
+    *statesChanged = fmi2False;
+
+    invalidateCache(m, fmi2True);
+
+    fmi2Status status = m->fmi2EnterEventMode(m->c);
+    if (status > fmi2Warning) return status;
+
+    do {
+        status = m->fmi2NewDiscreteStates(m->c, &m->eventInfo);
+        if (status > fmi2Warning) return status;
+        *statesChanged |= m->eventInfo.valuesOfContinuousStatesChanged;
+    } while (m->eventInfo.newDiscreteStatesNeeded && !m->eventInfo.terminateSimulation);
 
+    if (m->eventInfo.terminateSimulation) return status;
+
+    status = m->fmi2EnterContinuousTimeMode(m->c);
+    if (status > fmi2Warning) return status;
+
+    if (m->nx > 0 && *statesChanged) {
+        status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
+        if (status > fmi2Warning) return status;
+    }
+
+    if (m->nx > 0 && m->eventInfo.nominalsOfContinuousStatesChanged) {
+        status = setTolerances(m);
+        if (status > fmi2Warning) return status;
+    }
+
+    return status;
+}
 
 /***************************************************
 Types for Common Functions
@@ -152,7 +1041,8 @@ const char* fmi2GetVersion(void) { return fmi2Version; }
 fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
-    return m->fmi2SetDebugLogging(c, loggingOn, nCategories, categories);
+    m->loggingOn = loggingOn;
+    return m->fmi2SetDebugLogging(m->c, loggingOn, nCategories, categories);
 }
 
 
@@ -166,6 +1056,286 @@ fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nC
 #define ASSERT_CV_SUCCESS(f) if (f != CV_SUCCESS) { return NULL; }
 #define ASSERT_NOT_NULL(v) if (!v) { return NULL; }
 
+/* Create the configured linear solver or choose a dense, banded or sparse linear solver
+   from the sparsity pattern of the Jacobian */
+static void *createLinearSolver(Model *m) {
+
+    const Structure *s = m->structure;
+
+    const sunindextype nx = m->nx > 0 ? (sunindextype)m->nx : 1;
+
+    // upper and lower bandwidth
+    sunindextype mu = nx - 1;
+    sunindextype ml = nx - 1;
+
+    LinearSolverType type = m->linearSolver;
+
+    if (s) {
+
+        mu = 0;
+        ml = 0;
+
+        for (sunindextype j = 0; j < nx; j++) {
+            for (size_t l = s->columnPointers[j]; l < s->columnPointers[j + 1]; l++) {
+                const sunindextype i = (sunindextype)s->rowIndices[l];
+                if (j - i > mu) mu = j - i;
+                if (i - j > ml) ml = i - j;
+            }
+        }
+    }
+
+    if (type == LINEAR_SOLVER_AUTO) {
+
+        type = LINEAR_SOLVER_DENSE;
+
+        const double density = s ? (double)s->nnz / ((double)nx * (double)nx) : 1;
+
+        if (nx >= SPARSE_MIN_STATES && density <= SPARSE_MAX_DENSITY) {
+
+            if ((double)(mu + 2 * ml + 1) * nx <= BAND_MAX_FILL * (double)s->nnz) {
+                type = LINEAR_SOLVER_BAND;
+            } else {
+#ifdef CSWRAPPER_KLU
+                type = LINEAR_SOLVER_SPARSE;
+#else
+                // without a sparse solver use the band if it is considerably smaller than the dense matrix
+                if (2 * (mu + ml + 1) <= nx) type = LINEAR_SOLVER_BAND;
+#endif
+            }
+        }
+    }
+
+#ifdef CSWRAPPER_KLU
+    if (type == LINEAR_SOLVER_SPARSE && !s) {
+#else
+    if (type == LINEAR_SOLVER_SPARSE) {
+#endif
+        m->logger(m->componentEnvironment, m->instanceName, fmi2Warning, "logWarning",
+            "The sparse linear solver is not available. Using the dense linear solver instead.");
+        type = LINEAR_SOLVER_DENSE;
+    }
+
+    switch (type) {
+
+    case LINEAR_SOLVER_BAND:
+        m->A = SUNBandMatrix(nx, mu, ml);
+        ASSERT_NOT_NULL(m->A)
+        m->LS = SUNLinSol_Band(m->x, m->A);
+        break;
+
+#ifdef CSWRAPPER_KLU
+    case LINEAR_SOLVER_SPARSE:
+        m->A = SUNSparseMatrix(nx, nx, (sunindextype)s->nnz, CSC_MAT);
+        ASSERT_NOT_NULL(m->A)
+        m->LS = SUNLinSol_KLU(m->x, m->A);
+        break;
+#endif
+
+    case LINEAR_SOLVER_SPGMR:
+        // matrix-free with difference quotients of the Jacobian-vector products
+        m->LS = SUNLinSol_SPGMR(m->x, PREC_NONE, 0);
+        break;
+
+    default:
+        m->A = SUNDenseMatrix(nx, nx);
+        ASSERT_NOT_NULL(m->A)
+        m->LS = SUNLinSol_Dense(m->x, m->A);
+        break;
+    }
+
+    ASSERT_NOT_NULL(m->LS)
+
+    if (m->loggingOn) {
+        m->logger(m->componentEnvironment, m->instanceName, fmi2OK, "logStatusOK",
+            "Using the %s linear solver (nx = %zu, nnz = %zu, mu = %ld, ml = %ld).", linearSolverNames[type], m->nx, s ? s->nnz : m->nx * m->nx, (long)mu, (long)ml);
+    }
+
+    return m->LS;
+}
+
+#define ASSERT_ARK_SUCCESS(f) if (f != ARK_SUCCESS) { return NULL; }
+
+/* Create the integrator for the method and initialize it at time t0 with the states x */
+static void *createIntegrator(Model *m, Method method, realtype t0) {
+
+    int flag;
+
+    m->currentMethod = method;
+    m->stiffnessSteps = 0;
+    m->stiffnessFailures = 0;
+
+    if (method == METHOD_ERK) {
+
+        m->arkode_mem = ERKStepCreate(f, t0, m->x);
+        ASSERT_NOT_NULL(m->arkode_mem)
+
+        flag = ERKStepSVtolerances(m->arkode_mem, m->reltol, m->abstol);
+        ASSERT_ARK_SUCCESS(flag)
+
+        if (m->nz > 0) {
+            flag = ERKStepRootInit(m->arkode_mem, (int)m->nz, g);
+            ASSERT_ARK_SUCCESS(flag)
+        }
+
+        flag = ERKStepSetNoInactiveRootWarn(m->arkode_mem);
+        ASSERT_ARK_SUCCESS(flag)
+
+        flag = ERKStepSetErrHandlerFn(m->arkode_mem, ehfun, m);
+        ASSERT_ARK_SUCCESS(flag)
+
+        flag = ERKStepSetUserData(m->arkode_mem, m);
+        ASSERT_ARK_SUCCESS(flag)
+
+        return m->arkode_mem;
+    }
+
+    if (method == METHOD_ARK) {
+
+        // the model has no separate stiff part so the whole right-hand side is implicit
+        m->arkode_mem = ARKStepCreate(NULL, f, t0, m->x);
+        ASSERT_NOT_NULL(m->arkode_mem)
+
+        flag = ARKStepSVtolerances(m->arkode_mem, m->reltol, m->abstol);
+        ASSERT_ARK_SUCCESS(flag)
+
+        if (m->nz > 0) {
+            flag = ARKStepRootInit(m->arkode_mem, (int)m->nz, g);
+            ASSERT_ARK_SUCCESS(flag)
+        }
+
+        ASSERT_NOT_NULL(createLinearSolver(m))
+
+        flag = ARKStepSetLinearSolver(m->arkode_mem, m->LS, m->A);
+        ASSERT_ARK_SUCCESS(flag)
+
+        if (m->structure && m->A) {
+            flag = ARKStepSetJacFn(m->arkode_mem, jac);
+            ASSERT_ARK_SUCCESS(flag)
+        }
+
+        flag = ARKStepSetNoInactiveRootWarn(m->arkode_mem);
+        ASSERT_ARK_SUCCESS(flag)
+
+        flag = ARKStepSetErrHandlerFn(m->arkode_mem, ehfun, m);
+        ASSERT_ARK_SUCCESS(flag)
+
+        flag = ARKStepSetUserData(m->arkode_mem, m);
+        ASSERT_ARK_SUCCESS(flag)
+
+        return m->arkode_mem;
+    }
+
+    m->cvode_mem = CVodeCreate(method == METHOD_ADAMS ? CV_ADAMS : CV_BDF);
+    ASSERT_NOT_NULL(m->cvode_mem)
+		
+	flag = CVodeInit(m->cvode_mem, f, t0, m->x);
+	ASSERT_CV_SUCCESS(flag)
+
+    flag = CVodeSVtolerances(m->cvode_mem, m->reltol, m->abstol);
+	ASSERT_CV_SUCCESS(flag)
+
+    if (m->nz > 0) {
+        flag = CVodeRootInit(m->cvode_mem, (int)m->nz, g);
+		ASSERT_CV_SUCCESS(flag)
+    }
+
+    if (method == METHOD_ADAMS) {
+
+        m->NLS = SUNNonlinSol_FixedPoint(m->x, 0);
+        ASSERT_NOT_NULL(m->NLS)
+
+        flag = CVodeSetNonlinearSolver(m->cvode_mem, m->NLS);
+        ASSERT_CV_SUCCESS(flag)
+
+    } else {
+
+        ASSERT_NOT_NULL(createLinearSolver(m))
+
+        flag = CVodeSetLinearSolver(m->cvode_mem, m->LS, m->A);
+        ASSERT_CV_SUCCESS(flag)
+
+        if (m->structure && m->A) {
+            flag = CVodeSetJacFn(m->cvode_mem, jac);
+            ASSERT_CV_SUCCESS(flag)
+        }
+    }
+
+	flag = CVodeSetNoInactiveRootWarn(m->cvode_mem);
+	ASSERT_CV_SUCCESS(flag)
+
+	flag = CVodeSetErrHandlerFn(m->cvode_mem, ehfun, m);
+	ASSERT_CV_SUCCESS(flag)
+
+    flag = CVodeSetUserData(m->cvode_mem, m);
+	ASSERT_CV_SUCCESS(flag)
+
+    return m->cvode_mem;
+}
+
+static void freeIntegrator(Model *m) {
+
+    getTotalCounters(m, &m->statistics.previous);
+
+    if (m->cvode_mem) {
+        CVodeFree(&m->cvode_mem);
+    }
+
+    if (m->arkode_mem) {
+        if (m->currentMethod == METHOD_ERK) {
+            ERKStepFree(&m->arkode_mem);
+        } else {
+            ARKStepFree(&m->arkode_mem);
+        }
+    }
+
+    if (m->LS) SUNLinSolFree(m->LS);
+    if (m->A) SUNMatDestroy(m->A);
+    if (m->NLS) SUNNonlinSolFree(m->NLS);
+
+    m->cvode_mem = NULL;
+    m->arkode_mem = NULL;
+    m->LS = NULL;
+    m->A = NULL;
+    m->NLS = NULL;
+}
+
+/* Switch from Adams to BDF if the fixed-point iteration indicates that the model is stiff */
+static fmi2Status detectStiffness(Model *m, realtype t) {
+
+    if (m->method != METHOD_AUTO || m->currentMethod != METHOD_ADAMS) {
+        return fmi2OK;
+    }
+
+    long nsteps, nncfails;
+
+    if (CVodeGetNumSteps(m->cvode_mem, &nsteps) != CV_SUCCESS || CVodeGetNumNonlinSolvConvFails(m->cvode_mem, &nncfails) != CV_SUCCESS) {
+        return fmi2Error;
+    }
+
+    const long steps = nsteps - m->stiffnessSteps;
+    const long failures = nncfails - m->stiffnessFailures;
+
+    if (steps < STIFFNESS_MIN_STEPS) {
+        return fmi2OK;
+    }
+
+    m->stiffnessSteps = nsteps;
+    m->stiffnessFailures = nncfails;
+
+    if (failures <= STIFFNESS_MAX_FAILURES * steps) {
+        return fmi2OK;
+    }
+
+    if (m->loggingOn) {
+        m->logger(m->componentEnvironment, m->instanceName, fmi2OK, "logStatusOK",
+            "Switching from Adams to BDF at t = %g after %ld convergence failures in %ld steps.", t, failures, steps);
+    }
+
+    freeIntegrator(m);
+
+    return createIntegrator(m, METHOD_BDF, t) ? fmi2OK : fmi2Error;
+}
+
 /* Creation and destruction of FMU instances and setting debug status */
 fmi2Component fmi2Instantiate(fmi2String instanceName,
                               fmi2Type fmuType,
@@ -187,7 +1357,10 @@ fmi2Component fmi2Instantiate(fmi2String instanceName,
     Model *m = calloc(1, sizeof(Model));
 
 	m->logger = functions->logger;
+	m->componentEnvironment = functions->componentEnvironment;
 	m->instanceName = strdup(instanceName);
+	m->loggingOn = loggingOn;
+	m->reltol = RTOL;
     
 #ifdef _WIN32
 	char path[MAX_PATH];
@@ -295,6 +1468,15 @@ fmi2Component fmi2Instantiate(fmi2String instanceName,
 
     m->c = m->fmi2Instantiate(instanceName, fmi2ModelExchange, fmuGUID, fmuResourceLocation, functions, visible, loggingOn); 
 	ASSERT_NOT_NULL(m->c)
+
+    m->method = METHOD_BDF;
+    m->linearSolver = LINEAR_SOLVER_AUTO;
+
+    char path[PATH_LENGTH];
+
+    if (resourcePath(fmuResourceLocation, "cswrapper.txt", path)) {
+        m->structure = readConfiguration(m, path);
+    }
     
     if (m->nx > 0) {
         m->x = N_VNew_Serial(m->nx);
@@ -302,42 +1484,17 @@ fmi2Component fmi2Instantiate(fmi2String instanceName,
         for (size_t i = 0; i < m->nx; i++) {
             NV_DATA_S(m->abstol)[i] = RTOL;
         }
-        m->A = SUNDenseMatrix(m->nx, m->nx);
     } else  {
         m->x = N_VNew_Serial(1);
         m->abstol = N_VNew_Serial(1);
         NV_DATA_S(m->abstol)[0] = RTOL;
-        m->A = SUNDenseMatrix(1, 1);
     }
-    
-    m->cvode_mem = CVodeCreate(CV_BDF);
-    
-	int flag;
-		
-	flag = CVodeInit(m->cvode_mem, f, 0, m->x);
-	ASSERT_CV_SUCCESS(flag)
-
-    flag = CVodeSVtolerances(m->cvode_mem, RTOL, m->abstol);
-	ASSERT_CV_SUCCESS(flag)
 
-    if (m->nz > 0) {
-        flag = CVodeRootInit(m->cvode_mem, (int)m->nz, g);
-		ASSERT_CV_SUCCESS(flag)
-    }
+    m->cache.states = calloc(m->nx > 0 ? m->nx : 1, sizeof(realtype));
+    m->cache.derivatives = calloc(m->nx > 0 ? m->nx : 1, sizeof(realtype));
+    m->cache.eventIndicators = calloc(m->nz > 0 ? m->nz : 1, sizeof(realtype));
     
-    m->LS = SUNLinSol_Dense(m->x, m->A);
-
-    flag = CVodeSetLinearSolver(m->cvode_mem, m->LS, m->A);
-	ASSERT_CV_SUCCESS(flag)
-
-	flag = CVodeSetNoInactiveRootWarn(m->cvode_mem);
-	ASSERT_CV_SUCCESS(flag)
-
-	flag = CVodeSetErrHandlerFn(m->cvode_mem, ehfun, NULL);
-	ASSERT_CV_SUCCESS(flag)
-
-    flag = CVodeSetUserData(m->cvode_mem, m);
-	ASSERT_CV_SUCCESS(flag)
+    ASSERT_NOT_NULL(createIntegrator(m, m->method == METHOD_AUTO ? METHOD_ADAMS : m->method, 0))
 
     return m;
 }
@@ -359,14 +1516,14 @@ void fmi2FreeInstance(fmi2Component c) {
 	N_VDestroy(m->x);
 	N_VDestroy(m->abstol);
 
-	/* Free integrator memory */
-	CVodeFree(&m->cvode_mem);
+	/* Free the integrator, linear solver and matrix memory */
+	freeIntegrator(m);
 
-	/* Free the linear solver memory */
-	SUNLinSolFree(m->LS);
+	freeStructure(m->structure);
 
-	/* Free the matrix memory */
-	SUNMatDestroy(m->A);
+	free(m->cache.states);
+	free(m->cache.derivatives);
+	free(m->cache.eventIndicators);
 
     free(m);
 }
@@ -380,6 +1537,8 @@ fmi2Status fmi2SetupExperiment(fmi2Component c,
                                fmi2Real stopTime) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    m->reltol = toleranceDefined && tolerance > 0 ? tolerance : RTOL;
+    m->startTime = startTime;
     return m->fmi2SetupExperiment(m->c, toleranceDefined, tolerance, startTime, stopTimeDefined, stopTime);
 }
 
@@ -394,6 +1553,8 @@ fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
     Model *m = (Model *)c;
     fmi2Status status;
     
+    invalidateCache(m, fmi2True);
+
     status = m->fmi2ExitInitializationMode(m->c);
     if (status > fmi2Warning) { return status; }
     
@@ -403,19 +1564,79 @@ fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
     status = m->fmi2EnterContinuousTimeMode(m->c);
     if (status > fmi2Warning) { return status; }
 
+    if (m->nx > 0) {
+        status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
+        if (status > fmi2Warning) { return status; }
+    }
+
+    status = setTolerances(m);
+    if (status > fmi2Warning) { return status; }
+
+    // start the integration from the initial states
+    if (reinitIntegrator(m, m->startTime) != 0) { return fmi2Error; }
+
     return status;
 }
 
 fmi2Status fmi2Terminate(fmi2Component c) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+
+    if (m->loggingOn) {
+
+        const Statistics *statistics = &m->statistics;
+        const Cache *cache = &m->cache;
+
+        IntegratorCounters counters;
+
+        getTotalCounters(m, &counters);
+
+        m->logger(m->componentEnvironment, m->instanceName, fmi2OK, "logStatusOK",
+            "Integrator statistics (%s): %ld steps, %ld right-hand side evaluations, %ld Jacobian evaluations, "
+            "%ld linear solver setups, %ld error test failures, %ld convergence failures, %ld root function evaluations.",
+            methodNames[m->currentMethod], counters.nSteps, counters.nRhsEvaluations, counters.nJacobianEvaluations,
+            counters.nLinearSolverSetups, counters.nErrorTestFailures, counters.nConvergenceFailures, counters.nRootEvaluations);
+
+        m->logger(m->componentEnvironment, m->instanceName, fmi2OK, "logStatusOK",
+            "Events: %ld state events, %ld time events, %ld step events, %ld re-initializations.",
+            statistics->nStateEvents, statistics->nTimeEvents, statistics->nStepEvents, statistics->nReinitializations);
+
+        m->logger(m->componentEnvironment, m->instanceName, fmi2OK, "logStatusOK",
+            "Set the time and continuous states %zu times (%zu skipped), reused the derivatives %zu times and the event indicators %zu times.",
+            cache->nSets, cache->nSkippedSets, cache->nReusedDerivatives, cache->nReusedEventIndicators);
+
+        m->logger(m->componentEnvironment, m->instanceName, fmi2OK, "logStatusOK",
+            "Wall time in fmi2DoStep(): %g s in the model, %g s in the solver.",
+            statistics->modelTime * 1e-9, (statistics->stepTime - statistics->modelTime) * 1e-9);
+    }
+
     return m->fmi2Terminate(m->c);
 }
 
 fmi2Status fmi2Reset(fmi2Component c) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
-	// TODO: reset solver
+    // the solver is re-initialized in fmi2ExitInitializationMode()
+    m->reltol = RTOL;
+    m->startTime = 0;
+    invalidateCache(m, fmi2True);
+
+    // restart with the Adams method
+    if (m->method == METHOD_AUTO && m->currentMethod != METHOD_ADAMS) {
+        freeIntegrator(m);
+        if (!createIntegrator(m, METHOD_ADAMS, 0)) return fmi2Error;
+    }
+
+    // reset the counters of the integrator before the statistics are cleared
+    if (reinitIntegrator(m, 0) != 0) return fmi2Error;
+
+    memset(&m->statistics, 0, sizeof(Statistics));
+    m->cache.nSets = 0;
+    m->cache.nSkippedSets = 0;
+    m->cache.nReusedDerivatives = 0;
+    m->cache.nReusedEventIndicators = 0;
+    m->lastSuccessfulTime = 0;
+
     return m->fmi2Reset(m->c);
 }
 
@@ -447,24 +1668,28 @@ fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t
 fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real    value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    invalidateCache(m, fmi2False);
     return m->fmi2SetReal(m->c, vr, nvr, value);
 }
 
 fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    invalidateCache(m, fmi2False);
     return m->fmi2SetInteger(m->c, vr, nvr, value);
 }
 
 fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    invalidateCache(m, fmi2False);
     return m->fmi2SetBoolean(m->c, vr, nvr, value);
 }
 
 fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String  value[]) {
     if (!c) return fmi2Error;
     Model *m = (Model *)c;
+    invalidateCache(m, fmi2False);
     return m->fmi2SetString(m->c, vr, nvr, value);
 }
 
@@ -524,13 +1749,7 @@ fmi2Status fmi2GetRealOutputDerivatives(fmi2Component c,
 
 
 
-fmi2Status fmi2DoStep(fmi2Component c,
-                      fmi2Real      currentCommunicationPoint,
-                      fmi2Real      communicationStepSize,
-                      fmi2Boolean   noSetFMUStatePriorToCurrentPoint) {
-    
-    if (!c) return fmi2Error;
-    Model *m = (Model *)c;
+static fmi2Status doStep(Model *m, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize) {
     
     fmi2Status status;
     
@@ -539,7 +1758,7 @@ fmi2Status fmi2DoStep(fmi2Component c,
 	realtype epsilon = (1.0 + fabs(tNext)) * EPSILON;
         
     if (m->nx > 0) {
-        status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
+        MODEL_TIME(m, status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x)))
         if (status > fmi2Warning) return status;
     }
     
@@ -547,59 +1766,84 @@ fmi2Status fmi2DoStep(fmi2Component c,
         
         realtype tout = tNext;
         
-        if (m->eventInfo.nextEventTimeDefined && m->eventInfo.nextEventTime < tNext) {
-            tout = m->eventInfo.nextEventTime;
+        const fmi2Boolean timeEventPending = m->eventInfo.nextEventTimeDefined && m->eventInfo.nextEventTime < tNext + epsilon;
+
+        if (timeEventPending) {
+            tout = fmin(m->eventInfo.nextEventTime, tNext);
         }
+
+        // don't step past time events and communication points where the inputs may change
+        int flag = setStopTime(m, tout);
+        if (flag < 0) return fmi2Error;
     
-        int flag = CVode(m->cvode_mem, tout, m->x, &tret, CV_NORMAL);
+        flag = integrate(m, tout, &tret);
         
         if (flag < 0) {
-            // TODO: ehfn()
             return fmi2Error;
         }
         
-        status = m->fmi2SetTime(m->c, tret);
+        MODEL_TIME(m, status = setPoint(m, tret, m->x))
         if (status > fmi2Warning) return status;
 
-        if (m->nx > 0) {
-            status = m->fmi2SetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
-            if (status > fmi2Warning) return status;
-        }
+        m->lastSuccessfulTime = tret;
         
         fmi2Boolean enterEventMode, terminateSimulation;
         
-        status = m->fmi2CompletedIntegratorStep(m->c, fmi2False, &enterEventMode, &terminateSimulation);
+        MODEL_TIME(m, status = m->fmi2CompletedIntegratorStep(m->c, fmi2False, &enterEventMode, &terminateSimulation))
         if (status > fmi2Warning) return status;
         
         if (terminateSimulation) return fmi2Error;
-        
-        if (flag == CV_ROOT_RETURN || enterEventMode || (m->eventInfo.nextEventTimeDefined && m->eventInfo.nextEventTime == tret)) {
 
-            m->fmi2EnterEventMode(m->c);
-            if (status > fmi2Warning) return status;
+        const fmi2Boolean stateEvent = flag == CV_ROOT_RETURN;
+        const fmi2Boolean timeEvent = timeEventPending && fabs(tret - m->eventInfo.nextEventTime) <= epsilon;
+
+        if (!stateEvent && !timeEvent && !enterEventMode) {
+            continue;
+        }
 
-            do {
-                m->fmi2NewDiscreteStates(m->c, &m->eventInfo);
-                if (status > fmi2Warning) return status;
-            } while (m->eventInfo.newDiscreteStatesNeeded && !m->eventInfo.terminateSimulation);
+        if (stateEvent) m->statistics.nStateEvents++;
+        if (timeEvent) m->statistics.nTimeEvents++;
+        if (enterEventMode) m->statistics.nStepEvents++;
 
-            m->fmi2EnterContinuousTimeMode(m->c);
-            if (status > fmi2Warning) return status;
+        fmi2Boolean statesChanged;
 
-            if (m->nx > 0 && m->eventInfo.valuesOfContinuousStatesChanged) {
-                status = m->fmi2GetContinuousStates(m->c, NV_DATA_S(m->x), NV_LENGTH_S(m->x));
-                if (status > fmi2Warning) return status;
-            }
-            
-            flag = CVodeReInit(m->cvode_mem, tret, m->x);
+        MODEL_TIME(m, status = handleEvent(m, &statesChanged))
+        if (status > fmi2Warning) return status;
+
+        if (m->eventInfo.terminateSimulation) return fmi2Error;
+
+        // CVODE locates roots by interpolation and may already have stepped past the event,
+        // while time and step events end exactly at the stop time and keep the history
+        // of the integrator unless the continuous states have changed
+        if (stateEvent || statesChanged) {
+            flag = reinitIntegrator(m, tret);
             if (flag < 0) return fmi2Error;
+            m->statistics.nReinitializations++;
         }
-        
     }
+
+    if (detectStiffness(m, tret) > fmi2Warning) return fmi2Error;
     
     return status;
 }
 
+fmi2Status fmi2DoStep(fmi2Component c,
+                      fmi2Real      currentCommunicationPoint,
+                      fmi2Real      communicationStepSize,
+                      fmi2Boolean   noSetFMUStatePriorToCurrentPoint) {
+
+    if (!c) return fmi2Error;
+    Model *m = (Model *)c;
+
+    const uint64_t start = wallClock();
+
+    const fmi2Status status = doStep(m, currentCommunicationPoint, communicationStepSize);
+
+    m->statistics.stepTime += wallClock() - start;
+
+    return status;
+}
+
 fmi2Status fmi2CancelStep(fmi2Component c) {
     return fmi2Error;
 }
@@ -610,11 +1854,58 @@ fmi2Status fmi2GetStatus(fmi2Component c, const fmi2StatusKind s, fmi2Status*  v
 }
 
 fmi2Status fmi2GetRealStatus(fmi2Component c, const fmi2StatusKind s, fmi2Real*    value) {
-    return fmi2Error;
+
+    if (!c || !value) return fmi2Error;
+    Model *m = (Model *)c;
+
+    const Statistics *statistics = &m->statistics;
+
+    switch ((int)s) {
+    case fmi2LastSuccessfulTime:
+        *value = m->lastSuccessfulTime;
+        return fmi2OK;
+    case STATUS_MODEL_TIME:
+        *value = statistics->modelTime * 1e-9;
+        return fmi2OK;
+    case STATUS_SOLVER_TIME:
+        *value = (statistics->stepTime - statistics->modelTime) * 1e-9;
+        return fmi2OK;
+    default:
+        return fmi2Error;
+    }
 }
 
 fmi2Status fmi2GetIntegerStatus(fmi2Component c, const fmi2StatusKind s, fmi2Integer* value) {
-    return fmi2Error;
+
+    if (!c || !value) return fmi2Error;
+    Model *m = (Model *)c;
+
+    const Statistics *statistics = &m->statistics;
+    const Cache *cache = &m->cache;
+
+    IntegratorCounters counters;
+
+    getTotalCounters(m, &counters);
+
+    switch ((int)s) {
+    case STATUS_NUMBER_OF_STEPS:                  *value = (fmi2Integer)counters.nSteps; break;
+    case STATUS_NUMBER_OF_RHS_EVALUATIONS:        *value = (fmi2Integer)counters.nRhsEvaluations; break;
+    case STATUS_NUMBER_OF_LINEAR_SOLVER_SETUPS:   *value = (fmi2Integer)counters.nLinearSolverSetups; break;
+    case STATUS_NUMBER_OF_ERROR_TEST_FAILURES:    *value = (fmi2Integer)counters.nErrorTestFailures; break;
+    case STATUS_NUMBER_OF_CONVERGENCE_FAILURES:   *value = (fmi2Integer)counters.nConvergenceFailures; break;
+    case STATUS_NUMBER_OF_JACOBIAN_EVALUATIONS:   *value = (fmi2Integer)counters.nJacobianEvaluations; break;
+    case STATUS_NUMBER_OF_ROOT_EVALUATIONS:       *value = (fmi2Integer)counters.nRootEvaluations; break;
+    case STATUS_NUMBER_OF_STATE_EVENTS:           *value = (fmi2Integer)statistics->nStateEvents; break;
+    case STATUS_NUMBER_OF_TIME_EVENTS:            *value = (fmi2Integer)statistics->nTimeEvents; break;
+    case STATUS_NUMBER_OF_STEP_EVENTS:            *value = (fmi2Integer)statistics->nStepEvents; break;
+    case STATUS_NUMBER_OF_REINITIALIZATIONS:      *value = (fmi2Integer)statistics->nReinitializations; break;
+    case STATUS_NUMBER_OF_SKIPPED_SETS:           *value = (fmi2Integer)cache->nSkippedSets; break;
+    case STATUS_NUMBER_OF_REUSED_DERIVATIVES:     *value = (fmi2Integer)cache->nReusedDerivatives; break;
+    case STATUS_NUMBER_OF_REUSED_EVENT_INDICATORS: *value = (fmi2Integer)cache->nReusedEventIndicators; break;
+    default: return fmi2Error;
+    }
+
+    return fmi2OK;
 }
 
 fmi2Status fmi2GetBooleanStatus(fmi2Component c, const fmi2StatusKind s, fmi2Boolean* value) {
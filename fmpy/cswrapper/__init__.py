@@ -1,12 +1,58 @@
-
-
-def add_cswrapper(filename, outfilename=None):
+SOLVERS = ['auto', 'adams', 'bdf', 'erk', 'ark']
+
+LINEAR_SOLVERS = ['auto', 'dense', 'band', 'sparse', 'spgmr']
+
+# vendor specific status kinds for fmi2GetIntegerStatus() (see IntegerStatusKind in cswrapper.c)
+INTEGER_STATUS_KINDS = {
+    'steps': 1000,
+    'rhs_evaluations': 1001,
+    'linear_solver_setups': 1002,
+    'error_test_failures': 1003,
+    'convergence_failures': 1004,
+    'jacobian_evaluations': 1005,
+    'root_evaluations': 1006,
+    'state_events': 1007,
+    'time_events': 1008,
+    'step_events': 1009,
+    'reinitializations': 1010,
+    'skipped_sets': 1011,
+    'reused_derivatives': 1012,
+    'reused_event_indicators': 1013,
+}
+
+# vendor specific status kinds for fmi2GetRealStatus() (see RealStatusKind in cswrapper.c)
+REAL_STATUS_KINDS = {
+    'model_time': 1100,
+    'solver_time': 1101,
+}
+
+
+def add_cswrapper(filename, outfilename=None, solver='bdf', linear_solver='auto'):
+    """ Add a Co-Simulation interface to an FMI 2.0 Model Exchange FMU
+
+    Parameters:
+        filename       filename of the FMU
+        outfilename    filename of the output FMU (default: overwrite the FMU)
+        solver         integration method: 'bdf' (CVODE BDF), 'adams' (CVODE Adams-Moulton), 'erk' (ARKODE
+                       explicit Runge-Kutta), 'ark' (ARKODE implicit Runge-Kutta) or 'auto' (start with Adams
+                       and switch to BDF when the model becomes stiff)
+        linear_solver  linear solver for 'bdf' and 'ark': 'dense', 'band', 'sparse' (requires KLU), 'spgmr'
+                       (matrix-free Krylov) or 'auto' (dense, band or sparse depending on the sparsity pattern).
+                       The binaries built by build_cvode.py don't include KLU, so 'sparse' falls back to 'dense'
+                       and 'auto' selects 'band' or 'dense' for patterns that are not banded.
+    """
 
     from fmpy import read_model_description, extract, sharedLibraryExtension, platform, __version__
     from lxml import etree
     import os
     from shutil import copyfile, rmtree
 
+    if solver not in SOLVERS:
+        raise Exception("solver must be one of %s." % ', '.join(SOLVERS))
+
+    if linear_solver not in LINEAR_SOLVERS:
+        raise Exception("linear_solver must be one of %s." % ', '.join(LINEAR_SOLVERS))
+
     if outfilename is None:
         outfilename = filename
 
@@ -48,6 +94,13 @@ def add_cswrapper(filename, outfilename=None):
 
     tree.write(xml, pretty_print=True, encoding='utf-8')
 
+    resources_dir = os.path.join(unzipdir, 'resources')
+
+    if not os.path.isdir(resources_dir):
+        os.mkdir(resources_dir)
+
+    write_configuration(root, model_description, os.path.join(resources_dir, 'cswrapper.txt'), solver, linear_solver)
+
     shared_library = os.path.join(os.path.dirname(__file__), 'cswrapper' + sharedLibraryExtension)
     license_file = os.path.join(os.path.dirname(__file__), 'license.txt')
 
@@ -64,6 +117,82 @@ def add_cswrapper(filename, outfilename=None):
     rmtree(unzipdir, ignore_errors=True)
 
 
+def write_configuration(root, model_description, filename, solver='bdf', linear_solver='auto'):
+    """ Write the configuration of the wrapper with the solver, the value references of the continuous states and
+    derivatives and the sparsity pattern of the Jacobian d der(x) / d x
+
+    Parameters:
+        root                the root element of the modelDescription.xml
+        model_description   the model description of the wrapped FMU
+        filename            the filename of the configuration to write
+        solver              the integration method (see add_cswrapper())
+        linear_solver       the linear solver (see add_cswrapper())
+    """
+
+    variables = root.findall('ModelVariables/ScalarVariable')
+
+    states = []
+    derivatives = []
+    dependencies = []
+
+    # indices (1-based) of the states in ModelVariables -> indices in the state vector
+    state_indices = {}
+
+    for unknown in root.findall('ModelStructure/Derivatives/Unknown'):
+        index = int(unknown.get('index'))
+        derivative = variables[index - 1]
+        state_index = int(derivative.find('Real').get('derivative'))
+        state_indices[state_index] = len(states)
+        states.append(int(variables[state_index - 1].get('valueReference')))
+        derivatives.append(int(derivative.get('valueReference')))
+        dependencies.append(unknown.get('dependencies'))
+
+    with open(filename, 'w') as f:
+
+        f.write('# FMPy Co-Simulation wrapper\n')
+
+        f.write('solver %s\n' % solver)
+        f.write('linearSolver %s\n' % linear_solver)
+
+        f.write('providesDirectionalDerivative %d\n' % model_description.modelExchange.providesDirectionalDerivative)
+
+        f.write('states %d %s\n' % (len(states), ' '.join(map(str, states))))
+        f.write('derivatives %d %s\n' % (len(derivatives), ' '.join(map(str, derivatives))))
+
+        for row, d in enumerate(dependencies):
+
+            if d is None:
+                # the derivative may depend on all states
+                columns = range(len(states))
+            else:
+                # dependencies on variables other than the states (e.g. inputs) are not part of the Jacobian
+                columns = sorted(set(state_indices[int(i)] for i in d.split() if int(i) in state_indices))
+
+            f.write('dependencies %d %d %s\n' % (row, len(columns), ' '.join(map(str, columns))))
+
+
+def get_statistics(fmu):
+    """ Get the integrator statistics and the wall time spent in the model and the solver of an instance of an FMU
+    with the Co-Simulation wrapper
+
+    Parameters:
+        fmu  an instantiated FMU2Slave
+
+    Returns:
+        a dictionary with the counters of INTEGER_STATUS_KINDS and the times in seconds of REAL_STATUS_KINDS
+    """
+
+    statistics = {}
+
+    for name, kind in INTEGER_STATUS_KINDS.items():
+        statistics[name] = fmu.getIntegerStatus(kind).value
+
+    for name, kind in REAL_STATUS_KINDS.items():
+        statistics[name] = fmu.getRealStatus(kind).value
+
+    return statistics
+
+
 def create_zip_archive(filename, source_dir):
 
     import zipfile
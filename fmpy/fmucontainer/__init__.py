@@ -1,9 +1,174 @@
 from tempfile import mkdtemp
 
 
+# layout of the compiled configuration (config.bin) that must match CONFIG_VERSION and the
+# structs of the same names in FMUContainer.c (little-endian, see tests/test_fmu_container.py)
+CONFIG_ID = b'FMUCCFG1'
+CONFIG_VERSION = 6
+CONFIG_BYTE_ORDER = 0x01020304
+CONFIG_FORMATS = {
+    'ConfigHeader': '<8sIIIIQQQQQQQQQQQQQQd',
+    'ComponentConfig': '<QQQQQdII',
+    'VariableMapping': '<QII',
+    'Connection': '<QQIIcBBcIdd',
+    'LoopConfig': '<QQIIdd',
+    'RecordedVariableConfig': '<QQII',
+}
+
+
+def write_compiled_config(data, filename):
+    """ Write the configuration of an FMU container in the compiled format (config.bin) that is
+    memory-mapped by the container and used in place (see FMUContainer.c for the layout) """
+
+    import struct
+
+    strings = bytearray()
+    string_offsets = {}
+
+    def string(value):
+        if value not in string_offsets:
+            string_offsets[value] = len(strings)
+            strings.extend(value.encode('utf-8') + b'\0')
+        return string_offsets[value]
+
+    components = bytearray()
+
+    for component in data['components']:
+        flags = 0
+        if component.get('threadSafe', True):
+            flags |= 0x1
+        if component.get('interpolation', False):
+            flags |= 0x2
+        if component.get('isolate', False):
+            flags |= 0x4
+        if component.get('canInterpolateInputs', False):
+            flags |= 0x8
+        if component.get('providesDirectionalDerivative', False):
+            flags |= 0x10
+        if component.get('fmiVersion', 2) == 3:
+            flags |= 0x20
+        if component.get('eventMode', False):
+            flags |= 0x40
+        components += struct.pack(CONFIG_FORMATS['ComponentConfig'],
+                                  string(component['name']),
+                                  string(component['guid']),
+                                  string(component['modelIdentifier']),
+                                  string(component.get('directory', component['modelIdentifier'])),
+                                  component.get('rate', 1),
+                                  component.get('stepSize', 0.0),
+                                  flags, 0)
+
+    variables = bytearray()
+
+    for variable in data['variables']:
+        variables += struct.pack(CONFIG_FORMATS['VariableMapping'], variable['component'], variable['valueReference'], 0)
+
+    connections = bytearray()
+
+    for connection in data['connections']:
+        connections += struct.pack(CONFIG_FORMATS['Connection'],
+                                   connection['startComponent'],
+                                   connection['endComponent'],
+                                   connection['startValueReference'],
+                                   connection['endValueReference'],
+                                   connection['type'][0].encode('ascii'),
+                                   1 if connection.get('break', False) else 0,
+                                   connection.get('order', 0),
+                                   connection.get('endType', connection['type'])[0].encode('ascii'),
+                                   connection.get('size', 1),
+                                   connection.get('factor', 1.0),
+                                   connection.get('offset', 0.0))
+
+    loops = bytearray()
+    loop_components = bytearray()
+
+    for loop in data.get('loops', []):
+        loops += struct.pack(CONFIG_FORMATS['LoopConfig'],
+                             len(loop['components']),
+                             len(loop_components),  # relative to the component indices, see below
+                             1 if loop.get('method') == 'broyden' else 0,
+                             loop.get('maxIterations', 20),
+                             loop.get('tolerance', 1e-6),
+                             loop.get('relaxation', 1.0))
+        for index in loop['components']:
+            loop_components += struct.pack('<Q', index)
+
+    recorder = data.get('recorder')
+    recorded_variables = bytearray()
+    recorder_filename = 0
+    recorder_interval = 0.0
+
+    if recorder is not None:
+        recorder_filename = string(recorder['filename'])
+        recorder_interval = recorder.get('interval', 0.0)
+        for variable in recorder['variables']:
+            recorded_variables += struct.pack(CONFIG_FORMATS['RecordedVariableConfig'],
+                                              variable['variable'],
+                                              string(variable['name']),
+                                              ord(variable['type'][0]), 0)
+
+    flags = 0
+    if data.get('algorithm') == 'gauss-seidel':
+        flags |= 0x1
+    if data.get('parallelDoStep', False):
+        flags |= 0x2
+    if data.get('parallelInstantiation', False):
+        flags |= 0x4
+    if data.get('asyncDoStep', False):
+        flags |= 0x8
+    if recorder is not None:
+        flags |= 0x10
+
+    def align(size):
+        return (size + 7) // 8 * 8
+
+    header_size = struct.calcsize(CONFIG_FORMATS['ConfigHeader'])
+    loop_size = struct.calcsize(CONFIG_FORMATS['LoopConfig'])
+    components_offset = header_size
+    variables_offset = components_offset + len(components)
+    connections_offset = variables_offset + len(variables)
+    loops_offset = connections_offset + len(connections)
+    loop_components_offset = loops_offset + len(loops)
+    recorded_variables_offset = loop_components_offset + len(loop_components)
+    strings_offset = recorded_variables_offset + len(recorded_variables)
+
+    # make the offsets of the component indices absolute
+    for i in range(len(data.get('loops', []))):
+        offset, = struct.unpack_from('<Q', loops, i * loop_size + 8)
+        struct.pack_into('<Q', loops, i * loop_size + 8, loop_components_offset + offset)
+
+    header = struct.pack(CONFIG_FORMATS['ConfigHeader'],
+                         CONFIG_ID, CONFIG_VERSION, CONFIG_BYTE_ORDER, flags, 0,
+                         data.get('threads', 0),
+                         len(data['components']), components_offset,
+                         len(data['variables']), variables_offset,
+                         len(data['connections']), connections_offset,
+                         len(data.get('loops', [])), loops_offset,
+                         len(strings), strings_offset,
+                         len(recorder['variables']) if recorder is not None else 0, recorded_variables_offset,
+                         recorder_filename, recorder_interval)
+
+    with open(filename, 'wb') as f:
+        f.write(header)
+        f.write(components)
+        f.write(variables)
+        f.write(connections)
+        f.write(loops)
+        f.write(loop_components)
+        f.write(recorded_variables)
+        f.write(strings)
+        f.write(b'\0' * (align(len(strings)) - len(strings)))
+
+
 def create_fmu_container(configuration, output_filename):
     """ Create an FMU from nested FMUs (experimental)
 
+        Components that are FMU containers themselves are flattened: their components, connections and
+        loops are added to this container and scheduled with its algorithm, so the connections resolve
+        directly between the innermost FMUs. Their algorithm and asyncDoStep must match the ones of this
+        container, their parallelDoStep and parallelInstantiation are enabled for the whole container and
+        their recorded variables are added to the recorder of this container.
+
         see tests/test_fmu_container.py for an example
     """
 
@@ -12,12 +177,46 @@ def create_fmu_container(configuration, output_filename):
     import fmpy
     from fmpy import read_model_description, extract
     import msgpack
+    import hashlib
+    import zipfile
     from datetime import datetime
+    from lxml import etree
     import pytz
 
+    # types of FMI 3.0 variables that are transferred as the FMI 2.0 types of the container
+    fmi2_types = {'Float64': 'Real', 'Int32': 'Integer', 'Boolean': 'Boolean', 'String': 'String',
+                  'Real': 'Real', 'Integer': 'Integer', 'Enumeration': 'Enumeration'}
+
+    def fmi2_type(variable):
+        if variable.type not in fmi2_types:
+            raise Exception('Variable "%s" has the unsupported type %s.' % (variable.name, variable.type))
+        return fmi2_types[variable.type]
+
+    # capability flags of the Co-Simulation interface (FMI 2.0 name -> FMI 3.0 name)
+    capability_names = {'canGetAndSetFMUstate': 'canGetAndSetFMUState',
+                        'canSerializeFMUstate': 'canSerializeFMUState',
+                        'providesDirectionalDerivative': 'providesDirectionalDerivatives'}
+
+    def read_capabilities(filename, model_description):
+        # the model description only has the attributes with the FMI 2.0 names
+        if not model_description.fmiVersion.startswith('3.'):
+            return dict((name, getattr(model_description.coSimulation, name)) for name in capability_names)
+        with zipfile.ZipFile(filename) as zf:
+            co_simulation = etree.fromstring(zf.read('modelDescription.xml')).find('CoSimulation')
+        return dict((name, co_simulation.get(fmi3_name) == 'true') for name, fmi3_name in capability_names.items())
+
+    def size(variable):
+        n = 1
+        for dimension in variable.shape:
+            n *= dimension
+        return n
+
     base_filename, _ = os.path.splitext(output_filename)
     model_name = os.path.basename(base_filename)
 
+    if configuration.get('algorithm', 'jacobi') not in {'jacobi', 'gauss-seidel'}:
+        raise Exception('Unknown algorithm "%s". The algorithm must be "jacobi" or "gauss-seidel".' % configuration['algorithm'])
+
     unzipdir = mkdtemp()
 
     basedir = os.path.dirname(__file__)
@@ -28,15 +227,91 @@ def create_fmu_container(configuration, output_filename):
     os.mkdir(os.path.join(unzipdir, 'resources'))
 
     data = {
+        'algorithm': configuration.get('algorithm', 'jacobi'),
+        'parallelDoStep': configuration.get('parallelDoStep', False),
+        'parallelInstantiation': configuration.get('parallelInstantiation', False),
+        'asyncDoStep': configuration.get('asyncDoStep', False),
         'components': [],
         'variables': [],
         'connections': []
     }
 
+    if 'threads' in configuration:
+        data['threads'] = configuration['threads']
+
     l = []
 
     component_map = {}
+    capabilities = []  # capability flags of the components (see read_capabilities())
+    directories = {}  # (modelIdentifier, SHA-256 of the FMU) -> directory in resources
     vi = 0  # variable index
+    container_variables = {}  # name -> (variable index, type) of the exposed variables
+    nested_recorders = []  # (component name, component offset, variables, recorder) of the nested containers
+    outputs = []  # indices (1-based) of the exposed outputs
+    initial_unknowns = []  # indices (1-based) of the exposed variables that are calculated during initialization
+
+    def add_directory(fmu_key, source):
+        # extract identical FMUs only once so the components share the shared library
+        if fmu_key not in directories:
+            directory = fmu_key[0]
+            if directory in directories.values():
+                directory += '_' + fmu_key[1][:8]
+            directories[fmu_key] = directory
+            if os.path.isdir(source):
+                shutil.copytree(source, os.path.join(unzipdir, 'resources', directory))
+            else:
+                extract(source, os.path.join(unzipdir, 'resources', directory))
+        return directories[fmu_key]
+
+    def add_nested_container(component, fmu_hash):
+        # flatten the components, connections and loops of a nested container into this container
+        # so the connections resolve directly between the innermost FMUs
+        nested_dir = extract(component['filename'])
+        with open(os.path.join(nested_dir, 'resources', 'config.mp'), 'rb') as f:
+            nested = msgpack.unpackb(f.read())
+        for key, default in [('algorithm', 'jacobi'), ('asyncDoStep', False)]:
+            if nested.get(key, default) != data[key]:
+                raise Exception('The %s of the nested container "%s" (%s) differs from the %s of the container (%s).'
+                                % (key, component['name'], nested.get(key, default), key, data[key]))
+        # the nested components can be instantiated and stepped in parallel like in the nested container
+        for key in ['parallelDoStep', 'parallelInstantiation']:
+            data[key] = data[key] or nested.get(key, False)
+        offset = len(data['components'])
+        if 'recorder' in nested:
+            nested_recorders.append((component['name'], offset, nested['variables'], nested['recorder']))
+        for nested_component in nested['components']:
+            nested_component = dict(nested_component)
+            nested_directory = nested_component.get('directory', nested_component['modelIdentifier'])
+            fmu_key = (nested_component['modelIdentifier'], fmu_hash + '/' + nested_directory)
+            nested_component['directory'] = add_directory(fmu_key, os.path.join(nested_dir, 'resources', nested_directory))
+            nested_component['name'] = component['name'] + '.' + nested_component['name']
+            nested_component['threadSafe'] = nested_component.get('threadSafe', True) and component.get('threadSafe', True)
+            nested_component['isolate'] = nested_component.get('isolate', False) or component.get('isolate', False)
+            # steps of the nested components per communication step of this container
+            if 'stepSize' not in nested_component:
+                if 'stepSize' in component:
+                    nested_component['stepSize'] = component['stepSize'] / nested_component.get('rate', 1)
+                    nested_component.pop('rate', None)
+                else:
+                    nested_component['rate'] = component.get('rate', 1) * nested_component.get('rate', 1)
+            data['components'].append(nested_component)
+        for connection in nested['connections']:
+            connection = dict(connection)
+            connection['startComponent'] += offset
+            connection['endComponent'] += offset
+            data['connections'].append(connection)
+        for loop in nested.get('loops', []):
+            data.setdefault('loops', []).append(dict(loop, components=[offset + index for index in loop['components']]))
+        shutil.rmtree(nested_dir, ignore_errors=True)
+        return nested['variables']
+
+    def resolve(component_name, variable):
+        # index of the component and value reference of a variable of a component or nested container
+        index, _, _, nested_variables = component_map[component_name]
+        if nested_variables is None:
+            return index, variable.valueReference
+        mapping = nested_variables[variable.valueReference]
+        return index + mapping['component'], mapping['valueReference']
 
     l.append('<?xml version="1.0" encoding="UTF-8"?>')
     l.append('<fmiModelDescription')
@@ -48,28 +323,54 @@ def create_fmu_container(configuration, output_filename):
     l.append('  generationTool="FMPy %s FMU Container"' % fmpy.__version__)
     l.append('  generationDateAndTime="%s">' % datetime.now(pytz.utc).isoformat())
     l.append('')
+    co_simulation_index = len(l)
     l.append('  <CoSimulation modelIdentifier="FMUContainer">')
     l.append('    <SourceFiles>')
     l.append('      <File name="FMUContainer.c"/>')
     l.append('      <File name="mpack.c"/>')
+    l.append('      <File name="ThreadPool.c"/>')
+    l.append('      <File name="Recorder.c"/>')
     l.append('    </SourceFiles>')
     l.append('  </CoSimulation>')
     l.append('')
     l.append('  <ModelVariables>')
-    for i, component in enumerate(configuration['components']):
+    for component in configuration['components']:
         model_description = read_model_description(component['filename'])
+        capabilities.append(read_capabilities(component['filename'], model_description))
         model_identifier = model_description.coSimulation.modelIdentifier
-        extract(component['filename'], os.path.join(unzipdir, 'resources', model_identifier))
+        is_fmi3 = model_description.fmiVersion.startswith('3.')
+        with open(component['filename'], 'rb') as f:
+            fmu_key = (model_identifier, hashlib.sha256(f.read()).hexdigest())
         variables = dict((v.name, v) for v in model_description.modelVariables)
-        component_map[component['name']] = (i, variables)
-        data['components'].append({
-            'name': component['name'],
-            'guid': model_description.guid,
-            'modelIdentifier': model_identifier,
-        })
+        with zipfile.ZipFile(component['filename']) as zf:
+            is_container = model_identifier == 'FMUContainer' and 'resources/config.mp' in zf.namelist()
+        offset = len(data['components'])
+        if is_container:
+            nested_variables = add_nested_container(component, fmu_key[1])
+            component_map[component['name']] = (offset, variables, len(data['components']) - offset, nested_variables)
+        else:
+            component_map[component['name']] = (offset, variables, 1, None)
+            data['components'].append({
+                'name': component['name'],
+                'guid': model_description.guid,
+                'modelIdentifier': model_identifier,
+                'directory': add_directory(fmu_key, component['filename']),
+                'threadSafe': component.get('threadSafe', True),
+                'canInterpolateInputs': model_description.coSimulation.canInterpolateInputs and not is_fmi3,
+                'providesDirectionalDerivative': capabilities[-1]['providesDirectionalDerivative'],
+                'fmiVersion': 3 if is_fmi3 else 2,
+            })
+            # optional number of steps per communication step or step size, interpolation of slower inputs,
+            # loading of a private copy of the shared library and the event mode of FMI 3.0 components
+            for key in ['rate', 'stepSize', 'interpolation', 'isolate', 'eventMode']:
+                if key in component:
+                    data['components'][-1][key] = component[key]
         for name in component['variables']:
             v = variables[name]
-            data['variables'].append({'component': i, 'valueReference': v.valueReference})
+            if size(v) != 1:
+                raise Exception('Array variable "%s" can only be connected.' % name)
+            ci, vr = resolve(component['name'], v)
+            data['variables'].append({'component': ci, 'valueReference': vr})
             name = component['name'] + '.' + v.name
             description = v.description
             if name in configuration['variables']:
@@ -80,24 +381,108 @@ def create_fmu_container(configuration, output_filename):
                     description = mapping['description']
             description = ' description="%s"' % description if description else ''
             l.append('    <ScalarVariable name="%s" valueReference="%d" causality="%s" variability="%s"%s>' % (name, vi, v.causality, v.variability, description))
-            l.append('      <%s%s/>' % (v.type, ' start="%s"' % v.start if v.start else ''))
+            l.append('      <%s%s/>' % (fmi2_type(v), ' start="%s"' % v.start if v.start else ''))
             l.append('    </ScalarVariable>')
+            container_variables[name] = (vi, fmi2_type(v))
+            if v.causality == 'output':
+                outputs.append(vi + 1)
+            if (v.causality == 'output' and v.initial in {None, 'approx', 'calculated'}) or v.causality == 'calculatedParameter':
+                initial_unknowns.append(vi + 1)
             vi += 1
     l.append('  </ModelVariables>')
+
+    # the container supports FMU states if all components do and directional derivatives
+    # through the components' directional derivatives or finite differences
+    attributes = ' providesDirectionalDerivative="true"'
+    if data['asyncDoStep']:
+        attributes += ' canRunAsynchronuously="true"'
+    for capability in ['canGetAndSetFMUstate', 'canSerializeFMUstate']:
+        if all(c[capability] for c in capabilities):
+            attributes += ' %s="true"' % capability
+    l[co_simulation_index] = '  <CoSimulation modelIdentifier="FMUContainer"%s>' % attributes
     l.append('')
-    l.append('  <ModelStructure/>')
+    # the outputs may depend on all inputs of the container
+    if outputs or initial_unknowns:
+        l.append('  <ModelStructure>')
+        if outputs:
+            l.append('    <Outputs>')
+            for index in outputs:
+                l.append('      <Unknown index="%d"/>' % index)
+            l.append('    </Outputs>')
+        if initial_unknowns:
+            l.append('    <InitialUnknowns>')
+            for index in initial_unknowns:
+                l.append('      <Unknown index="%d"/>' % index)
+            l.append('    </InitialUnknowns>')
+        l.append('  </ModelStructure>')
+    else:
+        l.append('  <ModelStructure/>')
     l.append('')
     l.append('</fmiModelDescription>')
 
-    for sc, sv, ec, ev in configuration['connections']:
+    for connection in configuration['connections']:
+        sc, sv, ec, ev = connection[:4]
+        options = connection[4] if len(connection) > 4 else {}
+        start_variable = component_map[sc][1][sv]
+        end_variable = component_map[ec][1][ev]
+        # real arrays of FMI 3.0 components are transferred with a single call
+        if size(start_variable) != size(end_variable):
+            raise Exception('The variables %s.%s and %s.%s have different sizes.' % (sc, sv, ec, ev))
+        if size(start_variable) != 1 and start_variable.type != 'Float64':
+            raise Exception('Only arrays of type Float64 can be connected.')
+        start_component, start_value_reference = resolve(sc, start_variable)
+        end_component, end_value_reference = resolve(ec, end_variable)
         data['connections'].append({
-            'type': component_map[sc][1][sv].type,
-            'startComponent': component_map[sc][0],
-            'endComponent': component_map[ec][0],
-            'startValueReference': component_map[sc][1][sv].valueReference,
-            'endValueReference': component_map[ec][1][ev].valueReference,
+            'type': fmi2_type(start_variable),
+            'endType': fmi2_type(end_variable),  # the value is cast if the types differ
+            'size': size(start_variable),
+            'startComponent': start_component,
+            'endComponent': end_component,
+            'startValueReference': start_value_reference,
+            'endValueReference': end_value_reference,
+            'break': options.get('break', False),
+            'order': options.get('order', 0),
+            # linear transformation factor * value + offset, e.g. for unit conversions
+            'factor': float(options.get('factor', 1.0)),
+            'offset': float(options.get('offset', 0.0)),
         })
 
+    # optional loops of components that are iterated until their coupled real variables agree
+    for loop in configuration.get('loops', []):
+        # the components are restored to the start of the step for every iteration
+        for name in loop['components']:
+            index = [component['name'] for component in configuration['components']].index(name)
+            if not capabilities[index]['canGetAndSetFMUstate']:
+                raise Exception('The component "%s" of the loop does not support FMU states.' % name)
+        options = dict((key, value) for key, value in loop.items() if key != 'components')
+        components = [component_map[name][0] + i for name in loop['components'] for i in range(component_map[name][2])]
+        data.setdefault('loops', []).append(dict(components=components, **options))
+
+    # optional native recorder that writes the exposed variables to a NumPy file (see read_recording())
+    if 'recorder' in configuration or nested_recorders:
+        if 'recorder' in configuration:
+            recorder = configuration['recorder']
+        else:
+            # without a recorder of its own the container writes to the file of the first nested recorder
+            recorder = dict(nested_recorders[0][3], variables=[])
+        data['recorder'] = {
+            'filename': recorder['filename'],
+            'interval': float(recorder.get('interval', 0.0)),  # 0 = every micro step
+            'variables': [],
+        }
+        for name in recorder['variables']:
+            index, variable_type = container_variables[name]
+            if variable_type == 'String':
+                raise Exception('The string variable "%s" cannot be recorded.' % name)
+            data['recorder']['variables'].append({'variable': index, 'type': variable_type, 'name': name})
+        # the variables recorded by nested containers are mapped to (unexposed) variables of this container
+        for component_name, offset, nested_variables, nested_recorder in nested_recorders:
+            for variable in nested_recorder['variables']:
+                mapping = nested_variables[variable['variable']]
+                data['variables'].append({'component': offset + mapping['component'], 'valueReference': mapping['valueReference']})
+                data['recorder']['variables'].append({'variable': len(data['variables']) - 1, 'type': variable['type'],
+                                                      'name': component_name + '.' + variable['name']})
+
     with open(os.path.join(unzipdir, 'modelDescription.xml'), 'w') as f:
         f.write('\n'.join(l) + '\n')
 
@@ -105,6 +490,10 @@ def create_fmu_container(configuration, output_filename):
         packed = msgpack.packb(data)
         f.write(packed)
 
+    # optional compiled configuration that is used instead of config.mp
+    if configuration.get('compileConfig', False):
+        write_compiled_config(data, os.path.join(unzipdir, 'resources', 'config.bin'))
+
     shutil.make_archive(base_filename, 'zip', unzipdir)
 
     if os.path.isfile(output_filename):
@@ -113,3 +502,13 @@ def create_fmu_container(configuration, output_filename):
     os.rename(base_filename + '.zip', output_filename)
 
     shutil.rmtree(unzipdir, ignore_errors=True)
+
+
+def read_recording(filename):
+    """ Read the file written by the native recorder of an FMU container as a structured array with
+    the fields 'time' and the names of the recorded variables. The file is memory-mapped and can be
+    read while the container is running. """
+
+    import numpy as np
+
+    return np.load(filename, mmap_mode='r')
@@ -15,14 +15,62 @@
 #include <linux/limits.h>
 #endif
 
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include <mpack.h>
 
+#include "ThreadPool.h"
+#include "Recorder.h"
+
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #include "fmi2Functions.h"
+#include "fmi3FunctionTypes.h"
+
+
+#ifdef FMU_CONTAINER_PROFILING
+
+typedef enum {
+	PROFILE_DO_STEP,
+	PROFILE_TRANSFER,
+	PROFILE_GET,
+	PROFILE_SET,
+	N_PROFILE_CATEGORIES
+} ProfileCategory;
+
+/* Maximum number of trace events per component */
+#define MAX_PROFILE_EVENTS (1 << 20)
+
+typedef struct {
+
+	uint64_t start;
+	uint64_t duration;
+	ProfileCategory category;
+
+} ProfileEvent;
+
+typedef struct {
+
+	uint64_t time[N_PROFILE_CATEGORIES];  // in nanoseconds
+	uint64_t count[N_PROFILE_CATEGORIES];
+
+	size_t nEvents;
+	size_t eventsSize;
+	ProfileEvent *events;
+
+} Profile;
 
+#endif
 
 typedef struct {
 
@@ -82,523 +130,4403 @@ typedef struct {
 	fmi2GetBooleanStatusTYPE *fmi2GetBooleanStatus;
 	fmi2GetStringStatusTYPE  *fmi2GetStringStatus;
 
+	/***************************************************
+	Functions for FMI3 for Co-Simulation
+	****************************************************/
+
+	fmi3InstantiateCoSimulationTYPE *fmi3InstantiateCoSimulation;
+	fmi3FreeInstanceTYPE            *fmi3FreeInstance;
+	fmi3SetDebugLoggingTYPE         *fmi3SetDebugLogging;
+	fmi3EnterInitializationModeTYPE *fmi3EnterInitializationMode;
+	fmi3ExitInitializationModeTYPE  *fmi3ExitInitializationMode;
+	fmi3EnterEventModeTYPE          *fmi3EnterEventMode;
+	fmi3TerminateTYPE               *fmi3Terminate;
+	fmi3ResetTYPE                   *fmi3Reset;
+	fmi3GetFloat64TYPE              *fmi3GetFloat64;
+	fmi3GetInt32TYPE                *fmi3GetInt32;
+	fmi3GetBooleanTYPE              *fmi3GetBoolean;
+	fmi3GetStringTYPE               *fmi3GetString;
+	fmi3SetFloat64TYPE              *fmi3SetFloat64;
+	fmi3SetInt32TYPE                *fmi3SetInt32;
+	fmi3SetBooleanTYPE              *fmi3SetBoolean;
+	fmi3SetStringTYPE               *fmi3SetString;
+	fmi3GetFMUStateTYPE             *fmi3GetFMUState;
+	fmi3SetFMUStateTYPE             *fmi3SetFMUState;
+	fmi3FreeFMUStateTYPE            *fmi3FreeFMUState;
+	fmi3SerializedFMUStateSizeTYPE  *fmi3SerializedFMUStateSize;
+	fmi3SerializeFMUStateTYPE       *fmi3SerializeFMUState;
+	fmi3DeSerializeFMUStateTYPE     *fmi3DeSerializeFMUState;
+	fmi3GetDirectionalDerivativeTYPE *fmi3GetDirectionalDerivative;
+	fmi3NewDiscreteStatesTYPE       *fmi3NewDiscreteStates;
+	fmi3EnterStepModeTYPE           *fmi3EnterStepMode;
+	fmi3GetOutputDerivativesTYPE    *fmi3GetOutputDerivatives;
+	fmi3DoStepTYPE                  *fmi3DoStep;
+
+	fmi3Instance instance;
+
 	const char *name;
 	const char *guid;
 	const char *modelIdentifier;
+	const char *directory;  // directory of the extracted FMU in the resources
+
+	fmi2Boolean threadSafe;
+	fmi2Boolean isolate;  // load a private copy of the shared library
+	fmi2Boolean canInterpolateInputs;
+	fmi2Boolean providesDirectionalDerivative;
+
+	size_t fmiVersion;      // 2 or 3, FMI 3.0 components are called through the adapter functions
+	fmi2Boolean eventMode;  // instantiate FMI 3.0 components with eventModeRequired
+
+	fmi2Boolean ownsLibrary;
+	char *libraryCopy;
+
+	size_t rate;
+	fmi2Real stepSize;
+	fmi2Boolean interpolation;
+	fmi2Boolean stepSizeChanged;  // the warning about the changed step size has been logged
+
+	size_t nSteps;
+	size_t stepCount;
+	fmi2Real time;
+	fmi2Real currentTime;
+	fmi2Real currentStepSize;
+
+	/* experiment and status of FMI 3.0 components */
+	fmi2ComponentEnvironment componentEnvironment;
+	fmi2Boolean toleranceDefined;
+	fmi2Real tolerance;
+	fmi2Real startTime;
+	fmi2Boolean stopTimeDefined;
+	fmi2Real stopTime;
+	fmi2Real lastSuccessfulTime;
+	fmi2Boolean terminated;
+
+#ifdef FMU_CONTAINER_PROFILING
+	Profile profile;
+#endif
 
 } Model;
 
+/* The layout of VariableMapping and Connection is the same as in the compiled
+   configuration (config.bin) so the mapped tables can be used in place */
 typedef struct {
 
-	size_t ci;
+	uint64_t ci;
 	fmi2ValueReference vr;
+	uint32_t reserved;
 
 } VariableMapping;
 
 typedef struct {
 
-	char type;
-	size_t startComponent;
+	uint64_t startComponent;
+	uint64_t endComponent;
 	fmi2ValueReference startValueReference;
-	size_t endComponent;
 	fmi2ValueReference endValueReference;
+	char type;
+	uint8_t breakLoop;
+	uint8_t order;  // order of the extrapolation of real inputs (0, 1 or 2)
+	char endType;   // type of the end variable, the value is cast if it differs from type
+	uint32_t size;  // number of values of real array variables of FMI 3.0 components (1 for scalars)
+	double factor;  // linear transformation factor * value + offset of real values
+	double offset;
 
 } Connection;
 
 typedef struct {
 
-	size_t nComponents;
-	Model *components;
-	
-	size_t nVariables;
-	VariableMapping *variables;
+	size_t ci;
+	size_t start;
+	size_t size;
+	fmi2Boolean contiguous;
 
-	size_t nConnections;
-	Connection *connections;
+} Batch;
 
-} System;
+typedef struct {
 
+	size_t nvr;
+	fmi2ValueReference *vr;
 
-#define GET_SYSTEM \
-	if (!c) return fmi2Error; \
-	System *s = (System *)c; \
-	fmi2Status status = fmi2OK;
+	size_t nBatches;
+	Batch *batches;
 
-#define CHECK_STATUS(S) status = S; if (status > fmi2Warning) goto END;
+	fmi2ValueReference *valueReferences;
+	size_t *indices;
 
+} AccessPlan;
 
-/***************************************************
-Types for Common Functions
-****************************************************/
+#define N_ACCESS_PLANS 16
 
-/* Inquire version numbers of header files and setting logging status */
-const char* fmi2GetTypesPlatform(void) { return fmi2TypesPlatform; }
+/* The native recorder appends a row with the time and the values of the recorded variables at
+   every sample point to a NumPy file. The variables are read with one plan per type. */
+#define N_RECORDED_TYPES 3
 
-const char* fmi2GetVersion(void) { return fmi2Version; }
+typedef struct {
 
-fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
-    
-	GET_SYSTEM
+	Recorder *recorder;
+	fmi2Real interval;  // 0 = record every micro step
+	fmi2Real startTime;
+	size_t nSamples;    // number of sample points that have been passed
+	size_t nRows;       // number of rows that have been recorded
 
-		for (size_t i = 0; i < s->nComponents; i++) {
-			Model *m = &(s->components[i]);
-			CHECK_STATUS(m->fmi2SetDebugLogging(m->c, loggingOn, nCategories, categories))
-		}
+	fmi2Real *row;
+	AccessPlan *plans[N_RECORDED_TYPES];
+	size_t *columns[N_RECORDED_TYPES];  // columns of the variables of the plans in the row
+	void *values;
 
-END:
-	return status;
-}
+} Recording;
 
+typedef struct {
 
-/* Creation and destruction of FMU instances and setting debug status */
-#ifdef _WIN32
-#define GET(f) m->f = (f ## TYPE *)GetProcAddress(m->libraryHandle, #f); if (!m->f) { return NULL; }
-#else
-#define GET(f) m->f = (f ## TYPE *)dlsym(m->libraryHandle, #f); if (!m->f) { return NULL; }
-#endif
+	void *data;
+	size_t size;
 
-/* Creation and destruction of FMU instances and setting debug status */
-fmi2Component fmi2Instantiate(fmi2String instanceName,
-                              fmi2Type fmuType,
-                              fmi2String fmuGUID,
-                              fmi2String fmuResourceLocation,
-                              const fmi2CallbackFunctions* functions,
-                              fmi2Boolean visible,
-                              fmi2Boolean loggingOn) {
+} Segment;
 
-	if (!functions || !functions->logger) {
-		return NULL;
-	}
+typedef struct {
 
-    if (fmuType != fmi2CoSimulation) {
-        functions->logger(NULL, instanceName, fmi2Error, "logError", "Argument fmuType must be fmi2CoSimulation.");
-        return NULL;
-    }
+	char type;
 
-	const char *scheme1 = "file:///";
-	const char *scheme2 = "file:/";
-	char *path;
+	size_t nValues;
+	fmi2ValueReference *startValueReferences;
+	size_t nGetBatches;
+	Batch *getBatches;
+	size_t *stepCounts;
+	fmi2Boolean *required;
+	void *values;
+
+	size_t nTargets;
+	fmi2ValueReference *endValueReferences;
+	size_t *sourceIndices;
+	size_t *sourceBatches;
+	size_t nSetBatches;
+	Batch *setBatches;
+	void *targetValues;
+
+	/* the last three samples of the real outputs for the interpolation and extrapolation */
+	unsigned char *samples;
+	fmi2Real *times;
+	fmi2Real *previousTimes;
+	fmi2Real *previousValues;
+	fmi2Real *olderTimes;
+	fmi2Real *olderValues;
+
+	/* linear transformations of the real inputs (NULL if there are none) */
+	fmi2Real *factors;
+	fmi2Real *offsets;
+
+	/* extrapolation order of the real inputs and buffers for fmi2SetRealInputDerivatives() */
+	unsigned char *orders;
+	fmi2ValueReference *derivativeValueReferences;
+	fmi2Integer *derivativeOrders;
+	fmi2Real *derivatives;
+
+} Transfer;
 
-	if (strncmp(fmuResourceLocation, scheme1, strlen(scheme1)) == 0) {
-		path = strdup(&fmuResourceLocation[strlen(scheme1) - 1]);
-	} else if (strncmp(fmuResourceLocation, scheme2, strlen(scheme2)) == 0) {
-		path = strdup(&fmuResourceLocation[strlen(scheme2) - 1]);
-	} else {
-		return NULL;
-	}
+typedef struct {
 
-#ifdef _WIN32
-	// strip any leading slashes
-	while (path[0] == '/') {
-		strcpy(path, &path[1]);
-	}
-#endif
+	size_t nTransfers;
+	Transfer transfers[3];
+
+	/* real array connections that are transferred with one call per connection */
+	size_t nArrays;
+	size_t *arrays;
+	size_t *arrayOffsets;
+	fmi2Real *arrayValues;
+
+	/* connections that cast their value to a different type, transferred one by one as reals */
+	size_t nCasts;
+	size_t *casts;
+	fmi2Real *castValues;
+
+} TransferPlan;
+
+typedef struct {
+
+	size_t nComponents;
+	size_t *components;
+	int *pinned;
+	TransferPlan transferPlan;
+
+} Level;
+
+typedef enum {
+	LOOP_FIXED_POINT,
+	LOOP_BROYDEN
+} LoopMethod;
+
+/* Components whose real inputs and outputs are iterated until they agree at the end of the step */
+typedef struct {
+
+	size_t nComponents;
+	size_t *components;
+	LoopMethod method;
+	size_t maxIterations;
+	fmi2Real tolerance;
+	fmi2Real relaxation;
+
+	size_t level;
+	Transfer transfer;  // the real connections between the components of the loop
+	fmi2FMUstate *states;
+
+	fmi2Real *guess;
+	fmi2Real *residuals;
+	fmi2Real *previousGuess;
+	fmi2Real *previousResiduals;
+	fmi2Real *inverseJacobian;  // approximation of the inverse Jacobian of the residuals (Broyden)
+
+	/* statistics */
+	size_t nSteps;
+	size_t nIterations;
+	size_t maxStepIterations;
+	size_t nFailures;
+
+} Loop;
+
+typedef union {
+	fmi2Real realValue;
+	fmi2Integer integerValue;
+	fmi2Boolean booleanValue;
+	fmi2String stringValue;
+} Value;
+
+typedef struct MappedConfig MappedConfig;
 
-	System *s = calloc(1, sizeof(System));
 #ifdef _WIN32
-    char configPath[MAX_PATH] = "";
+typedef SRWLOCK Mutex;
+#define INIT_MUTEX(m)    InitializeSRWLock(&(m))
+#define DESTROY_MUTEX(m)
+#define LOCK_MUTEX(m)    AcquireSRWLockExclusive(&(m))
+#define UNLOCK_MUTEX(m)  ReleaseSRWLockExclusive(&(m))
 #else
-    char configPath[PATH_MAX] = "";
+typedef pthread_mutex_t Mutex;
+#define INIT_MUTEX(m)    pthread_mutex_init(&(m), NULL)
+#define DESTROY_MUTEX(m) pthread_mutex_destroy(&(m))
+#define LOCK_MUTEX(m)    pthread_mutex_lock(&(m))
+#define UNLOCK_MUTEX(m)  pthread_mutex_unlock(&(m))
 #endif
-	strcpy(configPath, path);
-	strcat(configPath, "/config.mp");
-
-	// parse a file into a node tree
-	mpack_tree_t tree;
-	mpack_tree_init_filename(&tree, configPath, 0);
-	mpack_tree_parse(&tree);
-	mpack_node_t root = mpack_tree_root(&tree);
 
-	//mpack_node_print_to_stdout(root);
+typedef struct {
 
-	mpack_node_t components = mpack_node_map_cstr(root, "components");
+	char *instanceName;
+	fmi2CallbackFunctions functions;
+	fmi2Boolean loggingOn;
 
-	s->nComponents = mpack_node_array_length(components);
+	MappedConfig *config;
 
-	s->components = calloc(s->nComponents, sizeof(Model));
+	size_t nComponents;
+	Model *components;
+	
+	size_t nVariables;
+	VariableMapping *variables;
 
-	for (size_t i = 0; i < s->nComponents; i++) {
-		mpack_node_t component = mpack_node_array_at(components, i);
+	size_t nConnections;
+	Connection *connections;
 
-		mpack_node_t name = mpack_node_map_cstr(component, "name");
-		s->components[i].name = mpack_node_cstr_alloc(name, 1024);
+	size_t nLevels;
+	Level *levels;
 
-		mpack_node_t guid = mpack_node_map_cstr(component, "guid");
-		s->components[i].guid = mpack_node_cstr_alloc(guid, 1024);
+	size_t nLoops;
+	Loop *loops;
 
-		mpack_node_t modelIdentifier = mpack_node_map_cstr(component, "modelIdentifier");
-		s->components[i].modelIdentifier = mpack_node_cstr_alloc(modelIdentifier, 1024);
-	}
+	/* real connections by start and end component and order of the components for the directional derivatives */
+	size_t *outputOffsets;
+	size_t *outputConnections;
+	size_t *inputOffsets;
+	size_t *inputConnections;
+	size_t *derivativeOrder;
+	fmi2Boolean derivativeCycles;
 
-	mpack_node_t connections = mpack_node_map_cstr(root, "connections");
+	fmi2Boolean *active;
+	size_t nActiveComponents;
+	size_t *activeComponents;
+	int *activePinned;
 
-	s->nConnections = mpack_node_array_length(connections);
+	ThreadPool *threadPool;
+	fmi2Status *statuses;
 
-	s->connections = calloc(s->nConnections, sizeof(Connection));
+	fmi2Boolean noSetFMUStatePriorToCurrentPoint;
 
-	for (size_t i = 0; i < s->nConnections; i++) {
-		mpack_node_t connection = mpack_node_array_at(connections, i);
+	/* asynchronous fmi2DoStep(): the step runs on asyncPool while stepStatus is fmi2Pending,
+	   stepStatus, stepCanceled and lastSuccessfulTime are guarded by stepMutex */
+	ThreadPool *asyncPool;
+	Mutex stepMutex;
+	fmi2Boolean stepStarted;
+	fmi2Boolean stepCanceled;
+	fmi2Status stepStatus;
+	fmi2Real lastSuccessfulTime;
+	fmi2Real stepTime;
+	fmi2Real stepSize;
 
-		mpack_node_t type = mpack_node_map_cstr(connection, "type");
-		s->connections[i].type = mpack_node_str(type)[0];
+	size_t nSegments;
+	Segment *segments;
+	size_t segmentsSize;
 
-		mpack_node_t startComponent = mpack_node_map_cstr(connection, "startComponent");
-		s->connections[i].startComponent = mpack_node_u64(startComponent);
+	size_t nAccessPlans;
+	AccessPlan *accessPlans[N_ACCESS_PLANS];
 
-		mpack_node_t endComponent = mpack_node_map_cstr(connection, "endComponent");
-		s->connections[i].endComponent = mpack_node_u64(endComponent);
+	size_t bufferSize;
+	void *buffer;
 
-		mpack_node_t startValueReference = mpack_node_map_cstr(connection, "startValueReference");
-		s->connections[i].startValueReference = mpack_node_u32(startValueReference);
+	Recording *recording;
 
-		mpack_node_t endValueReference = mpack_node_map_cstr(connection, "endValueReference");
-		s->connections[i].endValueReference = mpack_node_u32(endValueReference);
-	}
+#ifdef FMU_CONTAINER_PROFILING
+	uint64_t profileStart;
+	char *traceFile;
+#endif
 
-	mpack_node_t variables = mpack_node_map_cstr(root, "variables");
+} System;
 
-	s->nVariables = mpack_node_array_length(variables);
 
-	s->variables = calloc(s->nVariables, sizeof(VariableMapping));
+static void finishStep(System *s);
 
-	for (size_t i = 0; i < s->nVariables; i++) {
-		mpack_node_t variable = mpack_node_array_at(variables, i);
+static fmi2Boolean stepPending(System *s);
 
-		mpack_node_t component = mpack_node_map_cstr(variable, "component");
-		s->variables[i].ci = mpack_node_u64(component);
+/* Get the system and fail while an asynchronous step is pending */
+#define GET_SYSTEM \
+	if (!c) return fmi2Error; \
+	System *s = (System *)c; \
+	fmi2Status status = fmi2OK; \
+	if (stepPending(s)) return fmi2Error;
 
-		mpack_node_t valueReference = mpack_node_map_cstr(variable, "valueReference");
-		s->variables[i].vr = mpack_node_u32(valueReference);
-	}
+#define CHECK_STATUS(S) status = S; if (status > fmi2Warning) goto END;
 
-	// clean up and check for errors
-	if (mpack_tree_destroy(&tree) != mpack_ok) {
-		fprintf(stderr, "An error occurred decoding the data!\n");
-		return NULL;
-	}
 
-	for (size_t i = 0; i < s->nComponents; i++) {
+/***************************************************
+Profiling
+****************************************************/
 
-		Model *m = &(s->components[i]);
+/* Vendor specific status kinds to query the profile of component i with fmi2GetRealStatus()
+   (time in seconds) and fmi2GetIntegerStatus() (number of calls):
+   kind = FMU_CONTAINER_PROFILE_STATUS_KIND + i * N_PROFILE_CATEGORIES + category */
+#define FMU_CONTAINER_PROFILE_STATUS_KIND 0x1000
 
-		m->logger = functions->logger;
+/* Vendor specific status kinds to query the statistics of loop i with fmi2GetIntegerStatus():
+   kind = FMU_CONTAINER_LOOP_STATUS_KIND + i * N_LOOP_STATISTICS + statistic (see LoopStatistic) */
+#define FMU_CONTAINER_LOOP_STATUS_KIND 0x100000
 
-#ifdef _WIN32
-		char libraryPath[MAX_PATH] = "";
+#ifdef FMU_CONTAINER_PROFILING
 
-		PathCombine(libraryPath, path, m->modelIdentifier);
-		PathCombine(libraryPath, libraryPath, "binaries");
-#ifdef _WIN64
-		PathCombine(libraryPath, libraryPath, "win64");
-#else
-		PathCombine(libraryPath, libraryPath, "win32");
-#endif
-		PathCombine(libraryPath, libraryPath, m->modelIdentifier);
-		strcat(libraryPath, ".dll");
+#define PROFILE(s, m, category, S) { const uint64_t profileStart = profileClock(); S; recordProfile(s, m, category, profileStart); }
 
-		m->libraryHandle = LoadLibrary(libraryPath);
-#else
-        char libraryPath[PATH_MAX] = "";
-        strcpy(libraryPath, path);
-        strcat(libraryPath, "/");
-        strcat(libraryPath, m->modelIdentifier);
-#ifdef __APPLE__
-        strcat(libraryPath, "/binaries/darwin64/");
-        strcat(libraryPath, m->modelIdentifier);
-        strcat(libraryPath, ".dylib");
-#else
-        strcat(libraryPath, "/binaries/linux64/");
-        strcat(libraryPath, m->modelIdentifier);
-        strcat(libraryPath, ".so");
-#endif
-        m->libraryHandle = dlopen(libraryPath, RTLD_LAZY);
-#endif
+static const char *profileCategoryNames[N_PROFILE_CATEGORIES] = { "doStep", "transfer", "get", "set" };
 
+/* Monotonic clock in nanoseconds */
+static uint64_t profileClock(void) {
 #ifdef _WIN32
-		char resourcesPath[MAX_PATH];
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000 / (uint64_t)frequency.QuadPart;
 #else
-        char resourcesPath[PATH_MAX];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
 #endif
-		strcpy(resourcesPath, fmuResourceLocation);
-		strcat(resourcesPath, "/");
-		strcat(resourcesPath, m->modelIdentifier);
-		strcat(resourcesPath, "/resources");
-
-		if (!m->libraryHandle) {
-			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Failed to load shared library %s.", libraryPath);
-			return NULL;
-		}
-
-		GET(fmi2GetTypesPlatform)
-		GET(fmi2GetVersion)
-		GET(fmi2SetDebugLogging)
-		GET(fmi2Instantiate)
-		GET(fmi2FreeInstance)
-		GET(fmi2SetupExperiment)
-		GET(fmi2EnterInitializationMode)
-		GET(fmi2ExitInitializationMode)
-		GET(fmi2Terminate)
-		GET(fmi2Reset)
-		GET(fmi2GetReal)
-		GET(fmi2GetInteger)
-		GET(fmi2GetBoolean)
-		GET(fmi2GetString)
-		GET(fmi2SetReal)
-		GET(fmi2SetInteger)
-		GET(fmi2SetBoolean)
-		GET(fmi2SetString)
-		GET(fmi2GetFMUstate)
-		GET(fmi2SetFMUstate)
-		GET(fmi2FreeFMUstate)
-		GET(fmi2SerializedFMUstateSize)
-		GET(fmi2SerializeFMUstate)
-		GET(fmi2DeSerializeFMUstate)
-		GET(fmi2GetDirectionalDerivative)
-
-		GET(fmi2SetRealInputDerivatives)
-		GET(fmi2GetRealOutputDerivatives)
-		GET(fmi2DoStep)
-		GET(fmi2CancelStep)
-		GET(fmi2GetStatus)
-		GET(fmi2GetRealStatus)
-		GET(fmi2GetIntegerStatus)
-		GET(fmi2GetBooleanStatus)
-		GET(fmi2GetStringStatus)
-
-		m->c = m->fmi2Instantiate(m->name, fmi2CoSimulation, m->guid, resourcesPath, functions, visible, loggingOn);
-
-		if (!m->c) return NULL;
-	}
-
-    return s;
 }
 
-void fmi2FreeInstance(fmi2Component c) {
+/* Add the time since start to the profile of component m. The profile of a component is only
+   updated by the thread that currently calls the component so no synchronization is required. */
+static void recordProfile(System *s, Model *m, ProfileCategory category, uint64_t start) {
 
-	if (!c) return;
-	
-	System *s = (System *)c;
+	const uint64_t stop = profileClock();
+	Profile *profile = &(m->profile);
 
-	for (size_t i = 0; i < s->nComponents; i++) {
-		Model *m = &(s->components[i]);
-		m->fmi2FreeInstance(m->c);
-#ifdef _WIN32
-		FreeLibrary(m->libraryHandle);
-#else
-		dlclose(m->libraryHandle);
-#endif
-	}
+	profile->time[category] += stop - start;
+	profile->count[category]++;
 
-	free(s);
-}
+	if (!s->traceFile) return;
 
-/* Enter and exit initialization mode, terminate and reset */
-fmi2Status fmi2SetupExperiment(fmi2Component c,
-                               fmi2Boolean toleranceDefined,
-                               fmi2Real tolerance,
-                               fmi2Real startTime,
-                               fmi2Boolean stopTimeDefined,
-                               fmi2Real stopTime) {
-    
-	GET_SYSTEM
+	if (profile->nEvents == profile->eventsSize) {
 
-	for (size_t i = 0; i < s->nComponents; i++) {
-		Model *m = &(s->components[i]);
-		CHECK_STATUS(m->fmi2SetupExperiment(m->c, toleranceDefined, tolerance, startTime, stopTimeDefined, stopTime))
-	}
+		if (profile->eventsSize >= MAX_PROFILE_EVENTS) return;
 
-END:
-	return status;
-}
+		const size_t size = profile->eventsSize > 0 ? 2 * profile->eventsSize : 1024;
+		ProfileEvent *events = realloc(profile->events, size * sizeof(ProfileEvent));
 
-fmi2Status fmi2EnterInitializationMode(fmi2Component c) {
-	
-	GET_SYSTEM
+		if (!events) return;
 
-	for (size_t i = 0; i < s->nComponents; i++) {
-		Model *m = &(s->components[i]);
-		CHECK_STATUS(m->fmi2EnterInitializationMode(m->c))
+		profile->events = events;
+		profile->eventsSize = size;
 	}
 
-END:
-	return status;
+	ProfileEvent *event = &(profile->events[profile->nEvents++]);
+
+	event->start = start - s->profileStart;
+	event->duration = stop - start;
+	event->category = category;
 }
 
-fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
-	
-	GET_SYSTEM
+static void writeJSONString(FILE *file, const char *string) {
 
-	for (size_t i = 0; i < s->nComponents; i++) {
-		Model *m = &(s->components[i]);
-		CHECK_STATUS(m->fmi2ExitInitializationMode(m->c))
+	fputc('"', file);
+
+	for (const char *c = string; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', file);
+			fputc(*c, file);
+		} else if ((unsigned char)*c < 0x20) {
+			fprintf(file, "\\u%04x", *c);
+		} else {
+			fputc(*c, file);
+		}
 	}
 
-END:
-	return status;
+	fputc('"', file);
 }
 
-fmi2Status fmi2Terminate(fmi2Component c) {
-	
-	GET_SYSTEM
+/* Write the recorded events in the Chrome trace event format (chrome://tracing, https://ui.perfetto.dev) */
+static fmi2Boolean writeTrace(System *s) {
+
+	FILE *file = fopen(s->traceFile, "w");
+
+	if (!file) return fmi2False;
+
+	fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
 
 	for (size_t i = 0; i < s->nComponents; i++) {
-		Model *m = &(s->components[i]);
-		CHECK_STATUS(m->fmi2Terminate(m->c))
+
+		const Model *m = &(s->components[i]);
+
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":", i > 0 ? "," : "", i);
+		writeJSONString(file, m->name);
+		fputs("}}", file);
+
+		for (size_t j = 0; j < m->profile.nEvents; j++) {
+			const ProfileEvent *event = &(m->profile.events[j]);
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+				profileCategoryNames[event->category], i, event->start * 1e-3, event->duration * 1e-3);
+		}
 	}
 
-END:
-	return status;
+	fputs("\n]}\n", file);
+
+	return fclose(file) == 0;
 }
 
-fmi2Status fmi2Reset(fmi2Component c) {
+/* Map a vendor specific status kind to a component and category */
+static fmi2Boolean profileStatusKind(System *s, int kind, size_t *ci, size_t *category) {
 
-	GET_SYSTEM
+	if (kind < FMU_CONTAINER_PROFILE_STATUS_KIND || kind >= FMU_CONTAINER_LOOP_STATUS_KIND) return fmi2False;
 
-		for (size_t i = 0; i < s->nComponents; i++) {
-			Model *m = &(s->components[i]);
+	const size_t index = (size_t)(kind - FMU_CONTAINER_PROFILE_STATUS_KIND);
+
+	*ci = index / N_PROFILE_CATEGORIES;
+	*category = index % N_PROFILE_CATEGORIES;
+
+	return *ci < s->nComponents;
+}
+
+#else
+
+#define PROFILE(s, m, category, S) S;
+
+#endif
+
+
+/***************************************************
+Batched access to the variables of the components
+****************************************************/
+
+static void freeAccessPlan(AccessPlan *plan) {
+
+	if (!plan) return;
+
+	free(plan->vr);
+	free(plan->batches);
+	free(plan->valueReferences);
+	free(plan->indices);
+	free(plan);
+}
+
+/* Group the value references by component so that every component is called only once */
+static AccessPlan *createAccessPlan(System *s, const fmi2ValueReference vr[], size_t nvr) {
+
+	size_t *counts = calloc(s->nComponents + 1, sizeof(size_t));
+	AccessPlan *plan = calloc(1, sizeof(AccessPlan));
+
+	if (!counts || !plan) goto FAIL;
+
+	plan->nvr             = nvr;
+	plan->vr              = malloc(nvr * sizeof(fmi2ValueReference));
+	plan->valueReferences = malloc(nvr * sizeof(fmi2ValueReference));
+	plan->indices         = malloc(nvr * sizeof(size_t));
+	plan->batches         = calloc(s->nComponents, sizeof(Batch));
+
+	if (!plan->vr || !plan->valueReferences || !plan->indices || !plan->batches) goto FAIL;
+
+	memcpy(plan->vr, vr, nvr * sizeof(fmi2ValueReference));
+
+	for (size_t i = 0; i < nvr; i++) {
+		if (vr[i] >= s->nVariables) goto FAIL;
+		counts[s->variables[vr[i]].ci + 1]++;
+	}
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		if (counts[i + 1] > 0) {
+			Batch *batch = &(plan->batches[plan->nBatches++]);
+			batch->ci = i;
+			batch->start = counts[i];
+			batch->size = counts[i + 1];
+			batch->contiguous = fmi2True;
+		}
+		counts[i + 1] += counts[i];
+	}
+
+	// stable counting sort keeps the caller's order within a component
+	for (size_t i = 0; i < nvr; i++) {
+		const VariableMapping *vm = &(s->variables[vr[i]]);
+		size_t j = counts[vm->ci]++;
+		plan->valueReferences[j] = vm->vr;
+		plan->indices[j] = i;
+	}
+
+	for (size_t i = 0; i < plan->nBatches; i++) {
+		Batch *batch = &(plan->batches[i]);
+		for (size_t j = 1; j < batch->size; j++) {
+			if (plan->indices[batch->start + j] != plan->indices[batch->start] + j) {
+				batch->contiguous = fmi2False;
+				break;
+			}
+		}
+	}
+
+	free(counts);
+
+	return plan;
+
+FAIL:
+	free(counts);
+	freeAccessPlan(plan);
+	return NULL;
+}
+
+/* Look up a plan for the value references in the cache and move it to the front */
+static AccessPlan *getAccessPlan(System *s, const fmi2ValueReference vr[], size_t nvr) {
+
+	AccessPlan *plan = NULL;
+	size_t i;
+
+	for (i = 0; i < s->nAccessPlans; i++) {
+		AccessPlan *p = s->accessPlans[i];
+		if (p->nvr == nvr && memcmp(p->vr, vr, nvr * sizeof(fmi2ValueReference)) == 0) {
+			plan = p;
+			break;
+		}
+	}
+
+	if (!plan) {
+
+		plan = createAccessPlan(s, vr, nvr);
+
+		if (!plan) return NULL;
+
+		if (s->nAccessPlans < N_ACCESS_PLANS) {
+			i = s->nAccessPlans++;
+		} else {
+			i = N_ACCESS_PLANS - 1;
+			freeAccessPlan(s->accessPlans[i]);
+		}
+	}
+
+	memmove(&(s->accessPlans[1]), &(s->accessPlans[0]), i * sizeof(AccessPlan *));
+	s->accessPlans[0] = plan;
+
+	// make sure the staging buffer is large enough for any type
+	if (s->bufferSize < nvr) {
+		void *buffer = realloc(s->buffer, nvr * sizeof(Value));
+		if (!buffer) return NULL;
+		s->buffer = buffer;
+		s->bufferSize = nvr;
+	}
+
+	return plan;
+}
+
+static size_t sizeOfType(char type) {
+	switch (type) {
+	case 'R': return sizeof(fmi2Real);
+	case 'I': return sizeof(fmi2Integer);
+	case 'B': return sizeof(fmi2Boolean);
+	default:  return sizeof(fmi2String);
+	}
+}
+
+static fmi2Status getComponentValues(Model *m, char type, const fmi2ValueReference vr[], size_t nvr, void *values) {
+	switch (type) {
+	case 'R': return m->fmi2GetReal(m->c, vr, nvr, values);
+	case 'I': return m->fmi2GetInteger(m->c, vr, nvr, values);
+	case 'B': return m->fmi2GetBoolean(m->c, vr, nvr, values);
+	case 'S': return m->fmi2GetString(m->c, vr, nvr, values);
+	default:  return fmi2Error;
+	}
+}
+
+static fmi2Status setComponentValues(Model *m, char type, const fmi2ValueReference vr[], size_t nvr, const void *values) {
+	switch (type) {
+	case 'R': return m->fmi2SetReal(m->c, vr, nvr, values);
+	case 'I': return m->fmi2SetInteger(m->c, vr, nvr, values);
+	case 'B': return m->fmi2SetBoolean(m->c, vr, nvr, values);
+	case 'S': return m->fmi2SetString(m->c, vr, nvr, values);
+	default:  return fmi2Error;
+	}
+}
+
+/* Get the values of a real array variable of an FMI 3.0 component with a single call */
+static fmi2Status getComponentArray(Model *m, fmi2ValueReference vr, fmi2Real values[], size_t nValues) {
+	return (fmi2Status)m->fmi3GetFloat64(m->instance, &vr, 1, values, nValues);
+}
+
+static fmi2Status setComponentArray(Model *m, fmi2ValueReference vr, const fmi2Real values[], size_t nValues) {
+	return (fmi2Status)m->fmi3SetFloat64(m->instance, &vr, 1, values, nValues);
+}
+
+#define SCATTER(T) for (size_t i = 0; i < n; i++) ((T *)dst)[indices[i]] = ((const T *)src)[i];
+
+#define GATHER(T) for (size_t i = 0; i < n; i++) ((T *)dst)[i] = ((const T *)src)[indices[i]];
+
+/* dst[indices[i]] = src[i] */
+static void scatter(char type, void *dst, const size_t indices[], const void *src, size_t n) {
+	switch (type) {
+	case 'R': SCATTER(fmi2Real)    break;
+	case 'I': SCATTER(fmi2Integer) break;
+	case 'B': SCATTER(fmi2Boolean) break;
+	case 'S': SCATTER(fmi2String)  break;
+	}
+}
+
+/* dst[i] = src[indices[i]] */
+static void gather(char type, void *dst, const void *src, const size_t indices[], size_t n) {
+	switch (type) {
+	case 'R': GATHER(fmi2Real)    break;
+	case 'I': GATHER(fmi2Integer) break;
+	case 'B': GATHER(fmi2Boolean) break;
+	case 'S': GATHER(fmi2String)  break;
+	}
+}
+
+/* Get the values of the variables of a plan, the staging buffer must hold plan->nvr values */
+static fmi2Status getPlanValues(System *s, const AccessPlan *plan, char type, void *value) {
+
+	fmi2Status status = fmi2OK;
+
+	for (size_t i = 0; i < plan->nBatches; i++) {
+
+		const Batch *batch = &(plan->batches[i]);
+		const size_t *indices = &(plan->indices[batch->start]);
+		Model *m = &(s->components[batch->ci]);
+
+		if (batch->contiguous) {
+			// read directly into the caller's array
+			PROFILE(s, m, PROFILE_GET, CHECK_STATUS(getComponentValues(m, type, &(plan->valueReferences[batch->start]), batch->size, (char *)value + indices[0] * sizeOfType(type))))
+		} else {
+			PROFILE(s, m, PROFILE_GET, CHECK_STATUS(getComponentValues(m, type, &(plan->valueReferences[batch->start]), batch->size, s->buffer)))
+			scatter(type, value, indices, s->buffer, batch->size);
+		}
+	}
+
+END:
+	return status;
+}
+
+static fmi2Status getValues(System *s, char type, const fmi2ValueReference vr[], size_t nvr, void *value) {
+
+	if (stepPending(s)) return fmi2Error;
+
+	if (nvr == 0) return fmi2OK;
+
+	AccessPlan *plan = getAccessPlan(s, vr, nvr);
+
+	if (!plan) return fmi2Error;
+
+	return getPlanValues(s, plan, type, value);
+}
+
+static fmi2Status setValues(System *s, char type, const fmi2ValueReference vr[], size_t nvr, const void *value) {
+
+	fmi2Status status = fmi2OK;
+
+	if (stepPending(s)) return fmi2Error;
+
+	if (nvr == 0) return status;
+
+	AccessPlan *plan = getAccessPlan(s, vr, nvr);
+
+	if (!plan) return fmi2Error;
+
+	for (size_t i = 0; i < plan->nBatches; i++) {
+
+		const Batch *batch = &(plan->batches[i]);
+		const size_t *indices = &(plan->indices[batch->start]);
+		Model *m = &(s->components[batch->ci]);
+
+		if (batch->contiguous) {
+			// pass the caller's array directly
+			PROFILE(s, m, PROFILE_SET, CHECK_STATUS(setComponentValues(m, type, &(plan->valueReferences[batch->start]), batch->size, (const char *)value + indices[0] * sizeOfType(type))))
+		} else {
+			gather(type, s->buffer, value, indices, batch->size);
+			PROFILE(s, m, PROFILE_SET, CHECK_STATUS(setComponentValues(m, type, &(plan->valueReferences[batch->start]), batch->size, s->buffer)))
+		}
+	}
+
+END:
+	return status;
+}
+
+
+/***************************************************
+Transfer of the connections
+****************************************************/
+
+typedef struct {
+
+	size_t component;
+	fmi2ValueReference valueReference;
+	size_t index;
+	unsigned char order;
+	fmi2Real factor;
+	fmi2Real offset;
+
+} Endpoint;
+
+static int compareEndpoints(const void *a, const void *b) {
+
+	const Endpoint *e1 = a;
+	const Endpoint *e2 = b;
+
+	if (e1->component != e2->component) return e1->component < e2->component ? -1 : 1;
+	if (e1->valueReference != e2->valueReference) return e1->valueReference < e2->valueReference ? -1 : 1;
+	if (e1->index != e2->index) return e1->index < e2->index ? -1 : 1;
+
+	return 0;
+}
+
+static void freeTransfer(Transfer *t) {
+	free(t->startValueReferences);
+	free(t->getBatches);
+	free(t->stepCounts);
+	free(t->required);
+	free(t->values);
+	free(t->endValueReferences);
+	free(t->sourceIndices);
+	free(t->sourceBatches);
+	free(t->setBatches);
+	free(t->targetValues);
+	free(t->samples);
+	free(t->times);
+	free(t->previousTimes);
+	free(t->previousValues);
+	free(t->olderTimes);
+	free(t->olderValues);
+	free(t->factors);
+	free(t->offsets);
+	free(t->orders);
+	free(t->derivativeValueReferences);
+	free(t->derivativeOrders);
+	free(t->derivatives);
+	memset(t, 0, sizeof(Transfer));
+}
+
+static void freeTransferPlan(TransferPlan *plan) {
+	for (size_t i = 0; i < plan->nTransfers; i++) {
+		freeTransfer(&(plan->transfers[i]));
+	}
+	plan->nTransfers = 0;
+	free(plan->arrays);
+	free(plan->arrayOffsets);
+	free(plan->arrayValues);
+	plan->nArrays = 0;
+	free(plan->casts);
+	free(plan->castValues);
+	plan->nCasts = 0;
+}
+
+/* Discard the samples of the outputs so the interpolation and extrapolation restart with the next step */
+static void clearTransfer(Transfer *t) {
+
+	if (t->nValues == 0) return;
+
+	memset(t->stepCounts, 0, t->nValues * sizeof(size_t));
+
+	if (t->type != 'R') return;
+
+	memset(t->samples, 0, t->nValues * sizeof(unsigned char));
+	memset(t->times, 0, t->nValues * sizeof(fmi2Real));
+	memset(t->previousTimes, 0, t->nValues * sizeof(fmi2Real));
+	memset(t->previousValues, 0, t->nValues * sizeof(fmi2Real));
+	memset(t->olderTimes, 0, t->nValues * sizeof(fmi2Real));
+	memset(t->olderValues, 0, t->nValues * sizeof(fmi2Real));
+}
+
+/* Append a batch for endpoint i if it belongs to a different component than endpoint i - 1 */
+static void addBatch(Batch *batches, size_t *nBatches, const Endpoint *endpoints, size_t i, size_t position) {
+	if (i == 0 || endpoints[i].component != endpoints[i - 1].component) {
+		Batch *batch = &(batches[(*nBatches)++]);
+		batch->ci = endpoints[i].component;
+		batch->start = position;
+		batch->size = 0;
+		batch->contiguous = fmi2True;
+	}
+	batches[*nBatches - 1].size++;
+}
+
+static fmi2Boolean createTransfer(System *s, char type, size_t nConnections, const size_t connections[], Transfer *t) {
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < nConnections; i++) {
+		const Connection *k = &(s->connections[connections[i]]);
+		if (k->type == type && k->endType == type && k->size <= 1) n++;
+	}
+
+	if (n == 0) return fmi2True;
+
+	Endpoint *sources = calloc(n, sizeof(Endpoint));
+	Endpoint *targets = calloc(n, sizeof(Endpoint));
+
+	t->type                 = type;
+	t->startValueReferences = calloc(n, sizeof(fmi2ValueReference));
+	t->getBatches           = calloc(n, sizeof(Batch));
+	t->stepCounts           = calloc(n, sizeof(size_t));
+	t->required             = calloc(n, sizeof(fmi2Boolean));
+	t->values               = calloc(n, sizeOfType(type));
+	t->endValueReferences   = calloc(n, sizeof(fmi2ValueReference));
+	t->sourceIndices        = calloc(n, sizeof(size_t));
+	t->sourceBatches        = calloc(n, sizeof(size_t));
+	t->setBatches           = calloc(n, sizeof(Batch));
+	t->targetValues         = calloc(n, sizeOfType(type));
+
+	if (type == 'R') {
+		t->samples                   = calloc(n, sizeof(unsigned char));
+		t->times                     = calloc(n, sizeof(fmi2Real));
+		t->previousTimes             = calloc(n, sizeof(fmi2Real));
+		t->previousValues            = calloc(n, sizeof(fmi2Real));
+		t->olderTimes                = calloc(n, sizeof(fmi2Real));
+		t->olderValues               = calloc(n, sizeof(fmi2Real));
+		t->orders                    = calloc(n, sizeof(unsigned char));
+		t->derivativeValueReferences = calloc(2 * n, sizeof(fmi2ValueReference));
+		t->derivativeOrders          = calloc(2 * n, sizeof(fmi2Integer));
+		t->derivatives               = calloc(2 * n, sizeof(fmi2Real));
+	}
+
+	if (!sources || !targets || !t->startValueReferences || !t->getBatches || !t->stepCounts || !t->required || !t->values ||
+		!t->endValueReferences || !t->sourceIndices || !t->sourceBatches || !t->setBatches || !t->targetValues ||
+		(type == 'R' && (!t->samples || !t->times || !t->previousTimes || !t->previousValues || !t->olderTimes || !t->olderValues ||
+		!t->orders || !t->derivativeValueReferences || !t->derivativeOrders || !t->derivatives))) {
+		free(sources);
+		free(targets);
+		freeTransfer(t);
+		return fmi2False;
+	}
+
+	fmi2Boolean transformed = fmi2False;
+
+	for (size_t i = 0, j = 0; i < nConnections; i++) {
+		const Connection *k = &(s->connections[connections[i]]);
+		if (k->type != type || k->endType != type || k->size > 1) continue;
+		sources[j].component = k->startComponent;
+		sources[j].valueReference = k->startValueReference;
+		sources[j].index = j;
+		targets[j].component = k->endComponent;
+		targets[j].valueReference = k->endValueReference;
+		targets[j].index = j;
+		targets[j].order = k->order;
+		targets[j].factor = k->factor;
+		targets[j].offset = k->offset;
+		if (k->factor != 1 || k->offset != 0) transformed = fmi2True;
+		j++;
+	}
+
+	qsort(sources, n, sizeof(Endpoint), compareEndpoints);
+	qsort(targets, n, sizeof(Endpoint), compareEndpoints);
+
+	size_t *sourceIndices = calloc(n, sizeof(size_t));
+	size_t *sourceBatches = calloc(n, sizeof(size_t));
+
+	if (transformed) {
+		t->factors = calloc(n, sizeof(fmi2Real));
+		t->offsets = calloc(n, sizeof(fmi2Real));
+	}
+
+	if (!sourceIndices || !sourceBatches || (transformed && (!t->factors || !t->offsets))) {
+		free(sourceIndices);
+		free(sourceBatches);
+		free(sources);
+		free(targets);
+		freeTransfer(t);
+		return fmi2False;
+	}
+
+	// get every connected output only once
+	for (size_t i = 0; i < n; i++) {
+		if (i == 0 || sources[i].component != sources[i - 1].component || sources[i].valueReference != sources[i - 1].valueReference) {
+			addBatch(t->getBatches, &(t->nGetBatches), sources, i, t->nValues);
+			t->startValueReferences[t->nValues++] = sources[i].valueReference;
+		}
+		sourceIndices[sources[i].index] = t->nValues - 1;
+		sourceBatches[sources[i].index] = t->nGetBatches - 1;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		addBatch(t->setBatches, &(t->nSetBatches), targets, i, i);
+		t->endValueReferences[i] = targets[i].valueReference;
+		t->sourceIndices[i] = sourceIndices[targets[i].index];
+		t->sourceBatches[i] = sourceBatches[targets[i].index];
+		if (type == 'R') t->orders[i] = targets[i].order;
+		if (transformed) {
+			t->factors[i] = targets[i].factor;
+			t->offsets[i] = targets[i].offset;
+		}
+	}
+
+	t->nTargets = n;
+
+	free(sourceIndices);
+	free(sourceBatches);
+	free(sources);
+	free(targets);
+
+	return fmi2True;
+}
+
+/* Group the connections by type and by start and end component */
+static fmi2Boolean createTransferPlan(System *s, size_t nConnections, const size_t connections[], TransferPlan *plan) {
+
+	const char types[] = { 'R', 'I', 'B' };
+
+	memset(plan, 0, sizeof(TransferPlan));
+
+	for (size_t i = 0; i < sizeof(types); i++) {
+
+		Transfer *t = &(plan->transfers[plan->nTransfers]);
+
+		if (!createTransfer(s, types[i], nConnections, connections, t)) {
+			freeTransferPlan(plan);
+			return fmi2False;
+		}
+
+		if (t->nTargets > 0) plan->nTransfers++;
+	}
+
+	size_t nValues = 0;
+
+	for (size_t i = 0; i < nConnections; i++) {
+		const Connection *k = &(s->connections[connections[i]]);
+		if (k->size > 1) {
+			plan->nArrays++;
+			nValues += k->size;
+		} else if (k->type != k->endType) {
+			plan->nCasts++;
+		}
+	}
+
+	plan->arrays = calloc(plan->nArrays + 1, sizeof(size_t));
+	plan->arrayOffsets = calloc(plan->nArrays + 1, sizeof(size_t));
+	plan->arrayValues = calloc(nValues + 1, sizeof(fmi2Real));
+	plan->casts = calloc(plan->nCasts + 1, sizeof(size_t));
+	plan->castValues = calloc(plan->nCasts + 1, sizeof(fmi2Real));
+
+	if (!plan->arrays || !plan->arrayOffsets || !plan->arrayValues || !plan->casts || !plan->castValues) {
+		freeTransferPlan(plan);
+		return fmi2False;
+	}
+
+	for (size_t i = 0, j = 0, l = 0, offset = 0; i < nConnections; i++) {
+		const Connection *k = &(s->connections[connections[i]]);
+		if (k->size > 1) {
+			plan->arrays[j] = connections[i];
+			plan->arrayOffsets[j++] = offset;
+			offset += k->size;
+		} else if (k->type != k->endType) {
+			plan->casts[l++] = connections[i];
+		}
+	}
+
+	return fmi2True;
+}
+
+/* Apply the linear transformations of the real connections to n inputs. This is the innermost loop of
+   the transfer for systems with unit conversions and is kept free of branches so it can be vectorized. */
+static void transformValues(fmi2Real values[], const fmi2Real factors[], const fmi2Real offsets[], size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		values[i] = factors[i] * values[i] + offsets[i];
+	}
+}
+
+/* Get the value of a real, integer or boolean variable as real */
+static fmi2Status getComponentValueAsReal(Model *m, char type, fmi2ValueReference vr, fmi2Real *value) {
+
+	fmi2Status status;
+	fmi2Integer integerValue = 0;
+	fmi2Boolean booleanValue = fmi2False;
+
+	switch (type) {
+	case 'R':
+		return m->fmi2GetReal(m->c, &vr, 1, value);
+	case 'I':
+		status = m->fmi2GetInteger(m->c, &vr, 1, &integerValue);
+		*value = integerValue;
+		return status;
+	case 'B':
+		status = m->fmi2GetBoolean(m->c, &vr, 1, &booleanValue);
+		*value = booleanValue ? 1 : 0;
+		return status;
+	default:
+		return fmi2Error;
+	}
+}
+
+static fmi2Boolean castable(char type) {
+	return type == 'R' || type == 'I' || type == 'B';
+}
+
+/* Set a real value to a real, integer (rounded to the nearest integer) or boolean (value != 0) variable */
+static fmi2Status setComponentValueFromReal(Model *m, char type, fmi2ValueReference vr, fmi2Real value) {
+
+	fmi2Integer integerValue;
+	fmi2Boolean booleanValue;
+
+	switch (type) {
+	case 'R':
+		return m->fmi2SetReal(m->c, &vr, 1, &value);
+	case 'I':
+		integerValue = (fmi2Integer)(value < 0 ? value - 0.5 : value + 0.5);
+		return m->fmi2SetInteger(m->c, &vr, 1, &integerValue);
+	case 'B':
+		booleanValue = value != 0 ? fmi2True : fmi2False;
+		return m->fmi2SetBoolean(m->c, &vr, 1, &booleanValue);
+	default:
+		return fmi2Error;
+	}
+}
+
+/* Interpolate (or extrapolate) the real inputs of component m that come from slower components linearly */
+static void interpolate(System *s, Transfer *t, const Batch *batch, const Model *m) {
+
+	// sample the inputs in the middle of the step
+	const fmi2Real time = m->currentTime + 0.5 * m->currentStepSize;
+
+	for (size_t i = batch->start; i < batch->start + batch->size; i++) {
+
+		const size_t k = t->sourceIndices[i];
+		const Model *source = &(s->components[t->getBatches[t->sourceBatches[i]].ci]);
+
+		if (source->nSteps < m->nSteps && t->samples[k] > 1) {
+			const fmi2Real v0 = t->previousValues[k];
+			const fmi2Real v1 = ((const fmi2Real *)t->values)[k];
+			((fmi2Real *)t->targetValues)[i] = v1 + (v1 - v0) * (time - t->times[k]) / (t->times[k] - t->previousTimes[k]);
+		}
+	}
+}
+
+/* Evaluate the polynomial of the given order through the last samples of output k and its
+   first and second derivative at time. Returns the order that could be used. */
+static size_t extrapolateOutput(const Transfer *t, size_t k, size_t order, fmi2Real time, fmi2Real p[3]) {
+
+	const fmi2Real v0 = ((const fmi2Real *)t->values)[k];
+
+	const size_t maxOrder = t->samples[k] > 0 ? t->samples[k] - 1 : 0;
+
+	if (order > maxOrder) order = maxOrder;
+
+	p[0] = v0;
+	p[1] = 0;
+	p[2] = 0;
+
+	if (order > 0) {
+
+		// divided differences
+		const fmi2Real t0 = t->times[k], t1 = t->previousTimes[k];
+		const fmi2Real d1 = (v0 - t->previousValues[k]) / (t0 - t1);
+
+		p[0] = v0 + d1 * (time - t0);
+		p[1] = d1;
+
+		if (order > 1) {
+			const fmi2Real t2 = t->olderTimes[k];
+			const fmi2Real d2 = (d1 - (t->previousValues[k] - t->olderValues[k]) / (t1 - t2)) / (t0 - t2);
+			p[0] += d2 * (time - t0) * (time - t1);
+			p[1] += d2 * ((time - t0) + (time - t1));
+			p[2] = 2 * d2;
+		}
+	}
+
+	return order;
+}
+
+/* Extrapolate the real inputs of component m with connections of order > 0. Components that can
+   interpolate inputs get the value and the derivatives at the start of the step, for all others
+   the polynomial is evaluated in the middle of the step. Returns the number of derivatives. */
+static size_t extrapolate(Transfer *t, const Batch *batch, const Model *m) {
+
+	size_t nDerivatives = 0;
+
+	const fmi2Real time = m->canInterpolateInputs ? m->currentTime : m->currentTime + 0.5 * m->currentStepSize;
+
+	for (size_t i = batch->start; i < batch->start + batch->size; i++) {
+
+		if (t->orders[i] == 0) continue;
+
+		fmi2Real p[3];
+
+		const size_t order = extrapolateOutput(t, t->sourceIndices[i], t->orders[i], time, p);
+
+		((fmi2Real *)t->targetValues)[i] = p[0];
+
+		if (!m->canInterpolateInputs) continue;
+
+		// pass zero derivatives if there are not enough samples yet to clear the previous ones
+		for (size_t j = 0; j < t->orders[i]; j++) {
+			t->derivativeValueReferences[nDerivatives] = t->endValueReferences[i];
+			t->derivativeOrders[nDerivatives] = (fmi2Integer)(j + 1);
+			t->derivatives[nDerivatives] = j < order ? (t->factors ? t->factors[i] : 1) * p[j + 1] : 0;
+			nDerivatives++;
+		}
+	}
+
+	return nDerivatives;
+}
+
+/* Transfer the connections to the active components. Outputs are only read again
+   if their component has been stepped since the last transfer unless refresh is set. */
+static fmi2Status transfer(System *s, TransferPlan *plan, fmi2Boolean refresh) {
+
+	fmi2Status status = fmi2OK;
+
+	// get all outputs before setting the inputs
+	for (size_t i = 0; i < plan->nTransfers; i++) {
+
+		Transfer *t = &(plan->transfers[i]);
+		const size_t size = sizeOfType(t->type);
+
+		memset(t->required, 0, t->nGetBatches * sizeof(fmi2Boolean));
+
+		for (size_t j = 0; j < t->nSetBatches; j++) {
+			const Batch *batch = &(t->setBatches[j]);
+			if (!s->active[batch->ci]) continue;
+			for (size_t k = batch->start; k < batch->start + batch->size; k++) {
+				t->required[t->sourceBatches[k]] = fmi2True;
+			}
+		}
+
+		for (size_t j = 0; j < t->nGetBatches; j++) {
+
+			const Batch *batch = &(t->getBatches[j]);
+			Model *m = &(s->components[batch->ci]);
+
+			if (!t->required[j] || (!refresh && t->stepCounts[j] == m->stepCount)) continue;
+
+			if (t->type == 'R') {
+				for (size_t k = batch->start; k < batch->start + batch->size; k++) {
+					if (t->samples[k] > 0 && m->time > t->times[k]) {
+						t->olderTimes[k] = t->previousTimes[k];
+						t->olderValues[k] = t->previousValues[k];
+						t->previousTimes[k] = t->times[k];
+						t->previousValues[k] = ((const fmi2Real *)t->values)[k];
+					}
+					if (t->samples[k] == 0 || m->time > t->times[k]) {
+						if (t->samples[k] < 3) t->samples[k]++;
+						t->times[k] = m->time;
+					}
+				}
+			}
+
+			PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(getComponentValues(m, t->type, &(t->startValueReferences[batch->start]), batch->size, (char *)t->values + batch->start * size)))
+
+			t->stepCounts[j] = m->stepCount;
+		}
+	}
+
+	for (size_t i = 0; i < plan->nArrays; i++) {
+
+		const Connection *k = &(s->connections[plan->arrays[i]]);
+		Model *m = &(s->components[k->startComponent]);
+
+		if (!s->active[k->endComponent]) continue;
+
+		PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(getComponentArray(m, k->startValueReference, &(plan->arrayValues[plan->arrayOffsets[i]]), k->size)))
+	}
+
+	for (size_t i = 0; i < plan->nCasts; i++) {
+
+		const Connection *k = &(s->connections[plan->casts[i]]);
+		Model *m = &(s->components[k->startComponent]);
+
+		if (!s->active[k->endComponent]) continue;
+
+		PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(getComponentValueAsReal(m, k->type, k->startValueReference, &(plan->castValues[i]))))
+	}
+
+	for (size_t i = 0; i < plan->nTransfers; i++) {
+
+		Transfer *t = &(plan->transfers[i]);
+		const size_t size = sizeOfType(t->type);
+
+		for (size_t j = 0; j < t->nSetBatches; j++) {
+
+			const Batch *batch = &(t->setBatches[j]);
+			Model *m = &(s->components[batch->ci]);
+
+			if (!s->active[batch->ci]) continue;
+
+			gather(t->type, (char *)t->targetValues + batch->start * size, t->values, &(t->sourceIndices[batch->start]), batch->size);
+
+			size_t nDerivatives = 0;
+
+			if (t->type == 'R') {
+				if (m->interpolation) interpolate(s, t, batch, m);
+				nDerivatives = extrapolate(t, batch, m);
+				if (t->factors) {
+					transformValues((fmi2Real *)t->targetValues + batch->start, &(t->factors[batch->start]), &(t->offsets[batch->start]), batch->size);
+				}
+			}
+
+			PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(setComponentValues(m, t->type, &(t->endValueReferences[batch->start]), batch->size, (const char *)t->targetValues + batch->start * size)))
+
+			if (nDerivatives > 0) {
+				PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(m->fmi2SetRealInputDerivatives(m->c, t->derivativeValueReferences, nDerivatives, t->derivativeOrders, t->derivatives)))
+			}
+		}
+	}
+
+	for (size_t i = 0; i < plan->nArrays; i++) {
+
+		const Connection *k = &(s->connections[plan->arrays[i]]);
+		Model *m = &(s->components[k->endComponent]);
+
+		if (!s->active[k->endComponent]) continue;
+
+		fmi2Real *values = &(plan->arrayValues[plan->arrayOffsets[i]]);
+
+		if (k->factor != 1 || k->offset != 0) {
+			for (size_t j = 0; j < k->size; j++) {
+				values[j] = k->factor * values[j] + k->offset;
+			}
+		}
+
+		PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(setComponentArray(m, k->endValueReference, values, k->size)))
+	}
+
+	for (size_t i = 0; i < plan->nCasts; i++) {
+
+		const Connection *k = &(s->connections[plan->casts[i]]);
+		Model *m = &(s->components[k->endComponent]);
+
+		if (!s->active[k->endComponent]) continue;
+
+		PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(setComponentValueFromReal(m, k->endType, k->endValueReference, k->factor * plan->castValues[i] + k->offset)))
+	}
+
+END:
+	return status;
+}
+
+
+/***************************************************
+Schedule
+****************************************************/
+
+typedef struct {
+
+	size_t *offsets;
+	size_t *targets;
+
+	size_t counter;
+	size_t *index;
+	size_t *lowlink;
+	char *onStack;
+
+	size_t stackSize;
+	size_t *stack;
+
+	size_t nSCCs;
+	size_t *scc;
+
+} Graph;
+
+/* Tarjan's algorithm */
+static void strongConnect(Graph *g, size_t v) {
+
+	g->index[v] = g->lowlink[v] = ++g->counter;
+	g->stack[g->stackSize++] = v;
+	g->onStack[v] = 1;
+
+	for (size_t i = g->offsets[v]; i < g->offsets[v + 1]; i++) {
+
+		size_t w = g->targets[i];
+
+		if (!g->index[w]) {
+			strongConnect(g, w);
+			if (g->lowlink[w] < g->lowlink[v]) g->lowlink[v] = g->lowlink[w];
+		} else if (g->onStack[w] && g->index[w] < g->lowlink[v]) {
+			g->lowlink[v] = g->index[w];
+		}
+	}
+
+	if (g->lowlink[v] == g->index[v]) {
+		size_t w;
+		do {
+			w = g->stack[--g->stackSize];
+			g->onStack[w] = 0;
+			g->scc[w] = g->nSCCs;
+		} while (w != v);
+		g->nSCCs++;
+	}
+}
+
+/* Assign the components to levels so that every component comes after the components it depends on.
+   Components that form an algebraic loop that is not broken are put on the same level. */
+static fmi2Boolean sortComponents(System *s, size_t levels[], size_t *nLevels, const fmi2CallbackFunctions *functions, fmi2String instanceName) {
+
+	const size_t n = s->nComponents;
+	fmi2Boolean success = fmi2False;
+
+	Graph g;
+	memset(&g, 0, sizeof(Graph));
+
+	g.offsets = calloc(n + 1, sizeof(size_t));
+	g.targets = calloc(s->nConnections, sizeof(size_t));
+	g.index   = calloc(n, sizeof(size_t));
+	g.lowlink = calloc(n, sizeof(size_t));
+	g.onStack = calloc(n, sizeof(char));
+	g.stack   = calloc(n, sizeof(size_t));
+	g.scc     = calloc(n, sizeof(size_t));
+
+	size_t *sccLevels = calloc(n, sizeof(size_t));
+	size_t *sccSizes  = calloc(n, sizeof(size_t));
+	size_t *order     = calloc(n + 1, sizeof(size_t));
+
+	if (!g.offsets || !g.targets || !g.index || !g.lowlink || !g.onStack || !g.stack || !g.scc || !sccLevels || !sccSizes || !order) goto END;
+
+	// adjacency list of the connections that are not marked to break a loop
+	for (size_t i = 0; i < s->nConnections; i++) {
+		const Connection *k = &(s->connections[i]);
+		if (!k->breakLoop && k->startComponent != k->endComponent) g.offsets[k->startComponent + 1]++;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		g.offsets[i + 1] += g.offsets[i];
+	}
+
+	for (size_t i = 0, *next = order; i < s->nConnections; i++) {
+		const Connection *k = &(s->connections[i]);
+		if (!k->breakLoop && k->startComponent != k->endComponent) g.targets[g.offsets[k->startComponent] + next[k->startComponent]++] = k->endComponent;
+	}
+
+	for (size_t v = 0; v < n; v++) {
+		if (!g.index[v]) strongConnect(&g, v);
+	}
+
+	for (size_t v = 0; v < n; v++) {
+		sccSizes[g.scc[v]]++;
+	}
+
+	for (size_t v = 0; v < n; v++) {
+		if (sccSizes[g.scc[v]] > 1) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Warning, "warning",
+				"Component %s is part of an algebraic loop. Set \"break\" on one of the connections of the loop to step the components one after another.", s->components[v].name);
+		}
+	}
+
+	// Tarjan's algorithm finds the SCCs in reverse topological order
+	memset(order, 0, (n + 1) * sizeof(size_t));
+
+	for (size_t v = 0; v < n; v++) {
+		order[n - g.scc[v]]++;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		order[i + 1] += order[i];
+	}
+
+	size_t *sorted = g.stack;
+
+	for (size_t v = 0; v < n; v++) {
+		sorted[order[n - 1 - g.scc[v]]++] = v;
+	}
+
+	*nLevels = 0;
+
+	for (size_t i = 0; i < n; i++) {
+
+		const size_t v = sorted[i];
+		const size_t level = sccLevels[g.scc[v]];
+
+		for (size_t j = g.offsets[v]; j < g.offsets[v + 1]; j++) {
+			const size_t w = g.targets[j];
+			if (g.scc[w] != g.scc[v] && sccLevels[g.scc[w]] < level + 1) sccLevels[g.scc[w]] = level + 1;
+		}
+
+		levels[v] = level;
+
+		if (level + 1 > *nLevels) *nLevels = level + 1;
+	}
+
+	success = fmi2True;
+
+END:
+	free(g.offsets);
+	free(g.targets);
+	free(g.index);
+	free(g.lowlink);
+	free(g.onStack);
+	free(g.stack);
+	free(g.scc);
+	free(sccLevels);
+	free(sccSizes);
+	free(order);
+
+	return success;
+}
+
+static void freeSchedule(System *s) {
+
+	for (size_t i = 0; i < s->nLevels; i++) {
+		Level *level = &(s->levels[i]);
+		free(level->components);
+		free(level->pinned);
+		freeTransferPlan(&(level->transferPlan));
+	}
+
+	free(s->levels);
+
+	s->nLevels = 0;
+	s->levels = NULL;
+}
+
+/* Create the levels of components that are stepped together. With Gauss-Seidel the
+   inputs of a level are set right before it is stepped. Jacobi uses a single level. */
+static fmi2Boolean createSchedule(System *s, fmi2Boolean gaussSeidel, const fmi2CallbackFunctions *functions, fmi2String instanceName) {
+
+	size_t *levels = calloc(s->nComponents, sizeof(size_t));
+	size_t *connections = calloc(s->nConnections, sizeof(size_t));
+
+	if (!levels || !connections) goto FAIL;
+
+	s->nLevels = 1;
+
+	if (gaussSeidel && !sortComponents(s, levels, &(s->nLevels), functions, instanceName)) goto FAIL;
+
+	s->levels = calloc(s->nLevels, sizeof(Level));
+
+	if (!s->levels) goto FAIL;
+
+	for (size_t i = 0; i < s->nLevels; i++) {
+
+		Level *level = &(s->levels[i]);
+		size_t nConnections = 0;
+
+		for (size_t j = 0; j < s->nComponents; j++) {
+			if (levels[j] == i) level->nComponents++;
+		}
+
+		level->components = calloc(level->nComponents, sizeof(size_t));
+		level->pinned = calloc(level->nComponents, sizeof(int));
+
+		if (!level->components || !level->pinned) goto FAIL;
+
+		for (size_t j = 0, k = 0; j < s->nComponents; j++) {
+			if (levels[j] == i) {
+				// components that are not thread-safe are stepped on the same thread
+				level->pinned[k] = !s->components[j].threadSafe;
+				level->components[k++] = j;
+			}
+		}
+
+		for (size_t j = 0; j < s->nConnections; j++) {
+			if (levels[s->connections[j].endComponent] == i) connections[nConnections++] = j;
+		}
+
+		if (!createTransferPlan(s, nConnections, connections, &(level->transferPlan))) goto FAIL;
+	}
+
+	free(levels);
+	free(connections);
+
+	return fmi2True;
+
+FAIL:
+	free(levels);
+	free(connections);
+	freeSchedule(s);
+	free(s->segments);
+
+	return fmi2False;
+}
+
+static fmi2Status stepComponent(System *s, Model *m) {
+
+	fmi2Status status;
+
+	PROFILE(s, m, PROFILE_DO_STEP, status = m->fmi2DoStep(m->c, m->currentTime, m->currentStepSize, s->noSetFMUStatePriorToCurrentPoint))
+
+	m->time = m->currentTime + m->currentStepSize;
+	m->stepCount++;
+
+	return status;
+}
+
+static void doStep(void *userData, size_t i) {
+	System *s = userData;
+	s->statuses[i] = stepComponent(s, &(s->components[s->activeComponents[i]]));
+}
+
+static size_t greatestCommonDivisor(size_t a, size_t b) {
+	while (b) {
+		size_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+
+/***************************************************
+Algebraic loops
+****************************************************/
+
+typedef enum {
+	LOOP_STEPS,
+	LOOP_ITERATIONS,
+	LOOP_MAX_STEP_ITERATIONS,
+	LOOP_FAILURES,
+	N_LOOP_STATISTICS
+} LoopStatistic;
+
+#define ABS(x) ((x) < 0 ? -(x) : (x))
+
+static void freeLoops(System *s) {
+
+	for (size_t i = 0; i < s->nLoops; i++) {
+
+		Loop *loop = &(s->loops[i]);
+
+		if (loop->states) {
+			for (size_t j = 0; j < loop->nComponents; j++) {
+				Model *m = &(s->components[loop->components[j]]);
+				if (loop->states[j]) m->fmi2FreeFMUstate(m->c, &(loop->states[j]));
+			}
+		}
+
+		freeTransfer(&(loop->transfer));
+		free(loop->components);
+		free(loop->states);
+		free(loop->guess);
+		free(loop->residuals);
+		free(loop->previousGuess);
+		free(loop->previousResiduals);
+		free(loop->inverseJacobian);
+	}
+
+	free(s->loops);
+
+	s->nLoops = 0;
+	s->loops = NULL;
+}
+
+/* Check the loops and collect the real connections between their components */
+static fmi2Boolean createLoops(System *s) {
+
+	fmi2Boolean success = fmi2True;
+	size_t *connections = calloc(s->nConnections + 1, sizeof(size_t));
+	size_t *levels = calloc(s->nComponents + 1, sizeof(size_t));
+	fmi2Boolean *inLoop = calloc(s->nComponents + 1, sizeof(fmi2Boolean));
+
+	if (!connections || !levels || !inLoop) {
+		success = fmi2False;
+		goto END;
+	}
+
+	for (size_t i = 0; i < s->nLevels; i++) {
+		for (size_t j = 0; j < s->levels[i].nComponents; j++) {
+			levels[s->levels[i].components[j]] = i;
+		}
+	}
+
+	for (size_t i = 0; i < s->nLoops; i++) {
+
+		Loop *loop = &(s->loops[i]);
+		size_t nConnections = 0;
+
+		if (loop->nComponents == 0 || !loop->components) {
+			s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "error", "Loop %zu has no components.", i);
+			success = fmi2False;
+			goto END;
+		}
+
+		loop->level = levels[loop->components[0]];
+
+		for (size_t j = 0; j < loop->nComponents; j++) {
+
+			const size_t ci = loop->components[j];
+
+			if (ci >= s->nComponents || inLoop[ci] || levels[ci] != loop->level) {
+				s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "error",
+					"The components of loop %zu must be stepped together and can only be part of one loop.", i);
+				success = fmi2False;
+				goto END;
+			}
+
+			inLoop[ci] = fmi2True;
+		}
+
+		for (size_t j = 0; j < s->nConnections; j++) {
+
+			const Connection *k = &(s->connections[j]);
+			fmi2Boolean start = fmi2False, end = fmi2False;
+
+			for (size_t l = 0; l < loop->nComponents; l++) {
+				if (loop->components[l] == k->startComponent) start = fmi2True;
+				if (loop->components[l] == k->endComponent) end = fmi2True;
+			}
+
+			if (k->type == 'R' && k->endType == 'R' && k->size <= 1 && start && end) connections[nConnections++] = j;
+		}
+
+		if (!createTransfer(s, 'R', nConnections, connections, &(loop->transfer))) {
+			success = fmi2False;
+			goto END;
+		}
+
+		const size_t n = loop->transfer.nValues;
+
+		loop->states            = calloc(loop->nComponents, sizeof(fmi2FMUstate));
+		loop->guess             = calloc(n + 1, sizeof(fmi2Real));
+		loop->residuals         = calloc(n + 1, sizeof(fmi2Real));
+		loop->previousGuess     = calloc(n + 1, sizeof(fmi2Real));
+		loop->previousResiduals = calloc(n + 1, sizeof(fmi2Real));
+
+		if (loop->method == LOOP_BROYDEN) {
+			loop->inverseJacobian = calloc(n * n + 1, sizeof(fmi2Real));
+		}
+
+		if (!loop->states || !loop->guess || !loop->residuals || !loop->previousGuess || !loop->previousResiduals ||
+			(loop->method == LOOP_BROYDEN && !loop->inverseJacobian)) {
+			success = fmi2False;
+			goto END;
+		}
+	}
+
+END:
+	free(connections);
+	free(levels);
+	free(inLoop);
+
+	return success;
+}
+
+/* Get the coupled outputs of the loop */
+static fmi2Status getLoopOutputs(System *s, Loop *loop, fmi2Real *values) {
+
+	fmi2Status status = fmi2OK;
+	Transfer *t = &(loop->transfer);
+
+	for (size_t i = 0; i < t->nGetBatches; i++) {
+		const Batch *batch = &(t->getBatches[i]);
+		Model *m = &(s->components[batch->ci]);
+		PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(getComponentValues(m, 'R', &(t->startValueReferences[batch->start]), batch->size, &values[batch->start])))
+	}
+
+END:
+	return status;
+}
+
+/* Restore the components of the loop, set the guessed inputs and step them again */
+static fmi2Status restepLoop(System *s, Loop *loop) {
+
+	fmi2Status status = fmi2OK;
+	Transfer *t = &(loop->transfer);
+
+	for (size_t i = 0; i < loop->nComponents; i++) {
+		Model *m = &(s->components[loop->components[i]]);
+		CHECK_STATUS(m->fmi2SetFMUstate(m->c, loop->states[i]))
+	}
+
+	for (size_t i = 0; i < t->nSetBatches; i++) {
+		const Batch *batch = &(t->setBatches[i]);
+		Model *m = &(s->components[batch->ci]);
+		gather('R', &((fmi2Real *)t->targetValues)[batch->start], loop->guess, &(t->sourceIndices[batch->start]), batch->size);
+		if (t->factors) {
+			transformValues((fmi2Real *)t->targetValues + batch->start, &(t->factors[batch->start]), &(t->offsets[batch->start]), batch->size);
+		}
+		PROFILE(s, m, PROFILE_TRANSFER, CHECK_STATUS(setComponentValues(m, 'R', &(t->endValueReferences[batch->start]), batch->size, &((const fmi2Real *)t->targetValues)[batch->start])))
+	}
+
+	if (s->threadPool) {
+
+		for (size_t i = 0; i < loop->nComponents; i++) {
+			s->activeComponents[i] = loop->components[i];
+			s->activePinned[i] = !s->components[loop->components[i]].threadSafe;
+		}
+
+		s->nActiveComponents = loop->nComponents;
+
+		runThreadPool(s->threadPool, doStep, s, s->nActiveComponents, s->activePinned);
+
+		for (size_t i = 0; i < s->nActiveComponents; i++) {
+			if (s->statuses[i] > status) status = s->statuses[i];
+		}
+
+	} else {
+
+		for (size_t i = 0; i < loop->nComponents; i++) {
+			CHECK_STATUS(stepComponent(s, &(s->components[loop->components[i]])))
+		}
+	}
+
+END:
+	return status;
+}
+
+/* Save the states of the components of the active loops of a level before they are stepped
+   and use the current outputs as the first guess */
+static fmi2Status beginLoops(System *s, size_t level) {
+
+	fmi2Status status = fmi2OK;
+
+	for (size_t i = 0; i < s->nLoops; i++) {
+
+		Loop *loop = &(s->loops[i]);
+
+		if (loop->level != level || !s->active[loop->components[0]]) continue;
+
+		for (size_t j = 0; j < loop->nComponents; j++) {
+			Model *m = &(s->components[loop->components[j]]);
+			CHECK_STATUS(m->fmi2GetFMUstate(m->c, &(loop->states[j])))
+		}
+
+		CHECK_STATUS(getLoopOutputs(s, loop, loop->guess))
+	}
+
+END:
+	return status;
+}
+
+/* Iterate the active loops of a level until the coupled outputs at the end of the step
+   match the inputs that were used for the step */
+static fmi2Status iterateLoops(System *s, size_t level) {
+
+	fmi2Status status = fmi2OK, loopStatus = fmi2OK;
+	fmi2Boolean converged = fmi2True;
+
+	for (size_t i = 0; i < s->nLoops; i++) {
+
+		Loop *loop = &(s->loops[i]);
+		const size_t n = loop->transfer.nValues;
+		fmi2Real *outputs = loop->transfer.values;
+		fmi2Real *H = loop->inverseJacobian;
+
+		if (loop->level != level || !s->active[loop->components[0]]) continue;
+
+		loop->nSteps++;
+
+		for (size_t k = 1; ; k++) {
+
+			loop->nIterations++;
+
+			if (k > loop->maxStepIterations) loop->maxStepIterations = k;
+
+			CHECK_STATUS(getLoopOutputs(s, loop, outputs))
+
+			converged = fmi2True;
+
+			for (size_t j = 0; j < n; j++) {
+				loop->residuals[j] = outputs[j] - loop->guess[j];
+				if (ABS(loop->residuals[j]) > loop->tolerance * (1 + ABS(outputs[j]))) converged = fmi2False;
+			}
+
+			if (converged) break;
+
+			if (k >= loop->maxIterations) {
+				loop->nFailures++;
+				break;
+			}
+
+			if (loop->method == LOOP_BROYDEN) {
+
+				if (k == 1) {
+					// start with a relaxed fixed-point iteration
+					memset(H, 0, n * n * sizeof(fmi2Real));
+					for (size_t j = 0; j < n; j++) H[j * n + j] = -loop->relaxation;
+				} else {
+					// "bad" Broyden update of the inverse Jacobian H += (dg - H dr) dr^T / (dr^T dr)
+					fmi2Real *dg = loop->previousGuess, *dr = loop->previousResiduals;
+					fmi2Real drdr = 0;
+
+					for (size_t j = 0; j < n; j++) {
+						dg[j] = loop->guess[j] - dg[j];
+						dr[j] = loop->residuals[j] - dr[j];
+						drdr += dr[j] * dr[j];
+					}
+
+					if (drdr > 0) {
+						for (size_t j = 0; j < n; j++) {
+							fmi2Real v = dg[j];
+							for (size_t l = 0; l < n; l++) v -= H[j * n + l] * dr[l];
+							for (size_t l = 0; l < n; l++) H[j * n + l] += v * dr[l] / drdr;
+						}
+					}
+				}
+
+				memcpy(loop->previousGuess, loop->guess, n * sizeof(fmi2Real));
+				memcpy(loop->previousResiduals, loop->residuals, n * sizeof(fmi2Real));
+
+				// g -= H r
+				for (size_t j = 0; j < n; j++) {
+					for (size_t l = 0; l < n; l++) loop->guess[j] -= H[j * n + l] * loop->residuals[l];
+				}
+
+			} else {
+
+				for (size_t j = 0; j < n; j++) {
+					loop->guess[j] += loop->relaxation * loop->residuals[j];
+				}
+			}
+
+			CHECK_STATUS(restepLoop(s, loop))
+		}
+
+		if (!converged) {
+			s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Warning, "logWarning",
+				"Loop %zu did not converge in %zu iterations.", i, loop->maxIterations);
+			loopStatus = fmi2Warning;
+		}
+	}
+
+END:
+	return status > loopStatus ? status : loopStatus;
+}
+
+/* The largest number of micro steps per communication step */
+#define MAX_MICRO_STEPS 100000000
+
+/* The relative tolerance for a step size to divide the communication step size */
+#define STEP_SIZE_TOLERANCE 1e-6
+
+
+/***************************************************
+FMU state
+****************************************************/
+
+typedef struct {
+
+	fmi2FMUstate *states;
+	fmi2Byte *data;
+
+	/* set by fmi2DeSerializeFMUstate(), the component states are deserialized when they are needed */
+	fmi2Byte *serializedState;
+	size_t serializedStateSize;
+
+} SystemState;
+
+#define STATE_ID "FMUCSTA1"
+
+/* Layout of a serialized state: header, offset and size of the component states, container data, component states */
+typedef struct {
+
+	char id[8];
+	uint64_t nComponents;
+	uint64_t dataSize;
+
+} StateHeader;
+
+static void addSegment(System *s, void *data, size_t size) {
+	if (size == 0) return;
+	s->segments[s->nSegments].data = data;
+	s->segments[s->nSegments].size = size;
+	s->nSegments++;
+	s->segmentsSize += size;
+}
+
+/* Collect the internal buffers of the container that are part of the FMU state */
+static fmi2Boolean createSegments(System *s) {
+
+	// the position of the recorder is added by createRecording()
+	size_t n = s->nComponents + 2;
+
+	for (size_t i = 0; i < s->nLevels; i++) {
+		n += 7 * s->levels[i].transferPlan.nTransfers;
+	}
+
+	s->segments = calloc(n, sizeof(Segment));
+
+	if (!s->segments) return fmi2False;
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		addSegment(s, &(s->components[i].time), sizeof(fmi2Real));
+	}
+
+	for (size_t i = 0; i < s->nLevels; i++) {
+
+		TransferPlan *plan = &(s->levels[i].transferPlan);
+
+		for (size_t j = 0; j < plan->nTransfers; j++) {
+
+			Transfer *t = &(plan->transfers[j]);
+
+			addSegment(s, t->values, t->nValues * sizeOfType(t->type));
+
+			if (t->type == 'R') {
+				addSegment(s, t->samples, t->nValues * sizeof(unsigned char));
+				addSegment(s, t->times, t->nValues * sizeof(fmi2Real));
+				addSegment(s, t->previousTimes, t->nValues * sizeof(fmi2Real));
+				addSegment(s, t->previousValues, t->nValues * sizeof(fmi2Real));
+				addSegment(s, t->olderTimes, t->nValues * sizeof(fmi2Real));
+				addSegment(s, t->olderValues, t->nValues * sizeof(fmi2Real));
+			}
+		}
+	}
+
+	return fmi2True;
+}
+
+static void freeSystemState(System *s, SystemState *state) {
+
+	if (!state) return;
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		if (state->states[i]) m->fmi2FreeFMUstate(m->c, &(state->states[i]));
+	}
+
+	free(state->states);
+	free(state->data);
+	free(state->serializedState);
+	free(state);
+}
+
+static const uint64_t *stateIndex(const SystemState *state) {
+	return (const uint64_t *)(state->serializedState + sizeof(StateHeader));
+}
+
+/* Deserialize the state of component i if it is not available yet */
+static fmi2Status deserializeComponentState(System *s, SystemState *state, size_t i) {
+
+	if (state->states[i]) return fmi2OK;
+
+	if (!state->serializedState) return fmi2Error;
+
+	Model *m = &(s->components[i]);
+	const uint64_t *index = stateIndex(state);
+
+	return m->fmi2DeSerializeFMUstate(m->c, state->serializedState + index[2 * i], (size_t)index[2 * i + 1], &(state->states[i]));
+}
+
+
+/***************************************************
+Optional configuration parameters
+****************************************************/
+
+static fmi2Boolean optionalBoolean(mpack_node_t map, const char *key, fmi2Boolean defaultValue) {
+	mpack_node_t node = mpack_node_map_cstr_optional(map, key);
+	return mpack_node_is_missing(node) ? defaultValue : mpack_node_bool(node);
+}
+
+static size_t optionalSize(mpack_node_t map, const char *key, size_t defaultValue) {
+	mpack_node_t node = mpack_node_map_cstr_optional(map, key);
+	return mpack_node_is_missing(node) ? defaultValue : (size_t)mpack_node_u64(node);
+}
+
+static fmi2Real optionalReal(mpack_node_t map, const char *key, fmi2Real defaultValue) {
+	mpack_node_t node = mpack_node_map_cstr_optional(map, key);
+	return mpack_node_is_missing(node) ? defaultValue : mpack_node_double(node);
+}
+
+
+/***************************************************
+Configuration
+****************************************************/
+
+typedef struct {
+
+	size_t variable;  // index of the container variable
+	char type;
+	char *name;
+
+} RecordedVariable;
+
+typedef struct {
+
+	fmi2Boolean gaussSeidel;
+	fmi2Boolean parallelDoStep;
+	fmi2Boolean parallelInstantiation;
+	fmi2Boolean asyncDoStep;
+	size_t nThreads;
+
+	char *recorderFilename;  // NULL = no recorder
+	fmi2Real recorderInterval;
+	size_t nRecordedVariables;
+	RecordedVariable *recordedVariables;
+
+} Options;
+
+static void freeOptions(Options *options) {
+
+	for (size_t i = 0; i < options->nRecordedVariables; i++) {
+		free(options->recordedVariables[i].name);
+	}
+
+	free(options->recordedVariables);
+	free(options->recorderFilename);
+}
+
+/* Read the MessagePack configuration (config.mp) */
+static fmi2Boolean readConfig(System *s, Options *options, const char *filename) {
+
+	// parse a file into a node tree
+	mpack_tree_t tree;
+	mpack_tree_init_filename(&tree, filename, 0);
+	mpack_tree_parse(&tree);
+	mpack_node_t root = mpack_tree_root(&tree);
+
+	//mpack_node_print_to_stdout(root);
+
+	mpack_node_t components = mpack_node_map_cstr(root, "components");
+
+	s->nComponents = mpack_node_array_length(components);
+
+	s->components = calloc(s->nComponents, sizeof(Model));
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		mpack_node_t component = mpack_node_array_at(components, i);
+
+		mpack_node_t name = mpack_node_map_cstr(component, "name");
+		s->components[i].name = mpack_node_cstr_alloc(name, 1024);
+
+		mpack_node_t guid = mpack_node_map_cstr(component, "guid");
+		s->components[i].guid = mpack_node_cstr_alloc(guid, 1024);
+
+		mpack_node_t modelIdentifier = mpack_node_map_cstr(component, "modelIdentifier");
+		s->components[i].modelIdentifier = mpack_node_cstr_alloc(modelIdentifier, 1024);
+
+		mpack_node_t directory = mpack_node_map_cstr_optional(component, "directory");
+		s->components[i].directory = mpack_node_cstr_alloc(mpack_node_is_missing(directory) ? modelIdentifier : directory, 1024);
+
+		s->components[i].threadSafe = optionalBoolean(component, "threadSafe", fmi2True);
+		s->components[i].isolate = optionalBoolean(component, "isolate", fmi2False);
+		s->components[i].canInterpolateInputs = optionalBoolean(component, "canInterpolateInputs", fmi2False);
+		s->components[i].providesDirectionalDerivative = optionalBoolean(component, "providesDirectionalDerivative", fmi2False);
+		s->components[i].rate = optionalSize(component, "rate", 1);
+		s->components[i].stepSize = optionalReal(component, "stepSize", 0);
+		s->components[i].interpolation = optionalBoolean(component, "interpolation", fmi2False);
+		s->components[i].fmiVersion = optionalSize(component, "fmiVersion", 2);
+		s->components[i].eventMode = optionalBoolean(component, "eventMode", fmi2False);
+	}
+
+	mpack_node_t connections = mpack_node_map_cstr(root, "connections");
+
+	s->nConnections = mpack_node_array_length(connections);
+
+	s->connections = calloc(s->nConnections, sizeof(Connection));
+
+	for (size_t i = 0; i < s->nConnections; i++) {
+		mpack_node_t connection = mpack_node_array_at(connections, i);
+
+		mpack_node_t type = mpack_node_map_cstr(connection, "type");
+		s->connections[i].type = mpack_node_str(type)[0];
+
+		mpack_node_t endType = mpack_node_map_cstr_optional(connection, "endType");
+		s->connections[i].endType = mpack_node_is_missing(endType) ? s->connections[i].type : mpack_node_str(endType)[0];
+
+		mpack_node_t startComponent = mpack_node_map_cstr(connection, "startComponent");
+		s->connections[i].startComponent = mpack_node_u64(startComponent);
+
+		mpack_node_t endComponent = mpack_node_map_cstr(connection, "endComponent");
+		s->connections[i].endComponent = mpack_node_u64(endComponent);
+
+		mpack_node_t startValueReference = mpack_node_map_cstr(connection, "startValueReference");
+		s->connections[i].startValueReference = mpack_node_u32(startValueReference);
+
+		mpack_node_t endValueReference = mpack_node_map_cstr(connection, "endValueReference");
+		s->connections[i].endValueReference = mpack_node_u32(endValueReference);
+
+		s->connections[i].breakLoop = optionalBoolean(connection, "break", fmi2False);
+		s->connections[i].order = (uint8_t)optionalSize(connection, "order", 0);
+		s->connections[i].size = (uint32_t)optionalSize(connection, "size", 1);
+		s->connections[i].factor = optionalReal(connection, "factor", 1);
+		s->connections[i].offset = optionalReal(connection, "offset", 0);
+	}
+
+	mpack_node_t variables = mpack_node_map_cstr(root, "variables");
+
+	s->nVariables = mpack_node_array_length(variables);
+
+	s->variables = calloc(s->nVariables, sizeof(VariableMapping));
+
+	for (size_t i = 0; i < s->nVariables; i++) {
+		mpack_node_t variable = mpack_node_array_at(variables, i);
+
+		mpack_node_t component = mpack_node_map_cstr(variable, "component");
+		s->variables[i].ci = mpack_node_u64(component);
+
+		mpack_node_t valueReference = mpack_node_map_cstr(variable, "valueReference");
+		s->variables[i].vr = mpack_node_u32(valueReference);
+	}
+
+	mpack_node_t loops = mpack_node_map_cstr_optional(root, "loops");
+
+	if (!mpack_node_is_missing(loops)) {
+
+		s->nLoops = mpack_node_array_length(loops);
+
+		s->loops = calloc(s->nLoops, sizeof(Loop));
+
+		for (size_t i = 0; i < s->nLoops; i++) {
+			mpack_node_t loop = mpack_node_array_at(loops, i);
+
+			mpack_node_t components = mpack_node_map_cstr(loop, "components");
+			s->loops[i].nComponents = mpack_node_array_length(components);
+			s->loops[i].components = calloc(s->loops[i].nComponents, sizeof(size_t));
+
+			for (size_t j = 0; j < s->loops[i].nComponents; j++) {
+				s->loops[i].components[j] = (size_t)mpack_node_u64(mpack_node_array_at(components, j));
+			}
+
+			mpack_node_t method = mpack_node_map_cstr_optional(loop, "method");
+			s->loops[i].method = !mpack_node_is_missing(method) && mpack_node_strlen(method) == strlen("broyden") &&
+				strncmp(mpack_node_str(method), "broyden", strlen("broyden")) == 0 ? LOOP_BROYDEN : LOOP_FIXED_POINT;
+
+			s->loops[i].maxIterations = optionalSize(loop, "maxIterations", 20);
+			s->loops[i].tolerance = optionalReal(loop, "tolerance", 1e-6);
+			s->loops[i].relaxation = optionalReal(loop, "relaxation", 1);
+		}
+	}
+
+	options->parallelDoStep = optionalBoolean(root, "parallelDoStep", fmi2False);
+	options->parallelInstantiation = optionalBoolean(root, "parallelInstantiation", fmi2False);
+	options->asyncDoStep = optionalBoolean(root, "asyncDoStep", fmi2False);
+
+	mpack_node_t recorder = mpack_node_map_cstr_optional(root, "recorder");
+
+	if (!mpack_node_is_missing(recorder)) {
+
+		options->recorderFilename = mpack_node_cstr_alloc(mpack_node_map_cstr(recorder, "filename"), 4096);
+		options->recorderInterval = optionalReal(recorder, "interval", 0);
+
+		mpack_node_t variables = mpack_node_map_cstr(recorder, "variables");
+
+		options->nRecordedVariables = mpack_node_array_length(variables);
+		options->recordedVariables = calloc(options->nRecordedVariables, sizeof(RecordedVariable));
+
+		for (size_t i = 0; i < options->nRecordedVariables; i++) {
+			mpack_node_t variable = mpack_node_array_at(variables, i);
+			options->recordedVariables[i].variable = (size_t)mpack_node_u64(mpack_node_map_cstr(variable, "variable"));
+			options->recordedVariables[i].type = mpack_node_str(mpack_node_map_cstr(variable, "type"))[0];
+			options->recordedVariables[i].name = mpack_node_cstr_alloc(mpack_node_map_cstr(variable, "name"), 1024);
+		}
+	}
+
+	options->nThreads = optionalSize(root, "threads", s->nComponents);
+
+	mpack_node_t algorithm = mpack_node_map_cstr_optional(root, "algorithm");
+
+	if (!mpack_node_is_missing(algorithm)) {
+		// the strings are not null-terminated
+		const size_t length = mpack_node_strlen(algorithm);
+		options->gaussSeidel = length == strlen("gauss-seidel") && strncmp(mpack_node_str(algorithm), "gauss-seidel", length) == 0;
+		if (!options->gaussSeidel && !(length == strlen("jacobi") && strncmp(mpack_node_str(algorithm), "jacobi", length) == 0)) {
+			s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError", "Unknown algorithm \"%.*s\".", (int)length, mpack_node_str(algorithm));
+			mpack_node_flag_error(algorithm, mpack_error_data);
+		}
+	}
+
+	// clean up and check for errors
+	return mpack_tree_destroy(&tree) == mpack_ok;
+}
+
+/* The compiled configuration (config.bin) is memory-mapped and used in place:
+
+   ConfigHeader
+   ComponentConfig[nComponents]
+   VariableMapping[nVariables]
+   Connection[nConnections]
+   LoopConfig[nLoops]
+   uint64_t[] indices of the components of the loops
+   RecordedVariableConfig[nRecordedVariables]
+   string table (null-terminated UTF-8 strings referenced by their offset)
+
+   All offsets are relative to the start of the file and 8-byte aligned.
+   The mappings are shared by all instances in the process that use the same file. */
+
+#define CONFIG_ID         "FMUCCFG1"
+#define CONFIG_VERSION    6
+#define CONFIG_BYTE_ORDER 0x01020304
+
+#define CONFIG_GAUSS_SEIDEL           0x1
+#define CONFIG_PARALLEL_DO_STEP       0x2
+#define CONFIG_PARALLEL_INSTANTIATION 0x4
+#define CONFIG_ASYNC_DO_STEP          0x8
+#define CONFIG_RECORDER               0x10
+
+#define COMPONENT_THREAD_SAFE   0x1
+#define COMPONENT_INTERPOLATION 0x2
+#define COMPONENT_ISOLATE       0x4
+#define COMPONENT_CAN_INTERPOLATE_INPUTS 0x8
+#define COMPONENT_PROVIDES_DIRECTIONAL_DERIVATIVE 0x10
+#define COMPONENT_FMI3       0x20
+#define COMPONENT_EVENT_MODE 0x40
+
+typedef struct {
+
+	char id[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t threads;  // 0 = one thread per component
+	uint64_t nComponents;
+	uint64_t componentsOffset;
+	uint64_t nVariables;
+	uint64_t variablesOffset;
+	uint64_t nConnections;
+	uint64_t connectionsOffset;
+	uint64_t nLoops;
+	uint64_t loopsOffset;
+	uint64_t stringsSize;
+	uint64_t stringsOffset;
+	uint64_t nRecordedVariables;
+	uint64_t recordedVariablesOffset;
+	uint64_t recorderFilename;  // offset into the string table
+	double recorderInterval;
+
+} ConfigHeader;
+
+typedef struct {
+
+	uint64_t name;             // offsets into the string table
+	uint64_t guid;
+	uint64_t modelIdentifier;
+	uint64_t directory;
+	uint64_t rate;
+	double stepSize;
+	uint32_t flags;
+	uint32_t reserved;
+
+} ComponentConfig;
+
+typedef struct {
+
+	uint64_t nComponents;
+	uint64_t componentsOffset;  // offset of the uint64_t indices of the components
+	uint32_t method;            // see LoopMethod
+	uint32_t maxIterations;
+	double tolerance;
+	double relaxation;
+
+} LoopConfig;
+
+typedef struct {
+
+	uint64_t variable;
+	uint64_t name;  // offset into the string table
+	uint32_t type;
+	uint32_t reserved;
+
+} RecordedVariableConfig;
+
+struct MappedConfig {
+
+	char *filename;
+	size_t refCount;
+	size_t size;
+	const uint8_t *data;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	MappedConfig *next;
+
+};
+
+static MappedConfig *mappedConfigs = NULL;
+
+#ifdef _WIN32
+static SRWLOCK mappedConfigsLock = SRWLOCK_INIT;
+#define LOCK_MAPPED_CONFIGS   AcquireSRWLockExclusive(&mappedConfigsLock)
+#define UNLOCK_MAPPED_CONFIGS ReleaseSRWLockExclusive(&mappedConfigsLock)
+#else
+static pthread_mutex_t mappedConfigsLock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_MAPPED_CONFIGS   pthread_mutex_lock(&mappedConfigsLock)
+#define UNLOCK_MAPPED_CONFIGS pthread_mutex_unlock(&mappedConfigsLock)
+#endif
+
+static fmi2Boolean fileExists(const char *filename) {
+#ifdef _WIN32
+	return GetFileAttributesA(filename) != INVALID_FILE_ATTRIBUTES;
+#else
+	return access(filename, F_OK) == 0;
+#endif
+}
+
+static void unmapConfig(MappedConfig *config) {
+
+	if (!config) return;
+
+#ifdef _WIN32
+	if (config->data) UnmapViewOfFile(config->data);
+	if (config->mapping) CloseHandle(config->mapping);
+	if (config->file && config->file != INVALID_HANDLE_VALUE) CloseHandle(config->file);
+#else
+	if (config->data) munmap((void *)config->data, config->size);
+#endif
+
+	free(config->filename);
+	free(config);
+}
+
+static MappedConfig *mapConfig(const char *filename) {
+
+	MappedConfig *config = calloc(1, sizeof(MappedConfig));
+
+	if (!config) return NULL;
+
+	config->filename = strdup(filename);
+
+#ifdef _WIN32
+	LARGE_INTEGER size;
+
+	config->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (config->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(config->file, &size) || size.QuadPart == 0) {
+		unmapConfig(config);
+		return NULL;
+	}
+
+	config->size = (size_t)size.QuadPart;
+	config->mapping = CreateFileMappingA(config->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (config->mapping) {
+		config->data = MapViewOfFile(config->mapping, FILE_MAP_READ, 0, 0, 0);
+	}
+#else
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		unmapConfig(config);
+		return NULL;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		config->size = (size_t)st.st_size;
+		void *data = mmap(NULL, config->size, PROT_READ, MAP_SHARED, fd, 0);
+		config->data = data == MAP_FAILED ? NULL : data;
+	}
+
+	close(fd);
+#endif
+
+	if (!config->filename || !config->data) {
+		unmapConfig(config);
+		return NULL;
+	}
+
+	return config;
+}
+
+/* Check that a table of n elements of the given size lies within the file */
+static fmi2Boolean validTable(const MappedConfig *config, uint64_t offset, uint64_t n, size_t size) {
+	return offset % 8 == 0 && offset <= config->size && n <= (config->size - offset) / size;
+}
+
+static fmi2Boolean validConfig(const MappedConfig *config) {
+
+	if (sizeof(VariableMapping) != 16 || sizeof(Connection) != 48 || config->size < sizeof(ConfigHeader)) {
+		return fmi2False;
+	}
+
+	const ConfigHeader *header = (const ConfigHeader *)config->data;
+
+	if (memcmp(header->id, CONFIG_ID, sizeof(header->id)) || header->version != CONFIG_VERSION || header->byteOrder != CONFIG_BYTE_ORDER) {
+		return fmi2False;
+	}
+
+	if (!validTable(config, header->componentsOffset, header->nComponents, sizeof(ComponentConfig)) ||
+		!validTable(config, header->variablesOffset, header->nVariables, sizeof(VariableMapping)) ||
+		!validTable(config, header->connectionsOffset, header->nConnections, sizeof(Connection)) ||
+		!validTable(config, header->loopsOffset, header->nLoops, sizeof(LoopConfig)) ||
+		!validTable(config, header->recordedVariablesOffset, header->nRecordedVariables, sizeof(RecordedVariableConfig)) ||
+		!validTable(config, header->stringsOffset, header->stringsSize, 1)) {
+		return fmi2False;
+	}
+
+	const char *strings = (const char *)&config->data[header->stringsOffset];
+
+	// the last string must be terminated
+	if (header->stringsSize == 0 || strings[header->stringsSize - 1] != '\0') {
+		return fmi2False;
+	}
+
+	const ComponentConfig *components = (const ComponentConfig *)&config->data[header->componentsOffset];
+
+	for (size_t i = 0; i < header->nComponents; i++) {
+		const ComponentConfig *component = &components[i];
+		if (component->name >= header->stringsSize || component->guid >= header->stringsSize ||
+			component->modelIdentifier >= header->stringsSize || component->directory >= header->stringsSize) {
+			return fmi2False;
+		}
+	}
+
+	const VariableMapping *variables = (const VariableMapping *)&config->data[header->variablesOffset];
+
+	for (size_t i = 0; i < header->nVariables; i++) {
+		if (variables[i].ci >= header->nComponents) return fmi2False;
+	}
+
+	const Connection *connections = (const Connection *)&config->data[header->connectionsOffset];
+
+	for (size_t i = 0; i < header->nConnections; i++) {
+		const Connection *k = &connections[i];
+		if (k->startComponent >= header->nComponents || k->endComponent >= header->nComponents || k->order > 2) return fmi2False;
+	}
+
+	const LoopConfig *loops = (const LoopConfig *)&config->data[header->loopsOffset];
+
+	for (size_t i = 0; i < header->nLoops; i++) {
+
+		const LoopConfig *loop = &loops[i];
+
+		if (!validTable(config, loop->componentsOffset, loop->nComponents, sizeof(uint64_t)) || loop->method > LOOP_BROYDEN) return fmi2False;
+
+		const uint64_t *components = (const uint64_t *)&config->data[loop->componentsOffset];
+
+		for (size_t j = 0; j < loop->nComponents; j++) {
+			if (components[j] >= header->nComponents) return fmi2False;
+		}
+	}
+
+	const RecordedVariableConfig *recordedVariables = (const RecordedVariableConfig *)&config->data[header->recordedVariablesOffset];
+
+	if ((header->flags & CONFIG_RECORDER) && header->recorderFilename >= header->stringsSize) return fmi2False;
+
+	for (size_t i = 0; i < header->nRecordedVariables; i++) {
+		if (recordedVariables[i].name >= header->stringsSize) return fmi2False;
+	}
+
+	return fmi2True;
+}
+
+/* Get the mapping of filename from the cache or map and validate it */
+static MappedConfig *acquireConfig(const char *filename) {
+
+	LOCK_MAPPED_CONFIGS;
+
+	MappedConfig *config = mappedConfigs;
+
+	while (config && strcmp(config->filename, filename)) {
+		config = config->next;
+	}
+
+	if (!config) {
+
+		config = mapConfig(filename);
+
+		if (config && !validConfig(config)) {
+			unmapConfig(config);
+			config = NULL;
+		}
+
+		if (config) {
+			config->next = mappedConfigs;
+			mappedConfigs = config;
+		}
+	}
+
+	if (config) {
+		config->refCount++;
+	}
+
+	UNLOCK_MAPPED_CONFIGS;
+
+	return config;
+}
+
+static void releaseConfig(MappedConfig *config) {
+
+	if (!config) return;
+
+	LOCK_MAPPED_CONFIGS;
+
+	if (--config->refCount == 0) {
+
+		MappedConfig **p = &mappedConfigs;
+
+		while (*p != config) {
+			p = &(*p)->next;
+		}
+
+		*p = config->next;
+
+		unmapConfig(config);
+	}
+
+	UNLOCK_MAPPED_CONFIGS;
+}
+
+/* Use the compiled configuration (config.bin) in place */
+static fmi2Boolean readCompiledConfig(System *s, Options *options, const char *filename) {
+
+	s->config = acquireConfig(filename);
+
+	if (!s->config) return fmi2False;
+
+	const uint8_t *data = s->config->data;
+	const ConfigHeader *header = (const ConfigHeader *)data;
+	const ComponentConfig *components = (const ComponentConfig *)&data[header->componentsOffset];
+	const char *strings = (const char *)&data[header->stringsOffset];
+
+	s->nComponents = (size_t)header->nComponents;
+	s->components = calloc(s->nComponents, sizeof(Model));
+
+	if (!s->components) {
+		s->nComponents = 0;
+		return fmi2False;
+	}
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		const ComponentConfig *component = &components[i];
+		Model *m = &(s->components[i]);
+		m->name = &strings[component->name];
+		m->guid = &strings[component->guid];
+		m->modelIdentifier = &strings[component->modelIdentifier];
+		m->directory = &strings[component->directory];
+		m->threadSafe = (component->flags & COMPONENT_THREAD_SAFE) != 0;
+		m->isolate = (component->flags & COMPONENT_ISOLATE) != 0;
+		m->canInterpolateInputs = (component->flags & COMPONENT_CAN_INTERPOLATE_INPUTS) != 0;
+		m->providesDirectionalDerivative = (component->flags & COMPONENT_PROVIDES_DIRECTIONAL_DERIVATIVE) != 0;
+		m->rate = (size_t)component->rate;
+		m->stepSize = component->stepSize;
+		m->interpolation = (component->flags & COMPONENT_INTERPOLATION) != 0;
+		m->fmiVersion = (component->flags & COMPONENT_FMI3) ? 3 : 2;
+		m->eventMode = (component->flags & COMPONENT_EVENT_MODE) != 0;
+	}
+
+	s->nVariables = (size_t)header->nVariables;
+	s->variables = (VariableMapping *)&data[header->variablesOffset];
+
+	s->nConnections = (size_t)header->nConnections;
+	s->connections = (Connection *)&data[header->connectionsOffset];
+
+	const LoopConfig *loops = (const LoopConfig *)&data[header->loopsOffset];
+
+	s->nLoops = (size_t)header->nLoops;
+	s->loops = calloc(s->nLoops, sizeof(Loop));
+
+	if (s->nLoops > 0 && !s->loops) return fmi2False;
+
+	for (size_t i = 0; i < s->nLoops; i++) {
+
+		const uint64_t *components = (const uint64_t *)&data[loops[i].componentsOffset];
+		Loop *loop = &(s->loops[i]);
+
+		loop->nComponents = (size_t)loops[i].nComponents;
+		loop->components = calloc(loop->nComponents, sizeof(size_t));
+
+		if (loop->nComponents > 0 && !loop->components) return fmi2False;
+
+		for (size_t j = 0; j < loop->nComponents; j++) {
+			loop->components[j] = (size_t)components[j];
+		}
+
+		loop->method = (LoopMethod)loops[i].method;
+		loop->maxIterations = loops[i].maxIterations;
+		loop->tolerance = loops[i].tolerance;
+		loop->relaxation = loops[i].relaxation;
+	}
+
+	options->gaussSeidel = (header->flags & CONFIG_GAUSS_SEIDEL) != 0;
+	options->parallelDoStep = (header->flags & CONFIG_PARALLEL_DO_STEP) != 0;
+	options->parallelInstantiation = (header->flags & CONFIG_PARALLEL_INSTANTIATION) != 0;
+	options->asyncDoStep = (header->flags & CONFIG_ASYNC_DO_STEP) != 0;
+	options->nThreads = header->threads ? (size_t)header->threads : s->nComponents;
+
+	if (header->flags & CONFIG_RECORDER) {
+
+		const RecordedVariableConfig *recordedVariables = (const RecordedVariableConfig *)&data[header->recordedVariablesOffset];
+
+		options->recorderFilename = strdup(&strings[header->recorderFilename]);
+		options->recorderInterval = header->recorderInterval;
+		options->nRecordedVariables = (size_t)header->nRecordedVariables;
+		options->recordedVariables = calloc(options->nRecordedVariables, sizeof(RecordedVariable));
+
+		if (!options->recorderFilename || (options->nRecordedVariables > 0 && !options->recordedVariables)) return fmi2False;
+
+		for (size_t i = 0; i < options->nRecordedVariables; i++) {
+			options->recordedVariables[i].variable = (size_t)recordedVariables[i].variable;
+			options->recordedVariables[i].type = (char)recordedVariables[i].type;
+			options->recordedVariables[i].name = strdup(&strings[recordedVariables[i].name]);
+		}
+	}
+
+	return fmi2True;
+}
+
+static void freeConfig(System *s) {
+
+	if (s->config) {
+		releaseConfig(s->config);
+	} else {
+		for (size_t i = 0; i < s->nComponents; i++) {
+			free((void *)s->components[i].name);
+			free((void *)s->components[i].guid);
+			free((void *)s->components[i].modelIdentifier);
+			free((void *)s->components[i].directory);
+		}
+		free(s->variables);
+		free(s->connections);
+	}
+
+	free(s->components);
+}
+
+
+/***************************************************
+Native recorder
+****************************************************/
+
+static void freeRecording(Recording *r) {
+
+	if (!r) return;
+
+	freeRecorder(r->recorder);
+
+	for (size_t i = 0; i < N_RECORDED_TYPES; i++) {
+		freeAccessPlan(r->plans[i]);
+		free(r->columns[i]);
+	}
+
+	free(r->row);
+	free(r->values);
+	free(r);
+}
+
+static const char recordedTypes[N_RECORDED_TYPES] = { 'R', 'I', 'B' };
+
+/* Create the recorder and the plans to read the recorded variables */
+static Recording *createRecording(System *s, const Options *options, const fmi2CallbackFunctions *functions, fmi2String instanceName) {
+
+	const size_t nColumns = options->nRecordedVariables + 1;
+
+	Recording *r = calloc(1, sizeof(Recording));
+	const char **names = calloc(nColumns, sizeof(char *));
+	fmi2ValueReference *vr = calloc(nColumns, sizeof(fmi2ValueReference));
+
+	if (!r || !names || !vr) goto FAIL;
+
+	r->interval = options->recorderInterval;
+	r->row = calloc(nColumns, sizeof(fmi2Real));
+	r->values = calloc(nColumns, sizeof(Value));
+
+	if (!r->row || !r->values) goto FAIL;
+
+	names[0] = "time";
+
+	for (size_t i = 0; i < options->nRecordedVariables; i++) {
+
+		const RecordedVariable *variable = &(options->recordedVariables[i]);
+
+		if (variable->variable >= s->nVariables || !castable(variable->type) || !variable->name) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Recorded variable %zu must be a real, integer or boolean variable of the container.", i);
+			goto FAIL;
+		}
+
+		names[i + 1] = variable->name;
+	}
+
+	for (size_t i = 0; i < N_RECORDED_TYPES; i++) {
+
+		size_t nvr = 0;
+
+		r->columns[i] = calloc(nColumns, sizeof(size_t));
+
+		if (!r->columns[i]) goto FAIL;
+
+		for (size_t j = 0; j < options->nRecordedVariables; j++) {
+			if (options->recordedVariables[j].type == recordedTypes[i]) {
+				vr[nvr] = (fmi2ValueReference)options->recordedVariables[j].variable;
+				r->columns[i][nvr] = j + 1;
+				nvr++;
+			}
+		}
+
+		if (nvr == 0) continue;
+
+		r->plans[i] = createAccessPlan(s, vr, nvr);
+
+		if (!r->plans[i]) goto FAIL;
+	}
+
+	// make sure the staging buffer is large enough for the plans
+	if (s->bufferSize < nColumns) {
+		void *buffer = realloc(s->buffer, nColumns * sizeof(Value));
+		if (!buffer) goto FAIL;
+		s->buffer = buffer;
+		s->bufferSize = nColumns;
+	}
+
+	r->recorder = createRecorder(options->recorderFilename, nColumns, names);
+
+	if (!r->recorder) {
+		functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Failed to create the recording %s.", options->recorderFilename);
+		goto FAIL;
+	}
+
+	// restoring an FMU state discards the rows that have been recorded after it
+	addSegment(s, &(r->nSamples), sizeof(size_t));
+	addSegment(s, &(r->nRows), sizeof(size_t));
+
+	free(names);
+	free(vr);
+
+	return r;
+
+FAIL:
+	free(names);
+	free(vr);
+	freeRecording(r);
+	return NULL;
+}
+
+/* Append a row if time has reached the next sample point */
+static fmi2Status recordSample(System *s, fmi2Real time) {
+
+	Recording *r = s->recording;
+
+	if (!r) return fmi2OK;
+
+	if (r->interval > 0) {
+
+		const fmi2Real sample = (time - r->startTime) / r->interval + 1e-6;
+
+		if (sample < r->nSamples) return fmi2OK;
+
+		r->nSamples = (size_t)sample + 1;
+	}
+
+	fmi2Status status = fmi2OK;
+
+	r->row[0] = time;
+
+	for (size_t i = 0; i < N_RECORDED_TYPES; i++) {
+
+		const AccessPlan *plan = r->plans[i];
+
+		if (!plan) continue;
+
+		CHECK_STATUS(getPlanValues(s, plan, recordedTypes[i], r->values))
+
+		for (size_t j = 0; j < plan->nvr; j++) {
+			switch (recordedTypes[i]) {
+			case 'R': r->row[r->columns[i][j]] = ((const fmi2Real *)r->values)[j]; break;
+			case 'I': r->row[r->columns[i][j]] = ((const fmi2Integer *)r->values)[j]; break;
+			default:  r->row[r->columns[i][j]] = ((const fmi2Boolean *)r->values)[j]; break;
+			}
+		}
+	}
+
+	if (!appendRow(r->recorder, r->row)) {
+		s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError", "Failed to extend the recording.");
+		return fmi2Error;
+	}
+
+	r->nRows++;
+
+END:
+	return status;
+}
+
+/* Discard the recorded rows and restart the sampling at startTime */
+static void restartRecording(System *s, fmi2Real startTime) {
+
+	Recording *r = s->recording;
+
+	if (!r) return;
+
+	truncateRecorder(r->recorder, 0);
+
+	r->startTime = startTime;
+	r->nSamples = 0;
+	r->nRows = 0;
+}
+
+
+/***************************************************
+Types for Common Functions
+****************************************************/
+
+/* Inquire version numbers of header files and setting logging status */
+const char* fmi2GetTypesPlatform(void) { return fmi2TypesPlatform; }
+
+const char* fmi2GetVersion(void) { return fmi2Version; }
+
+fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
+    
+	GET_SYSTEM
+
+		for (size_t i = 0; i < s->nComponents; i++) {
+			Model *m = &(s->components[i]);
+			CHECK_STATUS(m->fmi2SetDebugLogging(m->c, loggingOn, nCategories, categories))
+		}
+
+END:
+	return status;
+}
+
+
+/***************************************************
+Directional derivatives
+****************************************************/
+
+static void freeDerivatives(System *s) {
+	free(s->outputOffsets);
+	free(s->outputConnections);
+	free(s->inputOffsets);
+	free(s->inputConnections);
+	free(s->derivativeOrder);
+}
+
+/* Group the real connections by start and end component and sort the components topologically */
+static fmi2Boolean createDerivatives(System *s) {
+
+	const size_t n = s->nComponents;
+	fmi2Boolean success = fmi2False;
+
+	s->outputOffsets     = calloc(n + 1, sizeof(size_t));
+	s->outputConnections = calloc(s->nConnections + 1, sizeof(size_t));
+	s->inputOffsets      = calloc(n + 1, sizeof(size_t));
+	s->inputConnections  = calloc(s->nConnections + 1, sizeof(size_t));
+	s->derivativeOrder   = calloc(n + 1, sizeof(size_t));
+
+	size_t *next = calloc(n + 1, sizeof(size_t));
+	size_t *inDegree = calloc(n + 1, sizeof(size_t));
+	fmi2Boolean *sorted = calloc(n + 1, sizeof(fmi2Boolean));
+
+	if (!s->outputOffsets || !s->outputConnections || !s->inputOffsets || !s->inputConnections || !s->derivativeOrder || !next || !inDegree || !sorted) goto END;
+
+	for (size_t i = 0; i < s->nConnections; i++) {
+		const Connection *k = &(s->connections[i]);
+		if (k->type != 'R' || k->endType != 'R' || k->size > 1) continue;
+		s->outputOffsets[k->startComponent + 1]++;
+		s->inputOffsets[k->endComponent + 1]++;
+		inDegree[k->endComponent]++;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		s->outputOffsets[i + 1] += s->outputOffsets[i];
+		s->inputOffsets[i + 1] += s->inputOffsets[i];
+	}
+
+	for (size_t i = 0; i < s->nConnections; i++) {
+		const Connection *k = &(s->connections[i]);
+		if (k->type != 'R' || k->endType != 'R' || k->size > 1) continue;
+		s->outputConnections[s->outputOffsets[k->startComponent] + next[k->startComponent]++] = i;
+	}
+
+	memset(next, 0, (n + 1) * sizeof(size_t));
+
+	for (size_t i = 0; i < s->nConnections; i++) {
+		const Connection *k = &(s->connections[i]);
+		if (k->type != 'R' || k->endType != 'R' || k->size > 1) continue;
+		s->inputConnections[s->inputOffsets[k->endComponent] + next[k->endComponent]++] = i;
+	}
+
+	// Kahn's algorithm, the components of cycles are appended in their original order
+	size_t nSorted = 0;
+
+	while (nSorted < n) {
+
+		size_t v = n;
+
+		for (size_t i = 0; i < n; i++) {
+			if (!sorted[i] && inDegree[i] == 0) {
+				v = i;
+				break;
+			}
+		}
+
+		if (v == n) {
+			s->derivativeCycles = fmi2True;
+			for (size_t i = 0; i < n; i++) {
+				if (!sorted[i]) s->derivativeOrder[nSorted++] = i;
+			}
+			break;
+		}
+
+		sorted[v] = fmi2True;
+		s->derivativeOrder[nSorted++] = v;
+
+		for (size_t i = s->outputOffsets[v]; i < s->outputOffsets[v + 1]; i++) {
+			inDegree[s->connections[s->outputConnections[i]].endComponent]--;
+		}
+	}
+
+	success = fmi2True;
+
+END:
+	free(next);
+	free(inDegree);
+	free(sorted);
+
+	return success;
+}
+
+/* Approximate the directional derivative of a component with forward differences */
+static fmi2Status finiteDifference(Model *m,
+	const fmi2ValueReference unknowns[], size_t nUnknowns,
+	const fmi2ValueReference knowns[], size_t nKnowns,
+	const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+
+	fmi2Status status = fmi2OK;
+
+	fmi2Real *u0 = calloc(nKnowns + 1, sizeof(fmi2Real));
+	fmi2Real *u1 = calloc(nKnowns + 1, sizeof(fmi2Real));
+	fmi2Real *y0 = calloc(nUnknowns + 1, sizeof(fmi2Real));
+
+	if (!u0 || !u1 || !y0) {
+		status = fmi2Error;
+		goto END;
+	}
+
+	CHECK_STATUS(m->fmi2GetReal(m->c, knowns, nKnowns, u0))
+	CHECK_STATUS(m->fmi2GetReal(m->c, unknowns, nUnknowns, y0))
+
+	fmi2Real uMax = 0, dvMax = 0;
+
+	for (size_t i = 0; i < nKnowns; i++) {
+		if (ABS(u0[i]) > uMax) uMax = ABS(u0[i]);
+		if (ABS(dvKnown[i]) > dvMax) dvMax = ABS(dvKnown[i]);
+	}
+
+	if (dvMax == 0) {
+		memset(dvUnknown, 0, nUnknowns * sizeof(fmi2Real));
+		goto END;
+	}
+
+	// the square root of the machine epsilon relative to the magnitude of the inputs
+	const fmi2Real h = 1.4901161193847656e-08 * (1 + uMax) / dvMax;
+
+	for (size_t i = 0; i < nKnowns; i++) {
+		u1[i] = u0[i] + h * dvKnown[i];
+	}
+
+	CHECK_STATUS(m->fmi2SetReal(m->c, knowns, nKnowns, u1))
+	CHECK_STATUS(m->fmi2GetReal(m->c, unknowns, nUnknowns, dvUnknown))
+
+	for (size_t i = 0; i < nUnknowns; i++) {
+		dvUnknown[i] = (dvUnknown[i] - y0[i]) / h;
+	}
+
+	// restore the inputs
+	CHECK_STATUS(m->fmi2SetReal(m->c, knowns, nKnowns, u0))
+
+END:
+	free(u0);
+	free(u1);
+	free(y0);
+
+	return status;
+}
+
+/* Relative and absolute tolerance for the directional derivatives of the connections to be
+   considered unchanged between two passes through the cycles (finite differences are only
+   accurate to about the square root of the machine epsilon) */
+#define DERIVATIVE_RTOL 1e-6
+#define DERIVATIVE_ATOL 1e-10
+
+/* Additional passes for cycles with direct feedthrough that converge like a fixed-point iteration */
+#define DERIVATIVE_MAX_ITERATIONS 50
+
+/* Propagate the directional derivatives of the container's knowns along the real connections.
+   Every component gets the derivatives of its connected inputs and container knowns and returns
+   the derivatives of its connected outputs and container unknowns. Cycles are traversed
+   repeatedly until the derivatives don't change, which is exact after nComponents + 1 passes
+   for loops without direct feedthrough. */
+static fmi2Status getDirectionalDerivative(System *s,
+	const fmi2ValueReference vUnknown_ref[], size_t nUnknown,
+	const fmi2ValueReference vKnown_ref[], size_t nKnown,
+	const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+
+	fmi2Status status = fmi2OK;
+
+	for (size_t i = 0; i < nUnknown; i++) {
+		if (vUnknown_ref[i] >= s->nVariables) return fmi2Error;
+		dvUnknown[i] = 0;
+	}
+
+	for (size_t i = 0; i < nKnown; i++) {
+		if (vKnown_ref[i] >= s->nVariables) return fmi2Error;
+	}
+
+	fmi2Real *connectionDerivatives = calloc(s->nConnections + 1, sizeof(fmi2Real));
+	fmi2Real *previousDerivatives   = calloc(s->nConnections + 1, sizeof(fmi2Real));
+	fmi2ValueReference *knowns      = calloc(nKnown + s->nConnections + 1, sizeof(fmi2ValueReference));
+	fmi2Real *dvKnowns              = calloc(nKnown + s->nConnections + 1, sizeof(fmi2Real));
+	fmi2ValueReference *unknowns    = calloc(nUnknown + s->nConnections + 1, sizeof(fmi2ValueReference));
+	fmi2Real *dvUnknowns            = calloc(nUnknown + s->nConnections + 1, sizeof(fmi2Real));
+
+	if (!connectionDerivatives || !previousDerivatives || !knowns || !dvKnowns || !unknowns || !dvUnknowns) {
+		status = fmi2Error;
+		goto END;
+	}
+
+	const size_t nPasses = s->derivativeCycles ? s->nComponents + 1 + DERIVATIVE_MAX_ITERATIONS : 1;
+	fmi2Boolean converged = !s->derivativeCycles;
+
+	for (size_t pass = 0; pass < nPasses; pass++) {
+
+		memcpy(previousDerivatives, connectionDerivatives, s->nConnections * sizeof(fmi2Real));
+
+		for (size_t i = 0; i < s->nComponents; i++) {
+
+			const size_t ci = s->derivativeOrder[i];
+			Model *m = &(s->components[ci]);
+			size_t nKnowns = 0, nUnknowns = 0;
+			fmi2Boolean seeded = fmi2False;
+
+			for (size_t j = 0; j < nKnown; j++) {
+				const VariableMapping *vm = &(s->variables[vKnown_ref[j]]);
+				if (vm->ci != ci) continue;
+				knowns[nKnowns] = vm->vr;
+				dvKnowns[nKnowns++] = dvKnown[j];
+				if (dvKnown[j] != 0) seeded = fmi2True;
+			}
+
+			for (size_t j = s->inputOffsets[ci]; j < s->inputOffsets[ci + 1]; j++) {
+				const size_t k = s->inputConnections[j];
+				knowns[nKnowns] = s->connections[k].endValueReference;
+				dvKnowns[nKnowns++] = s->connections[k].factor * connectionDerivatives[k];
+				if (connectionDerivatives[k] != 0) seeded = fmi2True;
+			}
+
+			for (size_t j = 0; j < nUnknown; j++) {
+				const VariableMapping *vm = &(s->variables[vUnknown_ref[j]]);
+				if (vm->ci == ci) unknowns[nUnknowns++] = vm->vr;
+			}
+
+			for (size_t j = s->outputOffsets[ci]; j < s->outputOffsets[ci + 1]; j++) {
+				unknowns[nUnknowns++] = s->connections[s->outputConnections[j]].startValueReference;
+			}
+
+			if (nUnknowns == 0) continue;
+
+			if (!seeded) {
+				memset(dvUnknowns, 0, nUnknowns * sizeof(fmi2Real));
+			} else if (m->providesDirectionalDerivative) {
+				CHECK_STATUS(m->fmi2GetDirectionalDerivative(m->c, unknowns, nUnknowns, knowns, nKnowns, dvKnowns, dvUnknowns))
+			} else {
+				CHECK_STATUS(finiteDifference(m, unknowns, nUnknowns, knowns, nKnowns, dvKnowns, dvUnknowns))
+			}
+
+			nUnknowns = 0;
+
+			for (size_t j = 0; j < nUnknown; j++) {
+				if (s->variables[vUnknown_ref[j]].ci == ci) dvUnknown[j] = dvUnknowns[nUnknowns++];
+			}
+
+			for (size_t j = s->outputOffsets[ci]; j < s->outputOffsets[ci + 1]; j++) {
+				connectionDerivatives[s->outputConnections[j]] = dvUnknowns[nUnknowns++];
+			}
+		}
+
+		converged = fmi2True;
+
+		for (size_t i = 0; i < s->nConnections; i++) {
+			const fmi2Real d0 = previousDerivatives[i], d1 = connectionDerivatives[i];
+			if (ABS(d1 - d0) > DERIVATIVE_RTOL * (ABS(d0) + ABS(d1)) + DERIVATIVE_ATOL) {
+				converged = fmi2False;
+				break;
+			}
+		}
+
+		if (converged) break;
+	}
+
+	if (s->derivativeCycles && !converged) {
+		s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Warning, "logWarning",
+			"The directional derivatives did not converge after %zu passes through the cycles of the connection graph.", nPasses);
+		status = fmi2Warning;
+	}
+
+END:
+	free(connectionDerivatives);
+	free(previousDerivatives);
+	free(knowns);
+	free(dvKnowns);
+	free(unknowns);
+	free(dvUnknowns);
+
+	return status;
+}
+
+
+/***************************************************
+FMI 3.0 components
+****************************************************/
+
+/* FMI 3.0 components are called through adapters with the signatures of the FMI 2.0 functions
+   that get the Model as the component, so the rest of the container can treat all components alike */
+
+static const char *fmi2GetTypesPlatformAdapter(void) {
+	return fmi2TypesPlatform;
+}
+
+static const char *fmi2GetVersionAdapter(void) {
+	return "3.0";
+}
+
+static fmi2Status fmi2SetDebugLoggingAdapter(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SetDebugLogging(m->instance, loggingOn, nCategories, categories);
+}
+
+/* FMI 3.0 components are instantiated with fmi3InstantiateCoSimulation() */
+static fmi2Component fmi2InstantiateAdapter(fmi2String instanceName, fmi2Type fmuType, fmi2String fmuGUID, fmi2String fmuResourceLocation,
+	const fmi2CallbackFunctions *functions, fmi2Boolean visible, fmi2Boolean loggingOn) {
+	return NULL;
+}
+
+static void fmi2FreeInstanceAdapter(fmi2Component c) {
+	Model *m = c;
+	m->fmi3FreeInstance(m->instance);
+}
+
+/* The experiment is passed to fmi3EnterInitializationMode() */
+static fmi2Status fmi2SetupExperimentAdapter(fmi2Component c, fmi2Boolean toleranceDefined, fmi2Real tolerance, fmi2Real startTime,
+	fmi2Boolean stopTimeDefined, fmi2Real stopTime) {
+	Model *m = c;
+	m->toleranceDefined = toleranceDefined;
+	m->tolerance = tolerance;
+	m->startTime = startTime;
+	m->stopTimeDefined = stopTimeDefined;
+	m->stopTime = stopTime;
+	m->lastSuccessfulTime = startTime;
+	return fmi2OK;
+}
+
+static fmi2Status fmi2EnterInitializationModeAdapter(fmi2Component c) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3EnterInitializationMode(m->instance, m->toleranceDefined, m->tolerance, m->startTime, m->stopTimeDefined, m->stopTime);
+}
+
+/* Update the discrete states of an FMI 3.0 component until they have converged and return to step mode */
+static fmi3Status updateDiscreteStates(Model *m, fmi3Boolean enterEventMode) {
+
+	fmi3Status status = enterEventMode ? m->fmi3EnterEventMode(m->instance, fmi3False, NULL, 0, fmi3False) : fmi3OK;
+
+	fmi3Boolean newDiscreteStatesNeeded = fmi3True;
+	fmi3Boolean terminateSimulation = fmi3False;
+	fmi3Boolean nominalsOfContinuousStatesChanged;
+	fmi3Boolean valuesOfContinuousStatesChanged;
+	fmi3Boolean nextEventTimeDefined;
+	fmi3Float64 nextEventTime;
+
+	while (status <= fmi3Warning && newDiscreteStatesNeeded && !terminateSimulation) {
+
+		const fmi3Status s = m->fmi3NewDiscreteStates(m->instance, &newDiscreteStatesNeeded, &terminateSimulation,
+			&nominalsOfContinuousStatesChanged, &valuesOfContinuousStatesChanged, &nextEventTimeDefined, &nextEventTime);
+
+		if (s > status) status = s;
+	}
+
+	if (status > fmi3Warning) return status;
+
+	if (terminateSimulation) {
+		m->terminated = fmi2True;
+		return fmi3Discard;
+	}
+
+	const fmi3Status s = m->fmi3EnterStepMode(m->instance);
+
+	return s > status ? s : status;
+}
+
+/* Components that use the event mode leave the initialization mode in event mode */
+static fmi2Status fmi2ExitInitializationModeAdapter(fmi2Component c) {
+
+	Model *m = c;
+	fmi3Status status = m->fmi3ExitInitializationMode(m->instance);
+
+	if (status <= fmi3Warning && m->eventMode) {
+		const fmi3Status s = updateDiscreteStates(m, fmi3False);
+		if (s > status) status = s;
+	}
+
+	return (fmi2Status)status;
+}
+
+static fmi2Status fmi2TerminateAdapter(fmi2Component c) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3Terminate(m->instance);
+}
+
+static fmi2Status fmi2ResetAdapter(fmi2Component c) {
+	Model *m = c;
+	m->terminated = fmi2False;
+	return (fmi2Status)m->fmi3Reset(m->instance);
+}
+
+static fmi2Status fmi2GetRealAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetFloat64(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2GetIntegerAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Integer value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetInt32(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2GetBooleanAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Boolean value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetBoolean(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2GetStringAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2String value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetString(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2SetRealAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SetFloat64(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2SetIntegerAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SetInt32(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2SetBooleanAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SetBoolean(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2SetStringAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SetString(m->instance, vr, nvr, value, nvr);
+}
+
+static fmi2Status fmi2GetFMUstateAdapter(fmi2Component c, fmi2FMUstate *FMUstate) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetFMUState(m->instance, FMUstate);
+}
+
+static fmi2Status fmi2SetFMUstateAdapter(fmi2Component c, fmi2FMUstate FMUstate) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SetFMUState(m->instance, FMUstate);
+}
+
+static fmi2Status fmi2FreeFMUstateAdapter(fmi2Component c, fmi2FMUstate *FMUstate) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3FreeFMUState(m->instance, FMUstate);
+}
+
+static fmi2Status fmi2SerializedFMUstateSizeAdapter(fmi2Component c, fmi2FMUstate FMUstate, size_t *size) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SerializedFMUStateSize(m->instance, FMUstate, size);
+}
+
+static fmi2Status fmi2SerializeFMUstateAdapter(fmi2Component c, fmi2FMUstate FMUstate, fmi2Byte serializedState[], size_t size) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3SerializeFMUState(m->instance, FMUstate, serializedState, size);
+}
+
+static fmi2Status fmi2DeSerializeFMUstateAdapter(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate *FMUstate) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3DeSerializeFMUState(m->instance, serializedState, size, FMUstate);
+}
+
+static fmi2Status fmi2GetDirectionalDerivativeAdapter(fmi2Component c, const fmi2ValueReference vUnknown_ref[], size_t nUnknown,
+	const fmi2ValueReference vKnown_ref[], size_t nKnown, const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetDirectionalDerivative(m->instance, vUnknown_ref, nUnknown, vKnown_ref, nKnown, dvKnown, nKnown, dvUnknown, nUnknown);
+}
+
+/* FMI 3.0 has no input derivatives for Co-Simulation */
+static fmi2Status fmi2SetRealInputDerivativesAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer order[], const fmi2Real value[]) {
+	return fmi2Error;
+}
+
+static fmi2Status fmi2GetRealOutputDerivativesAdapter(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer order[], fmi2Real value[]) {
+	Model *m = c;
+	return (fmi2Status)m->fmi3GetOutputDerivatives(m->instance, vr, nvr, order, value, nvr);
+}
+
+/* Step to the end of the communication step. If the component returns early (e.g. at an internal
+   event) its discrete states are updated in event mode (if used) and the step is resumed from the
+   last successful time. */
+static fmi2Status fmi2DoStepAdapter(fmi2Component c, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize,
+	fmi2Boolean noSetFMUStatePriorToCurrentCommunicationPoint) {
+
+	Model *m = c;
+	const fmi3Float64 endTime = currentCommunicationPoint + communicationStepSize;
+	fmi3Float64 time = currentCommunicationPoint;
+	fmi3Status status = fmi3OK;
+
+	for (;;) {
+
+		fmi3Boolean terminate = fmi3False;
+		fmi3Boolean earlyReturn = fmi3False;
+		fmi3Float64 lastSuccessfulTime = endTime;
+
+		const fmi3Status s = m->fmi3DoStep(m->instance, time, endTime - time, noSetFMUStatePriorToCurrentCommunicationPoint,
+			&terminate, &earlyReturn, &lastSuccessfulTime);
+
+		if (s > status) status = s;
+
+		if (status > fmi3Warning) break;
+
+		m->lastSuccessfulTime = earlyReturn ? lastSuccessfulTime : endTime;
+
+		if (terminate) {
+			m->terminated = fmi2True;
+			status = fmi3Discard;
+			break;
+		}
+
+		if (!earlyReturn) break;
+
+		// the component must make progress
+		if (lastSuccessfulTime <= time) {
+			status = fmi3Error;
+			break;
+		}
+
+		if (m->eventMode) {
+			const fmi3Status s = updateDiscreteStates(m, fmi3True);
+			if (s > status) status = s;
+			if (status > fmi3Warning) break;
+		}
+
+		if (lastSuccessfulTime >= endTime) break;
+
+		time = lastSuccessfulTime;
+	}
+
+	return (fmi2Status)status;
+}
+
+static fmi2Status fmi2CancelStepAdapter(fmi2Component c) {
+	return fmi2Error;
+}
+
+static fmi2Status fmi2GetStatusAdapter(fmi2Component c, const fmi2StatusKind s, fmi2Status *value) {
+	return fmi2Discard;
+}
+
+static fmi2Status fmi2GetRealStatusAdapter(fmi2Component c, const fmi2StatusKind s, fmi2Real *value) {
+	Model *m = c;
+	if (s != fmi2LastSuccessfulTime) return fmi2Discard;
+	*value = m->lastSuccessfulTime;
+	return fmi2OK;
+}
+
+static fmi2Status fmi2GetIntegerStatusAdapter(fmi2Component c, const fmi2StatusKind s, fmi2Integer *value) {
+	return fmi2Discard;
+}
+
+static fmi2Status fmi2GetBooleanStatusAdapter(fmi2Component c, const fmi2StatusKind s, fmi2Boolean *value) {
+	Model *m = c;
+	if (s != fmi2Terminated) return fmi2Discard;
+	*value = m->terminated;
+	return fmi2OK;
+}
+
+static fmi2Status fmi2GetStringStatusAdapter(fmi2Component c, const fmi2StatusKind s, fmi2String *value) {
+	return fmi2Discard;
+}
+
+/* Forward the log messages of FMI 3.0 components to the logger of the container */
+static void logMessageAdapter(fmi3InstanceEnvironment instanceEnvironment, fmi3String instanceName, fmi3Status status, fmi3String category, fmi3String message) {
+	Model *m = instanceEnvironment;
+	m->logger(m->componentEnvironment, instanceName, (fmi2Status)status, category, "%s", message);
+}
+
+/* Platform tuple of the FMI 3.0 binaries */
+#if defined(_WIN64)
+#define FMI3_PLATFORM "x86_64-windows"
+#elif defined(_WIN32)
+#define FMI3_PLATFORM "x86-windows"
+#elif defined(__APPLE__) && defined(__aarch64__)
+#define FMI3_PLATFORM "aarch64-darwin"
+#elif defined(__APPLE__)
+#define FMI3_PLATFORM "x86_64-darwin"
+#elif defined(__aarch64__)
+#define FMI3_PLATFORM "aarch64-linux"
+#else
+#define FMI3_PLATFORM "x86_64-linux"
+#endif
+
+
+/* Creation and destruction of FMU instances and setting debug status */
+#ifdef _WIN32
+#define GET(f) m->f = (f ## TYPE *)GetProcAddress(m->libraryHandle, #f); if (!m->f) { return componentError(inst, i, "Failed to load function %s.", #f); }
+#else
+#define GET(f) m->f = (f ## TYPE *)dlsym(m->libraryHandle, #f); if (!m->f) { return componentError(inst, i, "Failed to load function %s.", #f); }
+#endif
+
+#define COPY(f) m->f = library->f;
+
+#define ADAPT(f) m->f = f ## Adapter;
+
+#define FMI2_FUNCTIONS(X) \
+	X(fmi2GetTypesPlatform) \
+	X(fmi2GetVersion) \
+	X(fmi2SetDebugLogging) \
+	X(fmi2Instantiate) \
+	X(fmi2FreeInstance) \
+	X(fmi2SetupExperiment) \
+	X(fmi2EnterInitializationMode) \
+	X(fmi2ExitInitializationMode) \
+	X(fmi2Terminate) \
+	X(fmi2Reset) \
+	X(fmi2GetReal) \
+	X(fmi2GetInteger) \
+	X(fmi2GetBoolean) \
+	X(fmi2GetString) \
+	X(fmi2SetReal) \
+	X(fmi2SetInteger) \
+	X(fmi2SetBoolean) \
+	X(fmi2SetString) \
+	X(fmi2GetFMUstate) \
+	X(fmi2SetFMUstate) \
+	X(fmi2FreeFMUstate) \
+	X(fmi2SerializedFMUstateSize) \
+	X(fmi2SerializeFMUstate) \
+	X(fmi2DeSerializeFMUstate) \
+	X(fmi2GetDirectionalDerivative) \
+	X(fmi2SetRealInputDerivatives) \
+	X(fmi2GetRealOutputDerivatives) \
+	X(fmi2DoStep) \
+	X(fmi2CancelStep) \
+	X(fmi2GetStatus) \
+	X(fmi2GetRealStatus) \
+	X(fmi2GetIntegerStatus) \
+	X(fmi2GetBooleanStatus) \
+	X(fmi2GetStringStatus)
+
+#define FMI3_FUNCTIONS(X) \
+	X(fmi3InstantiateCoSimulation) \
+	X(fmi3FreeInstance) \
+	X(fmi3SetDebugLogging) \
+	X(fmi3EnterInitializationMode) \
+	X(fmi3ExitInitializationMode) \
+	X(fmi3EnterEventMode) \
+	X(fmi3Terminate) \
+	X(fmi3Reset) \
+	X(fmi3GetFloat64) \
+	X(fmi3GetInt32) \
+	X(fmi3GetBoolean) \
+	X(fmi3GetString) \
+	X(fmi3SetFloat64) \
+	X(fmi3SetInt32) \
+	X(fmi3SetBoolean) \
+	X(fmi3SetString) \
+	X(fmi3GetFMUState) \
+	X(fmi3SetFMUState) \
+	X(fmi3FreeFMUState) \
+	X(fmi3SerializedFMUStateSize) \
+	X(fmi3SerializeFMUState) \
+	X(fmi3DeSerializeFMUState) \
+	X(fmi3GetDirectionalDerivative) \
+	X(fmi3NewDiscreteStates) \
+	X(fmi3EnterStepMode) \
+	X(fmi3GetOutputDerivatives) \
+	X(fmi3DoStep)
+
+typedef struct {
+
+	System *s;
+	const char *path;
+	fmi2String fmuResourceLocation;
+	const fmi2CallbackFunctions *functions;
+	fmi2Boolean visible;
+	fmi2Boolean loggingOn;
+
+	size_t nLibraries;
+	size_t *libraries;
+	size_t *libraryOfComponent;
+	int *pinned;
+
+	char **errors;
+
+} Instantiation;
+
+/* Remember the error of component i so it can be logged in order */
+static fmi2Boolean componentError(Instantiation *inst, size_t i, const char *message, const char *argument) {
+
+	const size_t size = strlen(message) + strlen(argument) + 1;
+
+	inst->errors[i] = malloc(size);
+
+	if (inst->errors[i]) {
+		snprintf(inst->errors[i], size, message, argument);
+	}
+
+	return fmi2False;
+}
+
+/* Index of the first component that loads the shared library used by component i */
+static size_t libraryOwner(const System *s, size_t i) {
+
+	if (s->components[i].isolate) return i;
+
+	for (size_t j = 0; j < i; j++) {
+		const Model *m = &(s->components[j]);
+		if (!m->isolate && !strcmp(m->directory, s->components[i].directory)) return j;
+	}
+
+	return i;
+}
+
+#if !defined(LM_ID_NEWLM)
+/* Copy a file so it can be loaded as a separate shared library */
+static fmi2Boolean copyFile(const char *source, const char *destination) {
+#ifdef _WIN32
+	return CopyFileA(source, destination, FALSE) != 0;
+#else
+	FILE *in = fopen(source, "rb");
+	FILE *out = in ? fopen(destination, "wb") : NULL;
+	fmi2Boolean success = in && out;
+	char buffer[65536];
+	size_t n;
+
+	while (success && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		success = fwrite(buffer, 1, n, out) == n;
+	}
+
+	if (in) fclose(in);
+	if (out && fclose(out) != 0) success = fmi2False;
+
+	return success;
+#endif
+}
+#endif
+
+/* Load the shared library of component i or use the one of the component that has
+   already loaded it and instantiate the component */
+static fmi2Boolean instantiateComponent(Instantiation *inst, size_t i) {
+
+	Model *m = &(inst->s->components[i]);
+	const size_t owner = libraryOwner(inst->s, i);
+
+	m->logger = inst->functions->logger;
+
+#ifdef _WIN32
+	char libraryPath[MAX_PATH] = "";
+
+	PathCombine(libraryPath, inst->path, m->directory);
+	PathCombine(libraryPath, libraryPath, "binaries");
+#ifdef _WIN64
+	PathCombine(libraryPath, libraryPath, m->fmiVersion == 3 ? FMI3_PLATFORM : "win64");
+#else
+	PathCombine(libraryPath, libraryPath, m->fmiVersion == 3 ? FMI3_PLATFORM : "win32");
+#endif
+	PathCombine(libraryPath, libraryPath, m->modelIdentifier);
+	strcat(libraryPath, ".dll");
+#else
+    char libraryPath[PATH_MAX] = "";
+    strcpy(libraryPath, inst->path);
+    strcat(libraryPath, "/");
+    strcat(libraryPath, m->directory);
+#ifdef __APPLE__
+    strcat(libraryPath, m->fmiVersion == 3 ? "/binaries/" FMI3_PLATFORM "/" : "/binaries/darwin64/");
+    strcat(libraryPath, m->modelIdentifier);
+    strcat(libraryPath, ".dylib");
+#else
+    strcat(libraryPath, m->fmiVersion == 3 ? "/binaries/" FMI3_PLATFORM "/" : "/binaries/linux64/");
+    strcat(libraryPath, m->modelIdentifier);
+    strcat(libraryPath, ".so");
+#endif
+#endif
+
+#ifdef _WIN32
+	char resourcesPath[MAX_PATH];
+#else
+    char resourcesPath[PATH_MAX];
+#endif
+	strcpy(resourcesPath, inst->fmuResourceLocation);
+	strcat(resourcesPath, "/");
+	strcat(resourcesPath, m->directory);
+	strcat(resourcesPath, "/resources");
+
+	if (owner != i) {
+
+		const Model *library = &(inst->s->components[owner]);
+
+		if (!library->libraryHandle) {
+			return componentError(inst, i, "Failed to load shared library %s.", libraryPath);
+		}
+
+		m->libraryHandle = library->libraryHandle;
+
+		if (m->fmiVersion == 3) {
+			FMI3_FUNCTIONS(COPY)
+		} else {
+			FMI2_FUNCTIONS(COPY)
+		}
+
+	} else {
+
+#if defined(LM_ID_NEWLM)
+		// load isolated libraries into a new link-map namespace
+		m->libraryHandle = m->isolate ? dlmopen(LM_ID_NEWLM, libraryPath, RTLD_LAZY | RTLD_LOCAL) : dlopen(libraryPath, RTLD_LAZY);
+#else
+		// load a private copy of isolated libraries
+		if (m->isolate) {
+
+			const size_t size = strlen(libraryPath) + 32;
+
+			m->libraryCopy = malloc(size);
+
+			if (!m->libraryCopy) {
+				return componentError(inst, i, "Failed to copy shared library %s.", libraryPath);
+			}
+
+			snprintf(m->libraryCopy, size, "%s.%zu", libraryPath, i);
+
+			if (!copyFile(libraryPath, m->libraryCopy)) {
+				return componentError(inst, i, "Failed to copy shared library %s.", libraryPath);
+			}
+
+			strcpy(libraryPath, m->libraryCopy);
+		}
+#ifdef _WIN32
+		m->libraryHandle = LoadLibrary(libraryPath);
+#else
+		m->libraryHandle = dlopen(libraryPath, RTLD_LAZY);
+#endif
+#endif
+
+		if (!m->libraryHandle) {
+			return componentError(inst, i, "Failed to load shared library %s.", libraryPath);
+		}
+
+		m->ownsLibrary = fmi2True;
+
+		if (m->fmiVersion == 3) {
+			FMI3_FUNCTIONS(GET)
+		} else {
+			FMI2_FUNCTIONS(GET)
+		}
+	}
+
+	if (m->fmiVersion == 3) {
+		FMI2_FUNCTIONS(ADAPT)
+		m->componentEnvironment = inst->functions->componentEnvironment;
+		m->instance = m->fmi3InstantiateCoSimulation(m->name, m->guid, resourcesPath, inst->visible, inst->loggingOn, m->eventMode, NULL, 0, m, logMessageAdapter, NULL);
+		m->c = m->instance ? m : NULL;
+	} else {
+		m->c = m->fmi2Instantiate(m->name, fmi2CoSimulation, m->guid, resourcesPath, inst->functions, inst->visible, inst->loggingOn);
+	}
+
+	if (!m->c) {
+		return componentError(inst, i, "Failed to instantiate component %s.", m->name);
+	}
+
+	return fmi2True;
+}
+
+/* Instantiate the components that share library i one after another */
+static void instantiateLibrary(void *userData, size_t i) {
+
+	Instantiation *inst = userData;
+
+	for (size_t j = 0; j < inst->s->nComponents; j++) {
+		if (inst->libraryOfComponent[j] == inst->libraries[i] && !instantiateComponent(inst, j)) break;
+	}
+}
+
+static void freeInstantiation(Instantiation *inst) {
+
+	if (inst->errors) {
+		for (size_t i = 0; i < inst->s->nComponents; i++) {
+			free(inst->errors[i]);
+		}
+	}
+
+	free(inst->errors);
+	free(inst->libraries);
+	free(inst->libraryOfComponent);
+	free(inst->pinned);
+}
+
+/* Load and instantiate the components, optionally in parallel with one task per shared library */
+static fmi2Boolean instantiateComponents(Instantiation *inst, fmi2String instanceName, fmi2Boolean parallel, size_t nThreads) {
+
+	System *s = inst->s;
+	fmi2Boolean success = fmi2True;
+
+	inst->errors = calloc(s->nComponents, sizeof(char *));
+	inst->libraries = calloc(s->nComponents, sizeof(size_t));
+	inst->libraryOfComponent = calloc(s->nComponents, sizeof(size_t));
+	inst->pinned = calloc(s->nComponents, sizeof(int));
+
+	if (!inst->errors || !inst->libraries || !inst->libraryOfComponent || !inst->pinned) {
+		freeInstantiation(inst);
+		return fmi2False;
+	}
+
+	if (parallel) {
+
+		for (size_t i = 0; i < s->nComponents; i++) {
+
+			const size_t j = libraryOwner(s, i);
+
+			inst->libraryOfComponent[i] = j;
+
+			if (j == i) {
+				inst->libraries[inst->nLibraries++] = i;
+			}
+
+			// libraries with components that are not thread-safe are loaded on the same thread
+			if (!s->components[i].threadSafe) {
+				for (size_t k = 0; k < inst->nLibraries; k++) {
+					if (inst->libraries[k] == j) inst->pinned[k] = 1;
+				}
+			}
+		}
+
+		ThreadPool *pool = s->threadPool ? s->threadPool : createThreadPool(nThreads < inst->nLibraries ? nThreads : inst->nLibraries);
+
+		if (!pool) {
+			freeInstantiation(inst);
+			return fmi2False;
+		}
+
+		runThreadPool(pool, instantiateLibrary, inst, inst->nLibraries, inst->pinned);
+
+		if (pool != s->threadPool) {
+			freeThreadPool(pool);
+		}
+
+	} else {
+
+		for (size_t i = 0; i < s->nComponents; i++) {
+			if (!instantiateComponent(inst, i)) break;
+		}
+	}
+
+	// report the errors in the order of the components
+	for (size_t i = 0; i < s->nComponents; i++) {
+		if (inst->errors[i]) {
+			inst->functions->logger(inst->functions->componentEnvironment, instanceName, fmi2Error, "error", "%s", inst->errors[i]);
+			success = fmi2False;
+		}
+	}
+
+	freeInstantiation(inst);
+
+	return success;
+}
+
+/* Creation and destruction of FMU instances and setting debug status */
+fmi2Component fmi2Instantiate(fmi2String instanceName,
+                              fmi2Type fmuType,
+                              fmi2String fmuGUID,
+                              fmi2String fmuResourceLocation,
+                              const fmi2CallbackFunctions* functions,
+                              fmi2Boolean visible,
+                              fmi2Boolean loggingOn) {
+
+	if (!functions || !functions->logger) {
+		return NULL;
+	}
+
+    if (fmuType != fmi2CoSimulation) {
+        functions->logger(NULL, instanceName, fmi2Error, "logError", "Argument fmuType must be fmi2CoSimulation.");
+        return NULL;
+    }
+
+	const char *scheme1 = "file:///";
+	const char *scheme2 = "file:/";
+	char *path;
+
+	if (strncmp(fmuResourceLocation, scheme1, strlen(scheme1)) == 0) {
+		path = strdup(&fmuResourceLocation[strlen(scheme1) - 1]);
+	} else if (strncmp(fmuResourceLocation, scheme2, strlen(scheme2)) == 0) {
+		path = strdup(&fmuResourceLocation[strlen(scheme2) - 1]);
+	} else {
+		return NULL;
+	}
+
+#ifdef _WIN32
+	// strip any leading slashes
+	while (path[0] == '/') {
+		strcpy(path, &path[1]);
+	}
+#endif
+
+	Options options = { fmi2False, fmi2False, fmi2False, 0 };
+
+	System *s = calloc(1, sizeof(System));
+
+	if (!s) {
+		free(path);
+		return NULL;
+	}
+
+	s->instanceName = strdup(instanceName);
+	s->functions = *functions;
+	s->loggingOn = loggingOn;
+#ifdef _WIN32
+    char configPath[MAX_PATH] = "";
+#else
+    char configPath[PATH_MAX] = "";
+#endif
+	strcpy(configPath, path);
+	strcat(configPath, "/config.bin");
+
+	if (fileExists(configPath)) {
+		if (!readCompiledConfig(s, &options, configPath)) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Failed to read the compiled configuration %s.", configPath);
+			goto FAIL;
+		}
+	} else {
+		strcpy(configPath, path);
+		strcat(configPath, "/config.mp");
+
+		if (!readConfig(s, &options, configPath)) {
+			fprintf(stderr, "An error occurred decoding the data!\n");
+			goto FAIL;
+		}
+	}
+
+	if (!createSchedule(s, options.gaussSeidel, functions, instanceName) || !createSegments(s)) {
+		functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Failed to create the schedule.");
+		goto FAIL;
+	}
+
+	if (!createLoops(s) || !createDerivatives(s)) {
+		goto FAIL;
+	}
+
+	s->active = calloc(s->nComponents, sizeof(fmi2Boolean));
+	s->activeComponents = calloc(s->nComponents, sizeof(size_t));
+	s->activePinned = calloc(s->nComponents, sizeof(int));
+
+	if (!s->active || !s->activeComponents || !s->activePinned) {
+		goto FAIL;
+	}
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		if (s->components[i].rate < 1) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "The rate of component %s must be greater than zero.", s->components[i].name);
+			goto FAIL;
+		}
+	}
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		if (s->components[i].fmiVersion != 2 && s->components[i].fmiVersion != 3) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "The FMI version of component %s must be 2 or 3.", s->components[i].name);
+			goto FAIL;
+		}
+	}
+
+	for (size_t i = 0; i < s->nConnections; i++) {
+
+		const Connection *k = &(s->connections[i]);
+
+		if (k->order > 2) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "The order of connection %zu must be 0, 1 or 2.", i);
+			goto FAIL;
+		}
+
+		if (k->size > 1 && (k->type != 'R' || k->endType != 'R' || s->components[k->startComponent].fmiVersion != 3 || s->components[k->endComponent].fmiVersion != 3)) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Array connection %zu must connect real variables of FMI 3.0 components.", i);
+			goto FAIL;
+		}
+
+		if (k->type != k->endType && (!castable(k->type) || !castable(k->endType))) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Connection %zu can only cast real, integer and boolean values.", i);
+			goto FAIL;
+		}
+
+		if ((k->factor != 1 || k->offset != 0) && k->type != 'R' && k->endType != 'R') {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Connection %zu can only transform real values.", i);
+			goto FAIL;
+		}
+	}
+
+	if (options.parallelDoStep) {
+
+		s->threadPool = createThreadPool(options.nThreads);
+		s->statuses = calloc(s->nComponents, sizeof(fmi2Status));
+
+		if (!s->threadPool || !s->statuses) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Failed to create the thread pool.");
+			goto FAIL;
+		}
+	}
+
+	if (options.asyncDoStep) {
+
+		// a separate worker so the step can use the thread pool of parallelDoStep
+		s->asyncPool = createThreadPool(1);
+
+		if (!s->asyncPool) {
+			functions->logger(functions->componentEnvironment, instanceName, fmi2Error, "error", "Failed to create the thread for the asynchronous steps.");
+			goto FAIL;
+		}
+
+		INIT_MUTEX(s->stepMutex);
+	}
+
+#ifdef FMU_CONTAINER_PROFILING
+	// record a trace if the environment variable FMU_CONTAINER_TRACE is set to the output file
+	const char *traceFile = getenv("FMU_CONTAINER_TRACE");
+	s->traceFile = traceFile && *traceFile ? strdup(traceFile) : NULL;
+	s->profileStart = profileClock();
+#endif
+
+	Instantiation inst = { s, path, fmuResourceLocation, functions, visible, loggingOn };
+
+	if (!instantiateComponents(&inst, instanceName, options.parallelInstantiation, options.nThreads)) {
+		goto FAIL;
+	}
+
+	if (options.recorderFilename) {
+
+		s->recording = createRecording(s, &options, functions, instanceName);
+
+		if (!s->recording) goto FAIL;
+	}
+
+	freeOptions(&options);
+	free(path);
+
+	return s;
+
+FAIL:
+	// free the thread pools, the instantiated components and the loaded libraries
+	freeOptions(&options);
+	free(path);
+	fmi2FreeInstance(s);
+
+	return NULL;
+}
+
+void fmi2FreeInstance(fmi2Component c) {
+
+	if (!c) return;
+	
+	System *s = (System *)c;
+
+	finishStep(s);
+
+	if (s->asyncPool) {
+		freeThreadPool(s->asyncPool);
+		DESTROY_MUTEX(s->stepMutex);
+	}
+
+	freeLoops(s);
+	freeDerivatives(s);
+	freeRecording(s->recording);
+
+	// the components may be partially instantiated if fmi2Instantiate() failed
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		if (m->c) m->fmi2FreeInstance(m->c);
+	}
+
+	// unload the libraries after all components that share them have been freed
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		if (m->ownsLibrary) {
+#ifdef _WIN32
+			FreeLibrary(m->libraryHandle);
+#else
+			dlclose(m->libraryHandle);
+#endif
+		}
+		if (m->libraryCopy) {
+			remove(m->libraryCopy);
+			free(m->libraryCopy);
+		}
+	}
+
+	freeThreadPool(s->threadPool);
+	free(s->statuses);
+	free(s->active);
+	free(s->activeComponents);
+	free(s->activePinned);
+
+	freeSchedule(s);
+	free(s->segments);
+
+	for (size_t i = 0; i < s->nAccessPlans; i++) {
+		freeAccessPlan(s->accessPlans[i]);
+	}
+
+	free(s->buffer);
+
+#ifdef FMU_CONTAINER_PROFILING
+	for (size_t i = 0; i < s->nComponents; i++) {
+		free(s->components[i].profile.events);
+	}
+	free(s->traceFile);
+#endif
+
+	freeConfig(s);
+
+	free(s->instanceName);
+	free(s);
+}
+
+/* Enter and exit initialization mode, terminate and reset */
+fmi2Status fmi2SetupExperiment(fmi2Component c,
+                               fmi2Boolean toleranceDefined,
+                               fmi2Real tolerance,
+                               fmi2Real startTime,
+                               fmi2Boolean stopTimeDefined,
+                               fmi2Real stopTime) {
+    
+	GET_SYSTEM
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		CHECK_STATUS(m->fmi2SetupExperiment(m->c, toleranceDefined, tolerance, startTime, stopTimeDefined, stopTime))
+		m->time = startTime;
+		m->stepCount = 0;
+	}
+
+	// discard the samples of a previous simulation (e.g. before fmi2Reset())
+	for (size_t i = 0; i < s->nLevels; i++) {
+		TransferPlan *plan = &(s->levels[i].transferPlan);
+		for (size_t j = 0; j < plan->nTransfers; j++) {
+			clearTransfer(&(plan->transfers[j]));
+		}
+	}
+
+	s->lastSuccessfulTime = startTime;
+
+	restartRecording(s, startTime);
+
+END:
+	return status;
+}
+
+fmi2Status fmi2EnterInitializationMode(fmi2Component c) {
+	
+	GET_SYSTEM
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		CHECK_STATUS(m->fmi2EnterInitializationMode(m->c))
+	}
+
+END:
+	return status;
+}
+
+fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
+	
+	GET_SYSTEM
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		CHECK_STATUS(m->fmi2ExitInitializationMode(m->c))
+	}
+
+	CHECK_STATUS(recordSample(s, s->lastSuccessfulTime))
+
+END:
+	return status;
+}
+
+fmi2Status fmi2Terminate(fmi2Component c) {
+	
+	GET_SYSTEM
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		CHECK_STATUS(m->fmi2Terminate(m->c))
+	}
+
+	if (s->loggingOn) {
+		for (size_t i = 0; i < s->nLoops; i++) {
+			const Loop *loop = &(s->loops[i]);
+			s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2OK, "logStatistics",
+				"Loop %zu: %zu steps, %zu iterations (max. %zu per step), %zu steps did not converge.", i, loop->nSteps, loop->nIterations, loop->maxStepIterations, loop->nFailures);
+		}
+	}
+
+END:
+#ifdef FMU_CONTAINER_PROFILING
+	if (s->traceFile && !writeTrace(s)) {
+		s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Warning, "logWarning", "Failed to write the trace %s.", s->traceFile);
+		if (status < fmi2Warning) status = fmi2Warning;
+	}
+#endif
+	return status;
+}
+
+fmi2Status fmi2Reset(fmi2Component c) {
+
+	GET_SYSTEM
+
+		for (size_t i = 0; i < s->nComponents; i++) {
+			Model *m = &(s->components[i]);
 			CHECK_STATUS(m->fmi2Reset(m->c))
 		}
 
+	restartRecording(s, 0);
+
+END:
+	return status;
+}
+
+/* Getting and setting variable values */
+fmi2Status fmi2GetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]) {
+	if (!c) return fmi2Error;
+	return getValues(c, 'R', vr, nvr, value);
+}
+
+fmi2Status fmi2GetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Integer value[]) {
+	if (!c) return fmi2Error;
+	return getValues(c, 'I', vr, nvr, value);
+}
+
+fmi2Status fmi2GetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Boolean value[]) {
+	if (!c) return fmi2Error;
+	return getValues(c, 'B', vr, nvr, value);
+}
+
+fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2String  value[]) {
+	if (!c) return fmi2Error;
+	return getValues(c, 'S', vr, nvr, value);
+}
+
+fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
+	if (!c) return fmi2Error;
+	return setValues(c, 'R', vr, nvr, value);
+}
+
+fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
+	if (!c) return fmi2Error;
+	return setValues(c, 'I', vr, nvr, value);
+}
+
+fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
+	if (!c) return fmi2Error;
+	return setValues(c, 'B', vr, nvr, value);
+}
+
+fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String  value[]) {
+	if (!c) return fmi2Error;
+	return setValues(c, 'S', vr, nvr, value);
+}
+
+/* Getting and setting the internal FMU state */
+fmi2Status fmi2GetFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
+
+	GET_SYSTEM
+
+	if (!FMUstate) return fmi2Error;
+
+	SystemState *state = *FMUstate;
+
+	if (!state) {
+
+		state = calloc(1, sizeof(SystemState));
+
+		if (!state) return fmi2Error;
+
+		state->states = calloc(s->nComponents, sizeof(fmi2FMUstate));
+		state->data = calloc(s->segmentsSize > 0 ? s->segmentsSize : 1, 1);
+
+		if (!state->states || !state->data) {
+			freeSystemState(s, state);
+			return fmi2Error;
+		}
+
+		*FMUstate = state;
+	}
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		CHECK_STATUS(m->fmi2GetFMUstate(m->c, &(state->states[i])))
+	}
+
+	fmi2Byte *data = state->data;
+
+	for (size_t i = 0; i < s->nSegments; i++) {
+		memcpy(data, s->segments[i].data, s->segments[i].size);
+		data += s->segments[i].size;
+	}
+
+	// the serialized state is outdated
+	free(state->serializedState);
+	state->serializedState = NULL;
+	state->serializedStateSize = 0;
+
 END:
 	return status;
 }
 
-/* Getting and setting variable values */
-fmi2Status fmi2GetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]) {
-    
+fmi2Status fmi2SetFMUstate(fmi2Component c, fmi2FMUstate  FMUstate) {
+
 	GET_SYSTEM
 
-	for (size_t i = 0; i < nvr; i++) {
-		if (vr[i] >= s->nVariables) return fmi2Error;
-		VariableMapping vm = s->variables[vr[i]];
-		Model *m = &(s->components[vm.ci]);
-		CHECK_STATUS(m->fmi2GetReal(m->c, &(vm.vr), 1, &value[i]))
+	SystemState *state = FMUstate;
+
+	if (!state) return fmi2Error;
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		Model *m = &(s->components[i]);
+		CHECK_STATUS(deserializeComponentState(s, state, i))
+		CHECK_STATUS(m->fmi2SetFMUstate(m->c, state->states[i]))
 	}
-END:
-	return status;
-}
 
-fmi2Status fmi2GetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Integer value[]) {
+	const fmi2Byte *data = state->data;
 
-	GET_SYSTEM
+	for (size_t i = 0; i < s->nSegments; i++) {
+		memcpy(s->segments[i].data, data, s->segments[i].size);
+		data += s->segments[i].size;
+	}
+
+	// read the outputs of the restored components again in the next transfer
+	for (size_t i = 0; i < s->nComponents; i++) {
+		s->components[i].stepCount++;
+	}
+
+	// discard the rows that have been recorded after the state
+	if (s->recording) {
+		Recording *r = s->recording;
+		r->nRows = truncateRecorder(r->recorder, r->nRows);
+	}
 
-		for (size_t i = 0; i < nvr; i++) {
-			if (vr[i] >= s->nVariables) return fmi2Error;
-			VariableMapping vm = s->variables[vr[i]];
-			Model *m = &(s->components[vm.ci]);
-			CHECK_STATUS(m->fmi2GetInteger(m->c, &(vm.vr), 1, &value[i]))
-		}
 END:
 	return status;
 }
 
-fmi2Status fmi2GetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Boolean value[]) {
+fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
 
 	GET_SYSTEM
 
-		for (size_t i = 0; i < nvr; i++) {
-			if (vr[i] >= s->nVariables) return fmi2Error;
-			VariableMapping vm = s->variables[vr[i]];
-			Model *m = &(s->components[vm.ci]);
-			CHECK_STATUS(m->fmi2GetBoolean(m->c, &(vm.vr), 1, &value[i]))
-		}
-END:
-	return status;
-}
+	if (!FMUstate) return fmi2Error;
 
-fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2String  value[]) {
+	freeSystemState(s, *FMUstate);
 
-	GET_SYSTEM
+	*FMUstate = NULL;
 
-		for (size_t i = 0; i < nvr; i++) {
-			if (vr[i] >= s->nVariables) return fmi2Error;
-			VariableMapping vm = s->variables[vr[i]];
-			Model *m = &(s->components[vm.ci]);
-			CHECK_STATUS(m->fmi2GetString(m->c, &(vm.vr), 1, &value[i]))
-		}
-END:
 	return status;
 }
 
-fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
-	
+fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate  FMUstate, size_t* size) {
+
 	GET_SYSTEM
 
-	for (size_t i = 0; i < nvr; i++) {
-		if (vr[i] >= s->nVariables) return fmi2Error;
-		VariableMapping vm = s->variables[vr[i]];
-		Model *m = &(s->components[vm.ci]);
-		CHECK_STATUS(m->fmi2SetReal(m->c, &(vm.vr), 1, &value[i]))
-	}
-END:
-	return status;
-}
+	SystemState *state = FMUstate;
 
-fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
+	if (!state || !size) return fmi2Error;
 
-	GET_SYSTEM
+	*size = sizeof(StateHeader) + 2 * s->nComponents * sizeof(uint64_t) + s->segmentsSize;
 
-		for (size_t i = 0; i < nvr; i++) {
-			if (vr[i] >= s->nVariables) return fmi2Error;
-			VariableMapping vm = s->variables[vr[i]];
-			Model *m = &(s->components[vm.ci]);
-			CHECK_STATUS(m->fmi2SetInteger(m->c, &(vm.vr), 1, &value[i]))
+	for (size_t i = 0; i < s->nComponents; i++) {
+
+		Model *m = &(s->components[i]);
+
+		if (state->states[i]) {
+			size_t componentSize;
+			CHECK_STATUS(m->fmi2SerializedFMUstateSize(m->c, state->states[i], &componentSize))
+			*size += componentSize;
+		} else if (state->serializedState) {
+			*size += (size_t)stateIndex(state)[2 * i + 1];
+		} else {
+			return fmi2Error;
 		}
+	}
+
 END:
 	return status;
 }
 
-fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
+fmi2Status fmi2SerializeFMUstate(fmi2Component c, fmi2FMUstate  FMUstate, fmi2Byte serializedState[], size_t size) {
 
 	GET_SYSTEM
 
-		for (size_t i = 0; i < nvr; i++) {
-			if (vr[i] >= s->nVariables) return fmi2Error;
-			VariableMapping vm = s->variables[vr[i]];
-			Model *m = &(s->components[vm.ci]);
-			CHECK_STATUS(m->fmi2SetBoolean(m->c, &(vm.vr), 1, &value[i]))
+	SystemState *state = FMUstate;
+	size_t requiredSize;
+
+	CHECK_STATUS(fmi2SerializedFMUstateSize(c, FMUstate, &requiredSize))
+
+	if (size < requiredSize) return fmi2Error;
+
+	StateHeader *header = (StateHeader *)serializedState;
+	uint64_t *index = (uint64_t *)(serializedState + sizeof(StateHeader));
+	size_t offset = sizeof(StateHeader) + 2 * s->nComponents * sizeof(uint64_t);
+
+	memcpy(header->id, STATE_ID, sizeof(header->id));
+	header->nComponents = s->nComponents;
+	header->dataSize = s->segmentsSize;
+
+	memcpy(&serializedState[offset], state->data, s->segmentsSize);
+	offset += s->segmentsSize;
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+
+		Model *m = &(s->components[i]);
+		size_t componentSize;
+
+		if (state->states[i]) {
+			CHECK_STATUS(m->fmi2SerializedFMUstateSize(m->c, state->states[i], &componentSize))
+			CHECK_STATUS(m->fmi2SerializeFMUstate(m->c, state->states[i], &serializedState[offset], componentSize))
+		} else {
+			componentSize = (size_t)stateIndex(state)[2 * i + 1];
+			memcpy(&serializedState[offset], state->serializedState + stateIndex(state)[2 * i], componentSize);
 		}
+
+		index[2 * i] = offset;
+		index[2 * i + 1] = componentSize;
+		offset += componentSize;
+	}
+
 END:
 	return status;
 }
 
-fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String  value[]) {
+fmi2Status fmi2DeSerializeFMUstate(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate* FMUstate) {
 
 	GET_SYSTEM
 
-		for (size_t i = 0; i < nvr; i++) {
-			if (vr[i] >= s->nVariables) return fmi2Error;
-			VariableMapping vm = s->variables[vr[i]];
-			Model *m = &(s->components[vm.ci]);
-			CHECK_STATUS(m->fmi2SetString(m->c, &(vm.vr), 1, &value[i]))
-		}
-END:
-	return status;
-}
+	const StateHeader *header = (const StateHeader *)serializedState;
 
-/* Getting and setting the internal FMU state */
-fmi2Status fmi2GetFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    return fmi2Error;
-}
+	if (!FMUstate || size < sizeof(StateHeader) || memcmp(header->id, STATE_ID, sizeof(header->id)) != 0 ||
+		header->nComponents != s->nComponents || header->dataSize != s->segmentsSize ||
+		size < sizeof(StateHeader) + 2 * s->nComponents * sizeof(uint64_t) + s->segmentsSize) {
+		return fmi2Error;
+	}
 
-fmi2Status fmi2SetFMUstate(fmi2Component c, fmi2FMUstate  FMUstate) {
-    return fmi2Error;
-}
+	SystemState *state = calloc(1, sizeof(SystemState));
 
-fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
-    return fmi2Error;
-}
+	if (!state) return fmi2Error;
 
-fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate  FMUstate, size_t* size) {
-    return fmi2Error;
-}
+	state->states = calloc(s->nComponents, sizeof(fmi2FMUstate));
+	state->data = calloc(s->segmentsSize > 0 ? s->segmentsSize : 1, 1);
+	state->serializedState = malloc(size);
+	state->serializedStateSize = size;
 
-fmi2Status fmi2SerializeFMUstate(fmi2Component c, fmi2FMUstate  FMUstate, fmi2Byte serializedState[], size_t size) {
-    return fmi2Error;
-}
+	if (!state->states || !state->data || !state->serializedState) {
+		freeSystemState(s, state);
+		return fmi2Error;
+	}
 
-fmi2Status fmi2DeSerializeFMUstate(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate* FMUstate) {
-    return fmi2Error;
+	memcpy(state->serializedState, serializedState, size);
+	memcpy(state->data, serializedState + sizeof(StateHeader) + 2 * s->nComponents * sizeof(uint64_t), s->segmentsSize);
+
+	const uint64_t *index = stateIndex(state);
+
+	for (size_t i = 0; i < s->nComponents; i++) {
+		if (index[2 * i] > size || index[2 * i + 1] > size - index[2 * i]) {
+			freeSystemState(s, state);
+			return fmi2Error;
+		}
+	}
+
+	*FMUstate = state;
+
+	return status;
 }
 
 /* Getting partial derivatives */
@@ -607,7 +4535,13 @@ fmi2Status fmi2GetDirectionalDerivative(fmi2Component c,
                                         const fmi2ValueReference vKnown_ref[],   size_t nKnown,
                                         const fmi2Real dvKnown[],
                                         fmi2Real dvUnknown[]) {
-    return fmi2Error;
+
+	GET_SYSTEM
+
+	CHECK_STATUS(getDirectionalDerivative(s, vUnknown_ref, nUnknown, vKnown_ref, nKnown, dvKnown, dvUnknown))
+
+END:
+	return status;
 }
 
 /***************************************************
@@ -629,63 +4563,328 @@ fmi2Status fmi2GetRealOutputDerivatives(fmi2Component c,
     return fmi2Error;
 }
 
+/* Check whether fmi2CancelStep() has been called for the running asynchronous step */
+static fmi2Boolean stepCanceled(System *s) {
+
+	if (!s->asyncPool) return fmi2False;
+
+	LOCK_MUTEX(s->stepMutex);
+	const fmi2Boolean canceled = s->stepCanceled;
+	UNLOCK_MUTEX(s->stepMutex);
+
+	if (canceled) {
+		s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError", "The step has been canceled.");
+	}
+
+	return canceled;
+}
+
+/* Do a communication step of the system */
+static fmi2Status doSystemStep(System *s, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize) {
+
+	// the warnings that must not be overwritten by the following calls
+	fmi2Status status = fmi2OK, warningStatus = fmi2OK;
+
+	size_t nMicroSteps = 1;
+
+	// number of steps of the components in this communication step
+	for (size_t i = 0; i < s->nComponents; i++) {
+
+		Model *m = &(s->components[i]);
+
+		if (m->stepSize > 0) {
+
+			const fmi2Real ratio = communicationStepSize / m->stepSize;
+
+			m->nSteps = (size_t)(ratio + 0.5);
+			if (m->nSteps < 1) m->nSteps = 1;
+
+			const fmi2Real deviation = ratio - m->nSteps;
+
+			if (!m->stepSizeChanged && (deviation > STEP_SIZE_TOLERANCE * ratio || -deviation > STEP_SIZE_TOLERANCE * ratio)) {
+				m->stepSizeChanged = fmi2True;
+				s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Warning, "logWarning",
+					"The step size %g of %s does not divide the communication step size %g. Using the step size %g instead.",
+					m->stepSize, m->name, communicationStepSize, communicationStepSize / m->nSteps);
+				warningStatus = fmi2Warning;
+			}
+
+		} else {
+			m->nSteps = m->rate;
+		}
+
+		nMicroSteps = nMicroSteps / greatestCommonDivisor(nMicroSteps, m->nSteps) * m->nSteps;
+
+		if (nMicroSteps > MAX_MICRO_STEPS) {
+			s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError",
+				"The step size of %s is incompatible with the step sizes of the other components and the communication step size %g.", m->name, communicationStepSize);
+			return fmi2Error;
+		}
+	}
+
+	for (size_t i = 0; i < s->nLoops; i++) {
+
+		const Loop *loop = &(s->loops[i]);
+
+		for (size_t j = 1; j < loop->nComponents; j++) {
+			if (s->components[loop->components[j]].nSteps != s->components[loop->components[0]].nSteps) {
+				s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError", "The components of loop %zu must have the same step size.", i);
+				return fmi2Error;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < nMicroSteps; i++) {
+
+		for (size_t j = 0; j < s->nLevels; j++) {
+
+			Level *level = &(s->levels[j]);
+
+			if (stepCanceled(s)) return fmi2Error;
+
+			s->nActiveComponents = 0;
+
+			// collect the components that start a step at this micro step
+			for (size_t k = 0; k < level->nComponents; k++) {
+
+				const size_t ci = level->components[k];
+				Model *m = &(s->components[ci]);
+				const size_t stride = nMicroSteps / m->nSteps;
+
+				s->active[ci] = i % stride == 0;
+
+				if (s->active[ci]) {
+					m->currentStepSize = communicationStepSize / m->nSteps;
+					m->currentTime = currentCommunicationPoint + (i / stride) * m->currentStepSize;
+					s->activeComponents[s->nActiveComponents] = ci;
+					s->activePinned[s->nActiveComponents] = level->pinned[k];
+					s->nActiveComponents++;
+				}
+			}
+
+			if (s->nActiveComponents == 0) continue;
+
+			CHECK_STATUS(transfer(s, &(level->transferPlan), i == 0))
+
+			CHECK_STATUS(beginLoops(s, j))
+
+			if (s->threadPool) {
+
+				runThreadPool(s->threadPool, doStep, s, s->nActiveComponents, s->activePinned);
+
+				for (size_t k = 0; k < s->nActiveComponents; k++) {
+					if (s->statuses[k] > status) status = s->statuses[k];
+				}
+
+				if (status > fmi2Warning) goto END;
+
+			} else {
+
+				for (size_t k = 0; k < s->nActiveComponents; k++) {
+					if (k > 0 && stepCanceled(s)) return fmi2Error;
+					CHECK_STATUS(stepComponent(s, &(s->components[s->activeComponents[k]])))
+				}
+			}
+
+			CHECK_STATUS(iterateLoops(s, j))
+
+			// keep the warning of a loop that did not converge
+			if (status > warningStatus) warningStatus = status;
+		}
+
+		// all components have reached the end of the micro step
+		const fmi2Real time = currentCommunicationPoint + (i + 1) * (communicationStepSize / nMicroSteps);
+
+		if (s->asyncPool) {
+			LOCK_MUTEX(s->stepMutex);
+			s->lastSuccessfulTime = time;
+			UNLOCK_MUTEX(s->stepMutex);
+		} else {
+			s->lastSuccessfulTime = time;
+		}
+
+		CHECK_STATUS(recordSample(s, time))
+	}
+
+END:
+	return status > warningStatus ? status : warningStatus;
+}
+
+/* Do the asynchronous step on the worker thread of asyncPool */
+static void doAsyncStep(void *userData, size_t index) {
+
+	System *s = (System *)userData;
+
+	const fmi2Status status = doSystemStep(s, s->stepTime, s->stepSize);
+
+	LOCK_MUTEX(s->stepMutex);
+	s->stepStatus = status;
+	UNLOCK_MUTEX(s->stepMutex);
+
+	// the callback must not call back into the container on this thread
+	if (s->functions.stepFinished) {
+		s->functions.stepFinished(s->functions.componentEnvironment, status);
+	}
+}
+
+/* Wait for the asynchronous step to finish */
+static void finishStep(System *s) {
+
+	if (!s->stepStarted) return;
+
+	waitForThreadPool(s->asyncPool);
+
+	s->stepStarted = fmi2False;
+}
+
+/* Check that no asynchronous step is pending (only fmi2GetStatus() and fmi2CancelStep()
+   may be called while it is running) and release the worker of the finished step */
+static fmi2Boolean stepPending(System *s) {
+
+	if (!s->stepStarted) return fmi2False;
+
+	LOCK_MUTEX(s->stepMutex);
+	const fmi2Boolean pending = s->stepStatus == fmi2Pending;
+	UNLOCK_MUTEX(s->stepMutex);
+
+	if (pending) {
+		s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError",
+			"Only fmi2GetStatus() and fmi2CancelStep() can be called while the step is pending.");
+		return fmi2True;
+	}
+
+	finishStep(s);
+
+	return fmi2False;
+}
+
 fmi2Status fmi2DoStep(fmi2Component c,
                       fmi2Real      currentCommunicationPoint,
                       fmi2Real      communicationStepSize,
                       fmi2Boolean   noSetFMUStatePriorToCurrentPoint) {
 
-	GET_SYSTEM
+	if (!c) return fmi2Error;
 
-	for (size_t i = 0; i < s->nConnections; i++) {
-		fmi2Real realValue;
-		fmi2Integer integerValue;
-		fmi2Boolean booleanValue;
-		Connection *k = &(s->connections[i]);
-		Model *m1 = &(s->components[k->startComponent]);
-		Model *m2 = &(s->components[k->endComponent]);
-		fmi2ValueReference vr1 = k->startValueReference;
-		fmi2ValueReference vr2 = k->endValueReference;
-
-		switch (k->type) {
-		case 'R':
-			CHECK_STATUS(m1->fmi2GetReal(m1->c, &(vr1), 1, &realValue))
-			CHECK_STATUS(m2->fmi2SetReal(m2->c, &(vr2), 1, &realValue))
-			break;
-		case 'I':
-			CHECK_STATUS(m1->fmi2GetInteger(m1->c, &(vr1), 1, &integerValue))
-			CHECK_STATUS(m2->fmi2SetInteger(m2->c, &(vr2), 1, &integerValue))
-			break;
-		case 'B':
-			CHECK_STATUS(m1->fmi2GetBoolean(m1->c, &(vr1), 1, &booleanValue))
-			CHECK_STATUS(m2->fmi2SetBoolean(m2->c, &(vr2), 1, &booleanValue))
-			break;
-		}
-		
+	System *s = (System *)c;
+
+	if (!s->asyncPool) {
+		s->noSetFMUStatePriorToCurrentPoint = noSetFMUStatePriorToCurrentPoint;
+		return doSystemStep(s, currentCommunicationPoint, communicationStepSize);
 	}
 
-	for (size_t i = 0; i < s->nComponents; i++) {
-		Model *m = &(s->components[i]);
-		CHECK_STATUS(m->fmi2DoStep(m->c, currentCommunicationPoint, communicationStepSize, noSetFMUStatePriorToCurrentPoint))
+	fmi2Status status;
+
+	LOCK_MUTEX(s->stepMutex);
+	status = s->stepStatus;
+	UNLOCK_MUTEX(s->stepMutex);
+
+	if (status == fmi2Pending) {
+		s->functions.logger(s->functions.componentEnvironment, s->instanceName, fmi2Error, "logError", "fmi2DoStep() must not be called while the previous step is pending.");
+		return fmi2Error;
 	}
 
-END:
-	return status;
+	finishStep(s);
+
+	s->noSetFMUStatePriorToCurrentPoint = noSetFMUStatePriorToCurrentPoint;
+	s->stepTime = currentCommunicationPoint;
+	s->stepSize = communicationStepSize;
+	s->stepCanceled = fmi2False;
+	s->stepStatus = fmi2Pending;
+	s->stepStarted = fmi2True;
+
+	startThreadPool(s->asyncPool, doAsyncStep, s, 1, NULL);
+
+	return fmi2Pending;
 }
 
 fmi2Status fmi2CancelStep(fmi2Component c) {
-    return fmi2Error;
+
+	if (!c) return fmi2Error;
+
+	System *s = (System *)c;
+
+	if (!s->stepStarted) return fmi2Error;
+
+	// the step is aborted before the next micro step, level or component
+	LOCK_MUTEX(s->stepMutex);
+	s->stepCanceled = fmi2True;
+	UNLOCK_MUTEX(s->stepMutex);
+
+	finishStep(s);
+
+	return fmi2OK;
 }
 
 /* Inquire slave status */
-fmi2Status fmi2GetStatus(fmi2Component c, const fmi2StatusKind s, fmi2Status*  value) {
-    return fmi2Error;
+fmi2Status fmi2GetStatus(fmi2Component c, const fmi2StatusKind kind, fmi2Status*  value) {
+
+	if (!c || kind != fmi2DoStepStatus) return fmi2Error;
+
+	System *s = (System *)c;
+
+	if (!s->asyncPool) return fmi2Error;
+
+	LOCK_MUTEX(s->stepMutex);
+	*value = s->stepStatus;
+	UNLOCK_MUTEX(s->stepMutex);
+
+	return fmi2OK;
 }
 
-fmi2Status fmi2GetRealStatus(fmi2Component c, const fmi2StatusKind s, fmi2Real*    value) {
+fmi2Status fmi2GetRealStatus(fmi2Component c, const fmi2StatusKind kind, fmi2Real*    value) {
+
+	if (c && kind == fmi2LastSuccessfulTime) {
+
+		System *s = (System *)c;
+
+		if (s->asyncPool) {
+			LOCK_MUTEX(s->stepMutex);
+			*value = s->lastSuccessfulTime;
+			UNLOCK_MUTEX(s->stepMutex);
+		} else {
+			*value = s->lastSuccessfulTime;
+		}
+
+		return fmi2OK;
+	}
+
+#ifdef FMU_CONTAINER_PROFILING
+	size_t ci, category;
+	if (c && profileStatusKind((System *)c, kind, &ci, &category)) {
+		*value = ((System *)c)->components[ci].profile.time[category] * 1e-9;
+		return fmi2OK;
+	}
+#endif
     return fmi2Error;
 }
 
-fmi2Status fmi2GetIntegerStatus(fmi2Component c, const fmi2StatusKind s, fmi2Integer* value) {
+fmi2Status fmi2GetIntegerStatus(fmi2Component c, const fmi2StatusKind kind, fmi2Integer* value) {
+
+	if (c && kind >= FMU_CONTAINER_LOOP_STATUS_KIND) {
+
+		const System *s = (System *)c;
+		const size_t index = (size_t)(kind - FMU_CONTAINER_LOOP_STATUS_KIND);
+		const size_t i = index / N_LOOP_STATISTICS;
+
+		if (i < s->nLoops) {
+			const Loop *loop = &(s->loops[i]);
+			switch (index % N_LOOP_STATISTICS) {
+			case LOOP_STEPS:               *value = (fmi2Integer)loop->nSteps;            break;
+			case LOOP_ITERATIONS:          *value = (fmi2Integer)loop->nIterations;       break;
+			case LOOP_MAX_STEP_ITERATIONS: *value = (fmi2Integer)loop->maxStepIterations; break;
+			default:                       *value = (fmi2Integer)loop->nFailures;         break;
+			}
+			return fmi2OK;
+		}
+	}
+
+#ifdef FMU_CONTAINER_PROFILING
+	size_t ci, category;
+	if (c && profileStatusKind((System *)c, kind, &ci, &category)) {
+		*value = (fmi2Integer)((System *)c)->components[ci].profile.count[category];
+		return fmi2OK;
+	}
+#endif
     return fmi2Error;
 }
 
@@ -693,6 +4892,37 @@ fmi2Status fmi2GetBooleanStatus(fmi2Component c, const fmi2StatusKind s, fmi2Boo
     return fmi2Error;
 }
 
-fmi2Status fmi2GetStringStatus(fmi2Component c, const fmi2StatusKind s, fmi2String*  value) {
-    return fmi2Error;
+fmi2Status fmi2GetStringStatus(fmi2Component c, const fmi2StatusKind kind, fmi2String*  value) {
+
+	if (!c || kind != fmi2PendingStatus) return fmi2Error;
+
+	fmi2Status status;
+
+	if (fmi2GetStatus(c, fmi2DoStepStatus, &status) > fmi2Warning) return fmi2Error;
+
+	*value = status == fmi2Pending ? "The container is executing a step." : "";
+
+	return fmi2OK;
+}
+
+#ifdef FMU_CONTAINER_PROFILING
+
+/* Get the time in seconds and the number of calls of component i for the categories
+   doStep, transfer, get and set (see ProfileCategory) */
+FMI2_Export fmi2Status FMUContainerGetProfile(fmi2Component c, size_t i, fmi2Real times[4], uint64_t counts[4]) {
+
+	GET_SYSTEM
+
+	if (i >= s->nComponents) return fmi2Error;
+
+	const Profile *profile = &(s->components[i].profile);
+
+	for (size_t j = 0; j < N_PROFILE_CATEGORIES; j++) {
+		times[j] = profile->time[j] * 1e-9;
+		counts[j] = profile->count[j];
+	}
+
+	return status;
 }
+
+#endif
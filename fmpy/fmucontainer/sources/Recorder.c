@@ -0,0 +1,275 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "Recorder.h"
+
+
+/* The file starts with a NumPy header (format version 1.0 or 2.0 for long headers) that describes
+   a one-dimensional array of records. The number of rows in the shape is padded to SHAPE_WIDTH
+   characters so it can be updated in place after every row. */
+
+#define SHAPE_WIDTH 20
+
+#define INITIAL_CAPACITY (1 << 16)
+
+struct Recorder {
+
+	size_t rowSize;
+	size_t headerSize;
+	size_t shapeOffset;
+	size_t nRows;
+	size_t capacity;
+	uint8_t *data;
+
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+
+};
+
+static void unmapFile(Recorder *recorder) {
+
+#if defined(_WIN32)
+	if (recorder->data) UnmapViewOfFile(recorder->data);
+	if (recorder->mapping) CloseHandle(recorder->mapping);
+	recorder->mapping = NULL;
+#else
+	if (recorder->data) munmap(recorder->data, recorder->capacity);
+#endif
+
+	recorder->data = NULL;
+}
+
+/* Resize the file to capacity bytes and map it */
+static int mapFile(Recorder *recorder, size_t capacity) {
+
+	unmapFile(recorder);
+
+#if defined(_WIN32)
+	recorder->mapping = CreateFileMappingA(recorder->file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)capacity >> 32), (DWORD)capacity, NULL);
+
+	if (!recorder->mapping) return 0;
+
+	recorder->data = MapViewOfFile(recorder->mapping, FILE_MAP_WRITE, 0, 0, 0);
+#else
+	if (ftruncate(recorder->file, (off_t)capacity) != 0) return 0;
+
+	void *data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->file, 0);
+
+	recorder->data = data == MAP_FAILED ? NULL : data;
+#endif
+
+	if (!recorder->data) return 0;
+
+	recorder->capacity = capacity;
+
+	return 1;
+}
+
+static void writeShape(Recorder *recorder) {
+
+	char shape[SHAPE_WIDTH + 1];
+
+	snprintf(shape, sizeof(shape), "%*zu", SHAPE_WIDTH, recorder->nRows);
+
+	memcpy(&recorder->data[recorder->shapeOffset], shape, SHAPE_WIDTH);
+}
+
+/* Write the dictionary of the header or return its length if header is NULL */
+static size_t formatHeader(char *header, size_t nColumns, const char *const names[], size_t *shapeOffset) {
+
+	const uint16_t one = 1;
+	const char byteOrder = *(const uint8_t *)&one ? '<' : '>';
+
+	size_t n = 0;
+
+#define APPEND(C) if (header) header[n] = (C); n++;
+
+	const char *prefix = "{'descr': [";
+
+	for (const char *c = prefix; *c; c++) { APPEND(*c) }
+
+	for (size_t i = 0; i < nColumns; i++) {
+
+		if (i > 0) { APPEND(',') APPEND(' ') }
+
+		APPEND('(') APPEND('\'')
+
+		for (const char *c = names[i]; *c; c++) {
+			if (*c == '\'' || *c == '\\') { APPEND('\\') }
+			APPEND(*c)
+		}
+
+		APPEND('\'') APPEND(',') APPEND(' ') APPEND('\'') APPEND(byteOrder) APPEND('f') APPEND('8') APPEND('\'') APPEND(')')
+	}
+
+	const char *infix = "], 'fortran_order': False, 'shape': (";
+
+	for (const char *c = infix; *c; c++) { APPEND(*c) }
+
+	*shapeOffset = n;
+
+	for (size_t i = 0; i < SHAPE_WIDTH; i++) { APPEND(' ') }
+
+	const char *suffix = ",), }";
+
+	for (const char *c = suffix; *c; c++) { APPEND(*c) }
+
+#undef APPEND
+
+	return n;
+}
+
+Recorder *createRecorder(const char *filename, size_t nColumns, const char *const names[]) {
+
+	Recorder *recorder = calloc(1, sizeof(Recorder));
+
+	if (!recorder) return NULL;
+
+	size_t shapeOffset;
+	const size_t length = formatHeader(NULL, nColumns, names, &shapeOffset);
+
+	// magic string, version, length of the dictionary, dictionary and newline aligned to 64 bytes
+	const int version = length + 64 > 0xFFFF ? 2 : 1;
+	const size_t prefixSize = version == 1 ? 10 : 12;
+	const size_t headerSize = (prefixSize + length + 1 + 63) / 64 * 64;
+	const size_t dictionarySize = headerSize - prefixSize;
+
+	recorder->rowSize = nColumns * sizeof(double);
+	recorder->headerSize = headerSize;
+	recorder->shapeOffset = prefixSize + shapeOffset;
+
+	uint8_t *header = malloc(headerSize);
+
+	if (!header) {
+		free(recorder);
+		return NULL;
+	}
+
+	memcpy(header, "\x93NUMPY", 6);
+	header[6] = (uint8_t)version;
+	header[7] = 0;
+
+	// little-endian length of the dictionary
+	for (size_t i = 0; i < prefixSize - 8; i++) {
+		header[8 + i] = (uint8_t)(dictionarySize >> (8 * i));
+	}
+
+	formatHeader((char *)&header[prefixSize], nColumns, names, &shapeOffset);
+	memset(&header[prefixSize + length], ' ', dictionarySize - length - 1);
+	header[headerSize - 1] = '\n';
+
+	size_t capacity = INITIAL_CAPACITY;
+
+	while (capacity < headerSize + recorder->rowSize) capacity *= 2;
+
+#if defined(_WIN32)
+	recorder->file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (recorder->file == INVALID_HANDLE_VALUE) {
+		free(header);
+		free(recorder);
+		return NULL;
+	}
+#else
+	recorder->file = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (recorder->file < 0) {
+		free(header);
+		free(recorder);
+		return NULL;
+	}
+#endif
+
+	if (!mapFile(recorder, capacity)) {
+		free(header);
+		freeRecorder(recorder);
+		return NULL;
+	}
+
+	memcpy(recorder->data, header, headerSize);
+	writeShape(recorder);
+
+	free(header);
+
+	return recorder;
+}
+
+int appendRow(Recorder *recorder, const double row[]) {
+
+	const size_t size = recorder->headerSize + (recorder->nRows + 1) * recorder->rowSize;
+
+	if (size > recorder->capacity) {
+
+		size_t capacity = recorder->capacity;
+
+		while (capacity < size) capacity *= 2;
+
+		if (!mapFile(recorder, capacity)) return 0;
+	}
+
+	memcpy(&recorder->data[recorder->headerSize + recorder->nRows * recorder->rowSize], row, recorder->rowSize);
+
+	// update the shape after the row has been written
+	recorder->nRows++;
+	writeShape(recorder);
+
+	return 1;
+}
+
+size_t truncateRecorder(Recorder *recorder, size_t nRows) {
+
+	if (nRows < recorder->nRows) {
+
+		recorder->nRows = nRows;
+
+		if (recorder->data) writeShape(recorder);
+	}
+
+	return recorder->nRows;
+}
+
+void freeRecorder(Recorder *recorder) {
+
+	if (!recorder) return;
+
+	if (recorder->data) writeShape(recorder);
+
+	unmapFile(recorder);
+
+	// remove the unused capacity at the end of the file
+	const size_t size = recorder->headerSize + recorder->nRows * recorder->rowSize;
+
+#if defined(_WIN32)
+	if (recorder->file != INVALID_HANDLE_VALUE) {
+		LARGE_INTEGER position;
+		position.QuadPart = (LONGLONG)size;
+		if (SetFilePointerEx(recorder->file, position, NULL, FILE_BEGIN)) SetEndOfFile(recorder->file);
+		CloseHandle(recorder->file);
+	}
+#else
+	if (recorder->file >= 0) {
+		if (ftruncate(recorder->file, (off_t)size) != 0) {
+			// the file keeps the unused capacity
+		}
+		close(recorder->file);
+	}
+#endif
+
+	free(recorder);
+}
@@ -0,0 +1,24 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stddef.h>
+
+/* Rows of doubles that are appended to a growing memory-mapped NumPy file (.npy)
+   that can be opened with numpy.load(filename, mmap_mode='r') while it is written */
+typedef struct Recorder Recorder;
+
+/* Create the file with a record of nColumns doubles with the given names per row */
+Recorder *createRecorder(const char *filename, size_t nColumns, const char *const names[]);
+
+/* Append a row of nColumns values and return 0 if the file could not be extended */
+int appendRow(Recorder *recorder, const double row[]);
+
+/* Discard the rows after the first nRows and return the number of remaining rows */
+size_t truncateRecorder(Recorder *recorder, size_t nRows);
+
+/* Truncate the file to the recorded rows, close it and free the recorder */
+void freeRecorder(Recorder *recorder);
+
+#endif /* RECORDER_H */
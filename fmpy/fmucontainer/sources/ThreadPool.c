@@ -0,0 +1,243 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include <stdlib.h>
+
+#include "ThreadPool.h"
+
+
+#if defined(_WIN32)
+typedef HANDLE             Thread;
+typedef CRITICAL_SECTION   Mutex;
+typedef CONDITION_VARIABLE Condition;
+#define LOCK(m)      EnterCriticalSection(&(m))
+#define UNLOCK(m)    LeaveCriticalSection(&(m))
+#define WAIT(c, m)   SleepConditionVariableCS(&(c), &(m), INFINITE)
+#define NOTIFY_ALL(c) WakeAllConditionVariable(&(c))
+#else
+typedef pthread_t          Thread;
+typedef pthread_mutex_t    Mutex;
+typedef pthread_cond_t     Condition;
+#define LOCK(m)      pthread_mutex_lock(&(m))
+#define UNLOCK(m)    pthread_mutex_unlock(&(m))
+#define WAIT(c, m)   pthread_cond_wait(&(c), &(m))
+#define NOTIFY_ALL(c) pthread_cond_broadcast(&(c))
+#endif
+
+typedef struct {
+
+	ThreadPool *pool;
+	size_t index;
+
+} Worker;
+
+struct ThreadPool {
+
+	size_t nThreads;
+	Thread *threads;
+	Worker *workers;
+
+	Mutex mutex;
+	Condition started;
+	Condition finished;
+
+	int shutdown;
+	size_t generation;
+	size_t nBusy;
+
+	ThreadPoolTask *task;
+	void *userData;
+	size_t nTasks;
+	const int *pinned;
+	size_t next;
+
+};
+
+/* Returns the index of the next task that is not pinned or nTasks if there is none */
+static size_t nextTask(ThreadPool *pool) {
+
+	size_t index = pool->nTasks;
+
+	LOCK(pool->mutex);
+
+	while (pool->next < pool->nTasks) {
+		size_t i = pool->next++;
+		if (!pool->pinned || !pool->pinned[i]) {
+			index = i;
+			break;
+		}
+	}
+
+	UNLOCK(pool->mutex);
+
+	return index;
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI work(LPVOID data) {
+#else
+static void *work(void *data) {
+#endif
+
+	Worker *worker = data;
+	ThreadPool *pool = worker->pool;
+	size_t generation = 0;
+
+	for (;;) {
+
+		LOCK(pool->mutex);
+
+		while (!pool->shutdown && pool->generation == generation) {
+			WAIT(pool->started, pool->mutex);
+		}
+
+		if (pool->shutdown) {
+			UNLOCK(pool->mutex);
+			break;
+		}
+
+		generation = pool->generation;
+
+		UNLOCK(pool->mutex);
+
+		// the first worker executes the pinned tasks in order
+		if (worker->index == 0 && pool->pinned) {
+			for (size_t i = 0; i < pool->nTasks; i++) {
+				if (pool->pinned[i]) pool->task(pool->userData, i);
+			}
+		}
+
+		for (size_t i = nextTask(pool); i < pool->nTasks; i = nextTask(pool)) {
+			pool->task(pool->userData, i);
+		}
+
+		LOCK(pool->mutex);
+
+		if (--pool->nBusy == 0) {
+			NOTIFY_ALL(pool->finished);
+		}
+
+		UNLOCK(pool->mutex);
+	}
+
+	return 0;
+}
+
+ThreadPool *createThreadPool(size_t nThreads) {
+
+	if (nThreads < 1) nThreads = 1;
+
+	ThreadPool *pool = calloc(1, sizeof(ThreadPool));
+
+	if (!pool) return NULL;
+
+	pool->threads = calloc(nThreads, sizeof(Thread));
+	pool->workers = calloc(nThreads, sizeof(Worker));
+
+	if (!pool->threads || !pool->workers) {
+		free(pool->threads);
+		free(pool->workers);
+		free(pool);
+		return NULL;
+	}
+
+#if defined(_WIN32)
+	InitializeCriticalSection(&pool->mutex);
+	InitializeConditionVariable(&pool->started);
+	InitializeConditionVariable(&pool->finished);
+#else
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->started, NULL);
+	pthread_cond_init(&pool->finished, NULL);
+#endif
+
+	for (size_t i = 0; i < nThreads; i++) {
+
+		pool->workers[i].pool = pool;
+		pool->workers[i].index = i;
+
+#if defined(_WIN32)
+		pool->threads[i] = CreateThread(NULL, 0, work, &pool->workers[i], 0, NULL);
+		if (!pool->threads[i]) break;
+#else
+		if (pthread_create(&pool->threads[i], NULL, work, &pool->workers[i]) != 0) break;
+#endif
+		pool->nThreads++;
+	}
+
+	if (pool->nThreads < nThreads) {
+		freeThreadPool(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void freeThreadPool(ThreadPool *pool) {
+
+	if (!pool) return;
+
+	LOCK(pool->mutex);
+	pool->shutdown = 1;
+	NOTIFY_ALL(pool->started);
+	UNLOCK(pool->mutex);
+
+	for (size_t i = 0; i < pool->nThreads; i++) {
+#if defined(_WIN32)
+		WaitForSingleObject(pool->threads[i], INFINITE);
+		CloseHandle(pool->threads[i]);
+#else
+		pthread_join(pool->threads[i], NULL);
+#endif
+	}
+
+#if defined(_WIN32)
+	DeleteCriticalSection(&pool->mutex);
+#else
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->started);
+	pthread_cond_destroy(&pool->finished);
+#endif
+
+	free(pool->threads);
+	free(pool->workers);
+	free(pool);
+}
+
+void startThreadPool(ThreadPool *pool, ThreadPoolTask *task, void *userData, size_t nTasks, const int pinned[]) {
+
+	LOCK(pool->mutex);
+
+	pool->task = task;
+	pool->userData = userData;
+	pool->nTasks = nTasks;
+	pool->pinned = pinned;
+	pool->next = 0;
+	pool->nBusy = pool->nThreads;
+	pool->generation++;
+
+	NOTIFY_ALL(pool->started);
+
+	UNLOCK(pool->mutex);
+}
+
+void waitForThreadPool(ThreadPool *pool) {
+
+	LOCK(pool->mutex);
+
+	while (pool->nBusy > 0) {
+		WAIT(pool->finished, pool->mutex);
+	}
+
+	UNLOCK(pool->mutex);
+}
+
+void runThreadPool(ThreadPool *pool, ThreadPoolTask *task, void *userData, size_t nTasks, const int pinned[]) {
+	startThreadPool(pool, task, userData, nTasks, pinned);
+	waitForThreadPool(pool);
+}
@@ -0,0 +1,30 @@
+/* This file is part of FMPy. See LICENSE.txt for license information. */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+/* A task that processes item "index" */
+typedef void ThreadPoolTask(void *userData, size_t index);
+
+typedef struct ThreadPool ThreadPool;
+
+/* Create a pool with nThreads persistent worker threads */
+ThreadPool *createThreadPool(size_t nThreads);
+
+/* Stop the worker threads and free the pool */
+void freeThreadPool(ThreadPool *pool);
+
+/* Start task(userData, i) for i = 0...nTasks-1 on the worker threads and return immediately.
+   Tasks with pinned[i] != 0 are always executed one after another on the first worker thread. 
+   pinned may be NULL. */
+void startThreadPool(ThreadPool *pool, ThreadPoolTask *task, void *userData, size_t nTasks, const int pinned[]);
+
+/* Wait until all tasks started with startThreadPool() have finished */
+void waitForThreadPool(ThreadPool *pool);
+
+/* Run the tasks and wait for them to finish */
+void runThreadPool(ThreadPool *pool, ThreadPoolTask *task, void *userData, size_t nTasks, const int pinned[]);
+
+#endif /* THREAD_POOL_H */
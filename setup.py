@@ -51,6 +51,10 @@ package_data = {
         'fmucontainer/sources/FMUContainer.c',
         'fmucontainer/sources/mpack.c',
         'fmucontainer/sources/mpack.h',
+        'fmucontainer/sources/ThreadPool.c',
+        'fmucontainer/sources/ThreadPool.h',
+        'fmucontainer/sources/Recorder.c',
+        'fmucontainer/sources/Recorder.h',
         'remoting/client.dll',
         'remoting/license.txt',
         'remoting/server.exe',
@@ -0,0 +1,275 @@
+/* FMI 2.0 Model Exchange FMU to test the Co-Simulation wrapper: a chain of N states
+   der(x[i]) = D * (x[i-1] - 2 * x[i] + x[i+1]) - x[i]^3 with x[0] = x[N+1] = 0, so the
+   Jacobian d der(x) / d x is tridiagonal. The calls to fmi2GetDirectionalDerivative(),
+   fmi2GetDerivatives() and fmi2SetContinuousStates() are counted by the Integer outputs. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fmi2Functions.h"
+
+#define N 100
+
+/* value references */
+#define VR_X 0
+#define VR_DER_X N
+#define VR_D (2 * N)
+#define VR_N_DIRECTIONAL_DERIVATIVES (2 * N + 1)
+#define VR_N_GET_DERIVATIVES (2 * N + 2)
+#define VR_N_SET_CONTINUOUS_STATES (2 * N + 3)
+
+typedef struct {
+    fmi2Real time;
+    fmi2Real x[N];
+    fmi2Real D;
+    fmi2Integer nDirectionalDerivatives;
+    fmi2Integer nGetDerivatives;
+    fmi2Integer nSetContinuousStates;
+} Instance;
+
+static fmi2Real derivative(const Instance *inst, size_t i) {
+    const fmi2Real left = i > 0 ? inst->x[i - 1] : 0;
+    const fmi2Real right = i < N - 1 ? inst->x[i + 1] : 0;
+    const fmi2Real x = inst->x[i];
+    return inst->D * (left - 2 * x + right) - x * x * x;
+}
+
+static void setStartValues(Instance *inst) {
+    for (size_t i = 0; i < N; i++) inst->x[i] = 1;
+    inst->D = 100;
+    inst->nDirectionalDerivatives = 0;
+    inst->nGetDerivatives = 0;
+    inst->nSetContinuousStates = 0;
+}
+
+const char* fmi2GetTypesPlatform(void) {
+    return fmi2TypesPlatform;
+}
+
+const char* fmi2GetVersion(void) {
+    return fmi2Version;
+}
+
+fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
+    return fmi2OK;
+}
+
+fmi2Component fmi2Instantiate(fmi2String instanceName, fmi2Type fmuType, fmi2String fmuGUID, fmi2String fmuResourceLocation,
+    const fmi2CallbackFunctions* functions, fmi2Boolean visible, fmi2Boolean loggingOn) {
+    Instance *instance = calloc(1, sizeof(Instance));
+    if (!instance) return NULL;
+    setStartValues(instance);
+    return instance;
+}
+
+void fmi2FreeInstance(fmi2Component c) {
+    free(c);
+}
+
+fmi2Status fmi2SetupExperiment(fmi2Component c, fmi2Boolean toleranceDefined, fmi2Real tolerance, fmi2Real startTime,
+    fmi2Boolean stopTimeDefined, fmi2Real stopTime) {
+    ((Instance *)c)->time = startTime;
+    return fmi2OK;
+}
+
+fmi2Status fmi2EnterInitializationMode(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2Terminate(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2Reset(fmi2Component c) {
+    setStartValues(c);
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        if (vr[i] < VR_DER_X) {
+            value[i] = inst->x[vr[i] - VR_X];
+        } else if (vr[i] < VR_D) {
+            value[i] = derivative(inst, vr[i] - VR_DER_X);
+        } else if (vr[i] == VR_D) {
+            value[i] = inst->D;
+        } else {
+            return fmi2Error;
+        }
+    }
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Integer value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        switch (vr[i]) {
+        case VR_N_DIRECTIONAL_DERIVATIVES: value[i] = inst->nDirectionalDerivatives; break;
+        case VR_N_GET_DERIVATIVES:         value[i] = inst->nGetDerivatives; break;
+        case VR_N_SET_CONTINUOUS_STATES:   value[i] = inst->nSetContinuousStates; break;
+        default: return fmi2Error;
+        }
+    }
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Boolean value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2String value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        if (vr[i] < VR_DER_X) {
+            inst->x[vr[i] - VR_X] = value[i];
+        } else if (vr[i] == VR_D) {
+            inst->D = value[i];
+        } else {
+            return fmi2Error;
+        }
+    }
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2GetFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2SetFMUstate(fmi2Component c, fmi2FMUstate FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate FMUstate, size_t *size) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2SerializeFMUstate(fmi2Component c, fmi2FMUstate FMUstate, fmi2Byte serializedState[], size_t size) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2DeSerializeFMUstate(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate* FMUstate) {
+    return fmi2Error;
+}
+
+/* Directional derivatives of the derivatives with respect to the states */
+fmi2Status fmi2GetDirectionalDerivative(fmi2Component c, const fmi2ValueReference vUnknown_ref[], size_t nUnknown,
+    const fmi2ValueReference vKnown_ref[], size_t nKnown, const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+
+    Instance *inst = c;
+    fmi2Real seed[N] = { 0 };
+
+    for (size_t j = 0; j < nKnown; j++) {
+        if (vKnown_ref[j] >= VR_DER_X) return fmi2Error;
+        seed[vKnown_ref[j] - VR_X] += dvKnown[j];
+    }
+
+    for (size_t k = 0; k < nUnknown; k++) {
+
+        if (vUnknown_ref[k] < VR_DER_X || vUnknown_ref[k] >= VR_D) return fmi2Error;
+
+        const size_t i = vUnknown_ref[k] - VR_DER_X;
+        const fmi2Real left = i > 0 ? seed[i - 1] : 0;
+        const fmi2Real right = i < N - 1 ? seed[i + 1] : 0;
+
+        dvUnknown[k] = inst->D * (left - 2 * seed[i] + right) - 3 * inst->x[i] * inst->x[i] * seed[i];
+    }
+
+    inst->nDirectionalDerivatives++;
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2EnterEventMode(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2NewDiscreteStates(fmi2Component c, fmi2EventInfo* eventInfo) {
+    eventInfo->newDiscreteStatesNeeded = fmi2False;
+    eventInfo->terminateSimulation = fmi2False;
+    eventInfo->nominalsOfContinuousStatesChanged = fmi2False;
+    eventInfo->valuesOfContinuousStatesChanged = fmi2False;
+    eventInfo->nextEventTimeDefined = fmi2False;
+    eventInfo->nextEventTime = 0;
+    return fmi2OK;
+}
+
+fmi2Status fmi2EnterContinuousTimeMode(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2CompletedIntegratorStep(fmi2Component c, fmi2Boolean noSetFMUStatePriorToCurrentPoint,
+    fmi2Boolean* enterEventMode, fmi2Boolean* terminateSimulation) {
+    *enterEventMode = fmi2False;
+    *terminateSimulation = fmi2False;
+    return fmi2OK;
+}
+
+fmi2Status fmi2SetTime(fmi2Component c, fmi2Real time) {
+    ((Instance *)c)->time = time;
+    return fmi2OK;
+}
+
+fmi2Status fmi2SetContinuousStates(fmi2Component c, const fmi2Real x[], size_t nx) {
+    Instance *inst = c;
+    if (nx != N) return fmi2Error;
+    memcpy(inst->x, x, N * sizeof(fmi2Real));
+    inst->nSetContinuousStates++;
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetDerivatives(fmi2Component c, fmi2Real derivatives[], size_t nx) {
+    Instance *inst = c;
+    if (nx != N) return fmi2Error;
+    for (size_t i = 0; i < N; i++) derivatives[i] = derivative(inst, i);
+    inst->nGetDerivatives++;
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetEventIndicators(fmi2Component c, fmi2Real eventIndicators[], size_t ni) {
+    return ni == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2GetContinuousStates(fmi2Component c, fmi2Real x[], size_t nx) {
+    if (nx != N) return fmi2Error;
+    memcpy(x, ((Instance *)c)->x, N * sizeof(fmi2Real));
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetNominalsOfContinuousStates(fmi2Component c, fmi2Real x_nominal[], size_t nx) {
+    if (nx != N) return fmi2Error;
+    for (size_t i = 0; i < N; i++) x_nominal[i] = 1;
+    return fmi2OK;
+}
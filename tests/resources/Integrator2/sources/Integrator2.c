@@ -0,0 +1,259 @@
+/* FMI 2.0 Co-Simulation FMU to test the FMU container: x integrates der(x) = k * u and y = k * u
+   is a direct feedthrough with directional derivatives. The input is a polynomial in time whose
+   derivatives can be set with fmi2SetRealInputDerivatives(), so the step is exact for inputs that
+   are extrapolated by the container. */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fmi2Functions.h"
+
+typedef enum { vr_u, vr_x, vr_x0, vr_k, vr_nInputDerivatives, vr_y, vr_nDirectionalDerivatives } ValueReference;
+
+typedef struct {
+    fmi2Real time;
+    fmi2Real u;
+    fmi2Real du[2];  // first and second derivative of u
+    fmi2Real x;
+    fmi2Real x0;
+    fmi2Real k;
+    fmi2Integer nInputDerivatives;
+    fmi2Integer nDirectionalDerivatives;
+} Instance;
+
+const char* fmi2GetTypesPlatform(void) {
+    return fmi2TypesPlatform;
+}
+
+const char* fmi2GetVersion(void) {
+    return fmi2Version;
+}
+
+fmi2Status fmi2SetDebugLogging(fmi2Component c, fmi2Boolean loggingOn, size_t nCategories, const fmi2String categories[]) {
+    return fmi2OK;
+}
+
+fmi2Component fmi2Instantiate(fmi2String instanceName, fmi2Type fmuType, fmi2String fmuGUID, fmi2String fmuResourceLocation,
+    const fmi2CallbackFunctions* functions, fmi2Boolean visible, fmi2Boolean loggingOn) {
+    Instance *instance = calloc(1, sizeof(Instance));
+    if (!instance) return NULL;
+    instance->k = 1;
+    return instance;
+}
+
+void fmi2FreeInstance(fmi2Component c) {
+    free(c);
+}
+
+fmi2Status fmi2SetupExperiment(fmi2Component c, fmi2Boolean toleranceDefined, fmi2Real tolerance, fmi2Real startTime,
+    fmi2Boolean stopTimeDefined, fmi2Real stopTime) {
+    ((Instance *)c)->time = startTime;
+    return fmi2OK;
+}
+
+fmi2Status fmi2EnterInitializationMode(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2ExitInitializationMode(fmi2Component c) {
+    Instance *inst = c;
+    inst->x = inst->x0;
+    return fmi2OK;
+}
+
+fmi2Status fmi2Terminate(fmi2Component c) {
+    return fmi2OK;
+}
+
+fmi2Status fmi2Reset(fmi2Component c) {
+    Instance *inst = c;
+    memset(inst, 0, sizeof(Instance));
+    inst->k = 1;
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Real value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        switch (vr[i]) {
+        case vr_u:  value[i] = inst->u; break;
+        case vr_x:  value[i] = inst->x; break;
+        case vr_x0: value[i] = inst->x0; break;
+        case vr_k:  value[i] = inst->k; break;
+        case vr_y:  value[i] = inst->k * inst->u; break;
+        default: return fmi2Error;
+        }
+    }
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Integer value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        switch (vr[i]) {
+        case vr_nInputDerivatives:       value[i] = inst->nInputDerivatives; break;
+        case vr_nDirectionalDerivatives: value[i] = inst->nDirectionalDerivatives; break;
+        default: return fmi2Error;
+        }
+    }
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2Boolean value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2GetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, fmi2String value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2SetReal(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Real value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        switch (vr[i]) {
+        case vr_u:
+            // a new input value without derivatives is held constant
+            inst->u = value[i];
+            inst->du[0] = 0;
+            inst->du[1] = 0;
+            break;
+        case vr_x0: inst->x0 = value[i]; break;
+        case vr_k:  inst->k = value[i]; break;
+        default: return fmi2Error;
+        }
+    }
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2SetInteger(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2SetBoolean(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Boolean value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2SetString(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2String value[]) {
+    return nvr == 0 ? fmi2OK : fmi2Error;
+}
+
+fmi2Status fmi2GetFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2SetFMUstate(fmi2Component c, fmi2FMUstate FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2FreeFMUstate(fmi2Component c, fmi2FMUstate* FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2SerializedFMUstateSize(fmi2Component c, fmi2FMUstate FMUstate, size_t *size) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2SerializeFMUstate(fmi2Component c, fmi2FMUstate FMUstate, fmi2Byte serializedState[], size_t size) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2DeSerializeFMUstate(fmi2Component c, const fmi2Byte serializedState[], size_t size, fmi2FMUstate* FMUstate) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2GetDirectionalDerivative(fmi2Component c, const fmi2ValueReference vUnknown_ref[], size_t nUnknown,
+    const fmi2ValueReference vKnown_ref[], size_t nKnown, const fmi2Real dvKnown[], fmi2Real dvUnknown[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nUnknown; i++) {
+
+        dvUnknown[i] = 0;
+
+        // x has no direct feedthrough
+        if (vUnknown_ref[i] == vr_x) continue;
+
+        if (vUnknown_ref[i] != vr_y) return fmi2Error;
+
+        for (size_t j = 0; j < nKnown; j++) {
+            switch (vKnown_ref[j]) {
+            case vr_u: dvUnknown[i] += inst->k * dvKnown[j]; break;
+            case vr_k: dvUnknown[i] += inst->u * dvKnown[j]; break;
+            default: return fmi2Error;
+            }
+        }
+    }
+
+    inst->nDirectionalDerivatives++;
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2SetRealInputDerivatives(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer order[], const fmi2Real value[]) {
+
+    Instance *inst = c;
+
+    for (size_t i = 0; i < nvr; i++) {
+        if (vr[i] != vr_u || order[i] < 1 || order[i] > 2) return fmi2Error;
+        inst->du[order[i] - 1] = value[i];
+    }
+
+    inst->nInputDerivatives++;
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetRealOutputDerivatives(fmi2Component c, const fmi2ValueReference vr[], size_t nvr, const fmi2Integer order[], fmi2Real value[]) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2DoStep(fmi2Component c, fmi2Real currentCommunicationPoint, fmi2Real communicationStepSize, fmi2Boolean noSetFMUStatePriorToCurrentPoint) {
+
+    Instance *inst = c;
+    const fmi2Real h = communicationStepSize;
+
+    // exact integral of the input polynomial over the step
+    inst->x += inst->k * h * (inst->u + inst->du[0] * h / 2 + inst->du[1] * h * h / 6);
+
+    // and the input polynomial at the end of the step
+    inst->u += h * (inst->du[0] + inst->du[1] * h / 2);
+    inst->du[0] += h * inst->du[1];
+
+    inst->time = currentCommunicationPoint + communicationStepSize;
+
+    return fmi2OK;
+}
+
+fmi2Status fmi2CancelStep(fmi2Component c) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2GetStatus(fmi2Component c, const fmi2StatusKind s, fmi2Status* value) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2GetRealStatus(fmi2Component c, const fmi2StatusKind s, fmi2Real* value) {
+    if (s != fmi2LastSuccessfulTime) return fmi2Error;
+    *value = ((Instance *)c)->time;
+    return fmi2OK;
+}
+
+fmi2Status fmi2GetIntegerStatus(fmi2Component c, const fmi2StatusKind s, fmi2Integer* value) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2GetBooleanStatus(fmi2Component c, const fmi2StatusKind s, fmi2Boolean* value) {
+    return fmi2Error;
+}
+
+fmi2Status fmi2GetStringStatus(fmi2Component c, const fmi2StatusKind s, fmi2String* value) {
+    return fmi2Error;
+}
@@ -0,0 +1,292 @@
+/* FMI 3.0 Co-Simulation FMU to test the FMU container: the array x integrates der(x) = u + k * {1, 2, 3}
+   with the explicit Euler method. At t = 0.55 the step returns early and x[0] jumps by 10 (in event mode
+   if the FMU has been instantiated with eventModeRequired). */
+
+#include <stdlib.h>
+#include <string.h>
+#include "fmi3Functions.h"
+
+#define N 3
+#define EVENT_TIME 0.55
+
+typedef enum { vr_time, vr_u, vr_x, vr_sum, vr_usum, vr_k, vr_y, vr_nEvents, vr_nDerivatives } ValueReference;
+
+typedef struct {
+    fmi3Float64 time;
+    fmi3Float64 u[N];
+    fmi3Float64 x[N];
+    fmi3Float64 k;
+    fmi3Int32 nEvents;
+    fmi3Int32 nDerivatives;
+    fmi3Boolean eventMode;
+    fmi3Boolean eventHandled;
+    fmi3Boolean eventPending;
+} Instance;
+
+static fmi3Float64 weightedSum(const fmi3Float64 v[N]) {
+    return v[0] + 2 * v[1] + 3 * v[2];
+}
+
+fmi3Instance fmi3InstantiateCoSimulation(fmi3String instanceName, fmi3String instantiationToken, fmi3String resourceLocation,
+    fmi3Boolean visible, fmi3Boolean loggingOn, fmi3Boolean eventModeRequired, const fmi3ValueReference requiredIntermediateVariables[],
+    size_t nRequiredIntermediateVariables, fmi3InstanceEnvironment instanceEnvironment, fmi3CallbackLogMessage logMessage,
+    fmi3CallbackIntermediateUpdate intermediateUpdate) {
+    Instance *instance = calloc(1, sizeof(Instance));
+    if (!instance) return NULL;
+    instance->k = 1;
+    instance->eventMode = eventModeRequired;
+    return instance;
+}
+
+void fmi3FreeInstance(fmi3Instance instance) {
+    free(instance);
+}
+
+fmi3Status fmi3SetDebugLogging(fmi3Instance instance, fmi3Boolean loggingOn, size_t nCategories, const fmi3String categories[]) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3EnterInitializationMode(fmi3Instance instance, fmi3Boolean toleranceDefined, fmi3Float64 tolerance,
+    fmi3Float64 startTime, fmi3Boolean stopTimeDefined, fmi3Float64 stopTime) {
+    ((Instance *)instance)->time = startTime;
+    return fmi3OK;
+}
+
+fmi3Status fmi3ExitInitializationMode(fmi3Instance instance) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3EnterEventMode(fmi3Instance instance, fmi3Boolean stepEvent, const fmi3Int32 rootsFound[], size_t nEventIndicators, fmi3Boolean timeEvent) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3Terminate(fmi3Instance instance) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3Reset(fmi3Instance instance) {
+    Instance *inst = instance;
+    const fmi3Boolean eventMode = inst->eventMode;
+    memset(inst, 0, sizeof(Instance));
+    inst->k = 1;
+    inst->eventMode = eventMode;
+    return fmi3OK;
+}
+
+fmi3Status fmi3GetFloat64(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3Float64 values[], size_t nValues) {
+
+    Instance *inst = instance;
+    size_t j = 0;
+
+    for (size_t i = 0; i < nValueReferences; i++) {
+
+        const size_t n = valueReferences[i] == vr_u || valueReferences[i] == vr_x ? N : 1;
+
+        if (j + n > nValues) return fmi3Error;
+
+        switch (valueReferences[i]) {
+        case vr_time: values[j] = inst->time; break;
+        case vr_u:    memcpy(&values[j], inst->u, sizeof(inst->u)); break;
+        case vr_x:    memcpy(&values[j], inst->x, sizeof(inst->x)); break;
+        case vr_sum:  values[j] = weightedSum(inst->x); break;
+        case vr_usum: values[j] = weightedSum(inst->u); break;
+        case vr_k:    values[j] = inst->k; break;
+        case vr_y:    values[j] = 3 * inst->k; break;
+        default: return fmi3Error;
+        }
+
+        j += n;
+    }
+
+    return j == nValues ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3SetFloat64(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3Float64 values[], size_t nValues) {
+
+    Instance *inst = instance;
+    size_t j = 0;
+
+    for (size_t i = 0; i < nValueReferences; i++) {
+        switch (valueReferences[i]) {
+        case vr_u:
+            if (j + N > nValues) return fmi3Error;
+            memcpy(inst->u, &values[j], sizeof(inst->u));
+            j += N;
+            break;
+        case vr_k:
+            if (j + 1 > nValues) return fmi3Error;
+            inst->k = values[j++];
+            break;
+        default:
+            return fmi3Error;
+        }
+    }
+
+    return j == nValues ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3GetInt32(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3Int32 values[], size_t nValues) {
+
+    Instance *inst = instance;
+
+    if (nValueReferences != nValues) return fmi3Error;
+
+    for (size_t i = 0; i < nValueReferences; i++) {
+        switch (valueReferences[i]) {
+        case vr_nEvents:      values[i] = inst->nEvents; break;
+        case vr_nDerivatives: values[i] = inst->nDerivatives; break;
+        default: return fmi3Error;
+        }
+    }
+
+    return fmi3OK;
+}
+
+fmi3Status fmi3SetInt32(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3Int32 values[], size_t nValues) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3GetBoolean(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3Boolean values[], size_t nValues) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3SetBoolean(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3Boolean values[], size_t nValues) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3GetString(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, fmi3String values[], size_t nValues) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3SetString(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences, const fmi3String values[], size_t nValues) {
+    return nValueReferences == 0 ? fmi3OK : fmi3Error;
+}
+
+fmi3Status fmi3GetFMUState(fmi3Instance instance, fmi3FMUState *FMUState) {
+    Instance *state = malloc(sizeof(Instance));
+    if (!state) return fmi3Error;
+    memcpy(state, instance, sizeof(Instance));
+    *FMUState = state;
+    return fmi3OK;
+}
+
+fmi3Status fmi3SetFMUState(fmi3Instance instance, fmi3FMUState FMUState) {
+    memcpy(instance, FMUState, sizeof(Instance));
+    return fmi3OK;
+}
+
+fmi3Status fmi3FreeFMUState(fmi3Instance instance, fmi3FMUState *FMUState) {
+    free(*FMUState);
+    *FMUState = NULL;
+    return fmi3OK;
+}
+
+fmi3Status fmi3SerializedFMUStateSize(fmi3Instance instance, fmi3FMUState FMUState, size_t *size) {
+    *size = sizeof(Instance);
+    return fmi3OK;
+}
+
+fmi3Status fmi3SerializeFMUState(fmi3Instance instance, fmi3FMUState FMUState, fmi3Byte serializedState[], size_t size) {
+    if (size != sizeof(Instance)) return fmi3Error;
+    memcpy(serializedState, FMUState, size);
+    return fmi3OK;
+}
+
+fmi3Status fmi3DeSerializeFMUState(fmi3Instance instance, const fmi3Byte serializedState[], size_t size, fmi3FMUState *FMUState) {
+    if (size != sizeof(Instance)) return fmi3Error;
+    Instance *state = malloc(sizeof(Instance));
+    if (!state) return fmi3Error;
+    memcpy(state, serializedState, size);
+    *FMUState = state;
+    return fmi3OK;
+}
+
+/* the only derivative is d y / d k = 3 */
+fmi3Status fmi3GetDirectionalDerivative(fmi3Instance instance, const fmi3ValueReference unknowns[], size_t nUnknowns,
+    const fmi3ValueReference knowns[], size_t nKnowns, const fmi3Float64 seed[], size_t nSeed, fmi3Float64 sensitivity[], size_t nSensitivity) {
+
+    Instance *inst = instance;
+
+    if (nUnknowns != nSensitivity || nKnowns != nSeed) return fmi3Error;
+
+    inst->nDerivatives++;
+
+    for (size_t i = 0; i < nUnknowns; i++) {
+        sensitivity[i] = 0;
+        for (size_t j = 0; j < nKnowns; j++) {
+            if (unknowns[i] == vr_y && knowns[j] == vr_k) sensitivity[i] += 3 * seed[j];
+        }
+    }
+
+    return fmi3OK;
+}
+
+fmi3Status fmi3NewDiscreteStates(fmi3Instance instance, fmi3Boolean *newDiscreteStatesNeeded, fmi3Boolean *terminateSimulation,
+    fmi3Boolean *nominalsOfContinuousStatesChanged, fmi3Boolean *valuesOfContinuousStatesChanged, fmi3Boolean *nextEventTimeDefined,
+    fmi3Float64 *nextEventTime) {
+
+    Instance *inst = instance;
+
+    *valuesOfContinuousStatesChanged = inst->eventPending;
+
+    if (inst->eventPending) {
+        inst->x[0] += 10;
+        inst->nEvents++;
+        inst->eventPending = fmi3False;
+    }
+
+    *newDiscreteStatesNeeded = fmi3False;
+    *terminateSimulation = fmi3False;
+    *nominalsOfContinuousStatesChanged = fmi3False;
+    *nextEventTimeDefined = fmi3False;
+    *nextEventTime = 0;
+
+    return fmi3OK;
+}
+
+fmi3Status fmi3EnterStepMode(fmi3Instance instance) {
+    return fmi3OK;
+}
+
+fmi3Status fmi3GetOutputDerivatives(fmi3Instance instance, const fmi3ValueReference valueReferences[], size_t nValueReferences,
+    const fmi3Int32 orders[], fmi3Float64 values[], size_t nValues) {
+    return fmi3Error;
+}
+
+fmi3Status fmi3DoStep(fmi3Instance instance, fmi3Float64 currentCommunicationPoint, fmi3Float64 communicationStepSize,
+    fmi3Boolean noSetFMUStatePriorToCurrentPoint, fmi3Boolean *terminate, fmi3Boolean *earlyReturn, fmi3Float64 *lastSuccessfulTime) {
+
+    Instance *inst = instance;
+    fmi3Float64 endTime = currentCommunicationPoint + communicationStepSize;
+
+    if (inst->eventPending) return fmi3Error;
+
+    *terminate = fmi3False;
+    *earlyReturn = fmi3False;
+
+    if (!inst->eventHandled && endTime > EVENT_TIME + 1e-10) {
+        endTime = EVENT_TIME;
+        *earlyReturn = fmi3True;
+    }
+
+    const fmi3Float64 h = endTime - currentCommunicationPoint;
+
+    for (size_t i = 0; i < N; i++) {
+        inst->x[i] += h * (inst->u[i] + inst->k * (i + 1));
+    }
+
+    inst->time = endTime;
+
+    if (*earlyReturn) {
+        inst->eventHandled = fmi3True;
+        if (inst->eventMode) {
+            inst->eventPending = fmi3True;
+        } else {
+            inst->x[0] += 10;
+        }
+    }
+
+    *lastSuccessfulTime = endTime;
+
+    return fmi3OK;
+}
@@ -1,11 +1,72 @@
+import os
+import shutil
 import unittest
-from fmpy import read_model_description, simulate_fmu
-from fmpy.util import download_test_file
-from fmpy.cswrapper import add_cswrapper
+import zipfile
+import numpy as np
+from shutil import rmtree
+from unittest import skipIf
+from fmpy import platform, read_model_description, simulate_fmu, extract
+from fmpy.util import download_test_file, download_file, compile_platform_binary
+from fmpy.fmi2 import FMU2Slave
+from fmpy.simulation import instantiate_fmu
+from fmpy.cswrapper import add_cswrapper, get_statistics
+
+
+def simulate_wrapped_fmu(filename, **kwargs):
+    """ Simulate an FMU with the Co-Simulation wrapper and return the result, the integrator statistics
+    and the log messages """
+
+    model_description = read_model_description(filename)
+
+    unzipdir = extract(filename)
+
+    messages = []
+
+    def logger(component, instanceName, status, category, message):
+        messages.append(message.decode('utf-8'))
+
+    fmu = instantiate_fmu(unzipdir, model_description, 'CoSimulation', debug_logging=True, logger=logger)
+
+    result = simulate_fmu(unzipdir, fmu_instance=fmu, model_description=model_description, **kwargs)
+
+    statistics = get_statistics(fmu)
+
+    fmu.freeInstance()
+
+    rmtree(unzipdir, ignore_errors=True)
+
+    return result, statistics, messages
+
+
+def replace_configuration(filename, outfilename, configuration):
+    """ Copy an FMU with the Co-Simulation wrapper and replace its configuration """
+
+    with zipfile.ZipFile(filename) as zin, zipfile.ZipFile(outfilename, 'w', zipfile.ZIP_DEFLATED) as zout:
+        for item in zin.infolist():
+            if item.filename == 'resources/cswrapper.txt':
+                zout.writestr(item, configuration)
+            else:
+                zout.writestr(item, zin.read(item.filename))
+
+
+def compile_test_fmu(name):
+    """ Create the source FMU from tests/resources/<name> and compile its platform binary """
+
+    shutil.make_archive(name, 'zip', os.path.join(os.path.dirname(__file__), 'resources', name))
+    os.replace(name + '.zip', name + '.fmu')
+    compile_platform_binary(name + '.fmu')
+
+    return name + '.fmu'
 
 
 class CSWrapperTest(unittest.TestCase):
 
+    def assertResultsClose(self, result, reference, rtol=1e-2):
+        """ Compare the outputs with a tolerance relative to the range of the reference """
+        for name in reference.dtype.names[1:]:
+            atol = rtol * max(1.0, np.max(np.abs(reference[name])))
+            self.assertTrue(np.allclose(result[name], reference[name], rtol=0, atol=atol), name)
+
     def test_cswrapper(self):
 
         filename = 'CoupledClutches.fmu'
@@ -18,4 +79,288 @@ class CSWrapperTest(unittest.TestCase):
 
         add_cswrapper(filename)
 
+        with zipfile.ZipFile(filename) as zf:
+            self.assertIn('resources/cswrapper.txt', zf.namelist())
+
         simulate_fmu(filename, fmi_type='CoSimulation')
+
+    def test_cswrapper_solvers(self):
+
+        filename = 'CoupledClutches.fmu'
+
+        download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+        add_cswrapper(filename, outfilename='CoupledClutches_bdf_dense.fmu', solver='bdf', linear_solver='dense')
+
+        reference = simulate_fmu('CoupledClutches_bdf_dense.fmu', fmi_type='CoSimulation')
+
+        # the sparse linear solver falls back to the dense linear solver if the wrapper has been built without KLU
+        for solver, linear_solver in [('auto', 'auto'), ('adams', 'auto'), ('bdf', 'auto'), ('bdf', 'band'), ('bdf', 'sparse'),
+                                      ('bdf', 'spgmr'), ('erk', 'auto'), ('ark', 'dense'), ('ark', 'band')]:
+
+            with self.subTest(solver=solver, linear_solver=linear_solver):
+
+                outfilename = 'CoupledClutches_%s_%s.fmu' % (solver, linear_solver)
+
+                add_cswrapper(filename, outfilename=outfilename, solver=solver, linear_solver=linear_solver)
+
+                result = simulate_fmu(outfilename, fmi_type='CoSimulation')
+
+                self.assertResultsClose(result, reference)
+
+    def test_cswrapper_statistics(self):
+
+        filename = 'CoupledClutches.fmu'
+
+        download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+        add_cswrapper(filename, outfilename='CoupledClutches_statistics.fmu')
+
+        model_description = read_model_description('CoupledClutches_statistics.fmu')
+
+        fmu = FMU2Slave(guid=model_description.guid,
+                        unzipDirectory=extract('CoupledClutches_statistics.fmu'),
+                        modelIdentifier=model_description.coSimulation.modelIdentifier)
+
+        fmu.instantiate()
+
+        simulate_fmu('CoupledClutches_statistics.fmu', fmu_instance=fmu, model_description=model_description)
+
+        statistics = get_statistics(fmu)
+
+        self.assertGreater(statistics['steps'], 0)
+        self.assertGreater(statistics['rhs_evaluations'], 0)
+        self.assertGreaterEqual(statistics['model_time'], 0)
+
+        fmu.freeInstance()
+
+    @skipIf(platform != 'win64', "Current platform not supported by this FMU")
+    def test_cswrapper_directional_derivatives(self):
+
+        filename = 'Rectifier.fmu'
+
+        download_test_file('2.0', 'ModelExchange', 'Dymola', '2019FD01', 'Rectifier', filename)
+
+        model_description = read_model_description(filename)
+
+        self.assertTrue(model_description.modelExchange.providesDirectionalDerivative)
+
+        add_cswrapper(filename, outfilename='Rectifier_jacobian.fmu')
+
+        # without the states and the sparsity pattern CVODE approximates the Jacobian by difference quotients
+        replace_configuration('Rectifier_jacobian.fmu', 'Rectifier_no_structure.fmu', 'solver bdf\nlinearSolver dense\n')
+
+        result, statistics, _ = simulate_wrapped_fmu('Rectifier_jacobian.fmu', stop_time=0.1)
+        reference, reference_statistics, _ = simulate_wrapped_fmu('Rectifier_no_structure.fmu', stop_time=0.1)
+
+        self.assertResultsClose(result, reference)
+
+        # the analytic Jacobian must not need considerably more updates than the difference quotients
+        self.assertGreater(statistics['jacobian_evaluations'], 0)
+        self.assertGreater(reference_statistics['jacobian_evaluations'], 0)
+        self.assertLessEqual(statistics['jacobian_evaluations'], 2 * reference_statistics['jacobian_evaluations'])
+
+    @skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_cswrapper_colored_jacobian(self):
+
+        # chain of 100 states with a tridiagonal Jacobian that is evaluated with 3 directional derivatives
+        filename = compile_test_fmu('Chain')
+
+        add_cswrapper(filename, outfilename='Chain_jacobian.fmu', linear_solver='dense')
+
+        with zipfile.ZipFile('Chain_jacobian.fmu') as zf:
+            configuration = zf.read('resources/cswrapper.txt').decode('utf-8')
+
+        # the same FMU with difference quotients per color and with CVODE's dense difference quotients
+        replace_configuration('Chain_jacobian.fmu', 'Chain_colored.fmu',
+                              configuration.replace('providesDirectionalDerivative 1', 'providesDirectionalDerivative 0'))
+        replace_configuration('Chain_jacobian.fmu', 'Chain_dense.fmu', 'solver bdf\nlinearSolver dense\n')
+
+        output = ['x[1]', 'x[50]', 'x[100]', 'nDirectionalDerivatives']
+
+        reference, reference_statistics, _ = simulate_wrapped_fmu('Chain_dense.fmu', stop_time=1, output=output)
+
+        self.assertEqual(0, reference['nDirectionalDerivatives'][-1])
+
+        for filename, directional_derivatives in [('Chain_jacobian.fmu', True), ('Chain_colored.fmu', False)]:
+
+            with self.subTest(filename=filename):
+
+                result, statistics, _ = simulate_wrapped_fmu(filename, stop_time=1, output=output)
+
+                # the Jacobian is evaluated with one directional derivative per color
+                self.assertGreater(statistics['jacobian_evaluations'], 0)
+
+                if directional_derivatives:
+                    self.assertEqual(3 * statistics['jacobian_evaluations'], result['nDirectionalDerivatives'][-1])
+                else:
+                    self.assertEqual(0, result['nDirectionalDerivatives'][-1])
+
+                # a Jacobian that differs from the dense difference quotients would change the Newton iterations
+                self.assertResultsClose(result[['time', 'x[1]', 'x[50]', 'x[100]']], reference[['time', 'x[1]', 'x[50]', 'x[100]']], rtol=1e-3)
+                self.assertLessEqual(statistics['convergence_failures'], reference_statistics['convergence_failures'] + 2)
+                self.assertLessEqual(statistics['jacobian_evaluations'], 2 * reference_statistics['jacobian_evaluations'])
+                self.assertLessEqual(statistics['steps'], 1.2 * reference_statistics['steps'])
+
+    def test_cswrapper_linear_solver_selection(self):
+
+        filename = 'CoupledClutches.fmu'
+
+        download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+        # the model has too few states for a banded or sparse linear solver
+        add_cswrapper(filename, outfilename='CoupledClutches_auto.fmu', linear_solver='auto')
+
+        _, _, messages = simulate_wrapped_fmu('CoupledClutches_auto.fmu')
+
+        self.assertTrue(any(message.startswith('Using the dense linear solver') for message in messages))
+
+        # the bandwidths of the banded linear solver are derived from the sparsity pattern
+        add_cswrapper(filename, outfilename='CoupledClutches_band.fmu', linear_solver='band')
+
+        with zipfile.ZipFile('CoupledClutches_band.fmu') as zf:
+            configuration = zf.read('resources/cswrapper.txt').decode('utf-8')
+
+        mu, ml = 0, 0
+
+        for line in configuration.splitlines():
+            if line.startswith('dependencies '):
+                row, _, *columns = map(int, line.split()[1:])
+                for column in columns:
+                    mu = max(mu, column - row)
+                    ml = max(ml, row - column)
+
+        _, _, messages = simulate_wrapped_fmu('CoupledClutches_band.fmu')
+
+        self.assertTrue(any(message.startswith('Using the band linear solver') and 'mu = %d, ml = %d' % (mu, ml) in message
+                            for message in messages))
+
+    @skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_cswrapper_linear_solver_selection_sparse(self):
+
+        # 100 states with a tridiagonal Jacobian (nnz = 298)
+        filename = compile_test_fmu('Chain')
+
+        add_cswrapper(filename, outfilename='Chain_auto.fmu', linear_solver='auto')
+
+        with zipfile.ZipFile('Chain_auto.fmu') as zf:
+            configuration = zf.read('resources/cswrapper.txt').decode('utf-8')
+
+        def linear_solver(filename):
+            _, _, messages = simulate_wrapped_fmu(filename, stop_time=0.1)
+            for message in messages:
+                if message.startswith('Using the '):
+                    return message
+            self.fail("The linear solver has not been logged.")
+
+        # the sparse linear solver is only available if the wrapper has been built with KLU
+        replace_configuration('Chain_auto.fmu', 'Chain_sparse.fmu', configuration.replace('linearSolver auto', 'linearSolver sparse'))
+
+        _, _, messages = simulate_wrapped_fmu('Chain_sparse.fmu', stop_time=0.1)
+
+        klu = 'The sparse linear solver is not available. Using the dense linear solver instead.' not in messages
+
+        # the band matrix is small enough for the tridiagonal pattern
+        self.assertEqual('Using the band linear solver (nx = 100, nnz = 298, mu = 1, ml = 1).', linear_solver('Chain_auto.fmu'))
+
+        # the band of a pattern with one distant entry is too large but still smaller than the dense matrix
+        replace_configuration('Chain_auto.fmu', 'Chain_distant.fmu', configuration.replace('dependencies 0 2 0 1\n', 'dependencies 0 3 0 1 20\n'))
+
+        self.assertEqual('Using the %s linear solver (nx = 100, nnz = 299, mu = 20, ml = 1).' % ('sparse' if klu else 'band'),
+                         linear_solver('Chain_distant.fmu'))
+
+        # the band of a pattern with entries in the corners is the dense matrix
+        replace_configuration('Chain_auto.fmu', 'Chain_corners.fmu', configuration
+                              .replace('dependencies 0 2 0 1\n', 'dependencies 0 3 0 1 99\n')
+                              .replace('dependencies 99 2 98 99\n', 'dependencies 99 3 0 98 99\n'))
+
+        self.assertEqual('Using the %s linear solver (nx = 100, nnz = 300, mu = 99, ml = 99).' % ('sparse' if klu else 'dense'),
+                         linear_solver('Chain_corners.fmu'))
+
+    def test_cswrapper_tolerance(self):
+
+        filename = 'CoupledClutches.fmu'
+
+        download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+        add_cswrapper(filename, outfilename='CoupledClutches_tolerance.fmu')
+
+        # the tolerance passed to fmi2SetupExperiment() is used by the integrator
+        coarse, coarse_statistics, _ = simulate_wrapped_fmu('CoupledClutches_tolerance.fmu', relative_tolerance=1e-3)
+        fine, fine_statistics, _ = simulate_wrapped_fmu('CoupledClutches_tolerance.fmu', relative_tolerance=1e-7)
+
+        self.assertGreater(fine_statistics['steps'], coarse_statistics['steps'])
+
+        self.assertResultsClose(coarse, fine)
+
+    def test_cswrapper_evaluation_cache(self):
+
+        filename = 'CoupledClutches.fmu'
+
+        download_test_file('2.0', 'ModelExchange', 'MapleSim', '2016.2', 'CoupledClutches', filename)
+
+        for solver in ['bdf', 'auto']:
+
+            with self.subTest(solver=solver):
+
+                outfilename = 'CoupledClutches_cache_%s.fmu' % solver
+
+                add_cswrapper(filename, outfilename=outfilename, solver=solver)
+
+                _, statistics, _ = simulate_wrapped_fmu(outfilename)
+
+                # the root function is evaluated at the points where the right-hand side has been evaluated
+                # (e.g. at the start of the integration and after the re-initializations at state events)
+                self.assertGreater(statistics['state_events'], 0)
+                self.assertGreater(statistics['skipped_sets'], 0)
+
+    @skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_cswrapper_evaluation_cache_model_calls(self):
+
+        # the test FMU counts the calls to fmi2GetDerivatives() and fmi2SetContinuousStates()
+        filename = compile_test_fmu('Chain')
+
+        add_cswrapper(filename, outfilename='Chain_cache.fmu', solver='bdf')
+
+        result, statistics, _ = simulate_wrapped_fmu('Chain_cache.fmu', stop_time=1, output_interval=0.01,
+                                                     output=['nGetDerivatives', 'nSetContinuousStates'])
+
+        n_get_derivatives = result['nGetDerivatives'][-1]
+        n_set_continuous_states = result['nSetContinuousStates'][-1]
+
+        # every evaluation of the right-hand side that is not reused calls the model
+        self.assertEqual(statistics['rhs_evaluations'] - statistics['reused_derivatives'], n_get_derivatives)
+
+        # the Jacobian is evaluated at the point of the preceding right-hand side evaluation
+        self.assertGreater(statistics['jacobian_evaluations'], 0)
+        self.assertGreaterEqual(statistics['skipped_sets'], statistics['jacobian_evaluations'])
+
+        # without the cache the states would be set for every right-hand side and Jacobian evaluation
+        # and at every communication point
+        uncached = statistics['rhs_evaluations'] + statistics['jacobian_evaluations'] + len(result)
+        self.assertLessEqual(n_set_continuous_states, uncached - statistics['skipped_sets'])
+
+    def test_cswrapper_events(self):
+
+        v = '0.0.4'  # Reference FMUs version
+
+        download_file(url='https://github.com/modelica/Reference-FMUs/releases/download/v' + v + '/Reference-FMUs-' + v + '.zip',
+                      checksum='ed4b2346782c44937a411037c19a32ac2bd09cd43a5fce9bb0fddc571723fc3a')
+
+        extract('Reference-FMUs-' + v + '.zip', 'Reference-FMUs-dist')
+
+        # time events that do not change the continuous states keep the history of the integrator
+        add_cswrapper(os.path.join('Reference-FMUs-dist', '2.0', 'Stair.fmu'), outfilename='Stair_cswrapper.fmu')
+
+        _, statistics, _ = simulate_wrapped_fmu('Stair_cswrapper.fmu')
+
+        self.assertGreater(statistics['time_events'], 0)
+        self.assertEqual(0, statistics['reinitializations'])
+
+        # state events re-initialize the integrator
+        add_cswrapper(os.path.join('Reference-FMUs-dist', '2.0', 'BouncingBall.fmu'), outfilename='BouncingBall_cswrapper.fmu')
+
+        _, statistics, _ = simulate_wrapped_fmu('BouncingBall_cswrapper.fmu')
+
+        self.assertGreater(statistics['state_events'], 0)
+        self.assertEqual(statistics['state_events'], statistics['reinitializations'])
@@ -1,12 +1,122 @@
+import json
 import os
+import re
+import shutil
+import struct
+import time
 import unittest
-from fmpy import simulate_fmu
-from fmpy.fmucontainer import create_fmu_container
+import zipfile
+from shutil import rmtree
+import fmpy
+from fmpy import platform, simulate_fmu, read_model_description, extract
+from fmpy.util import download_file, compile_platform_binary
+from fmpy.fmi2 import FMU2Slave, fmi2OK, fmi2Warning, fmi2Error, fmi2Pending, fmi2True, fmi2DoStepStatus, fmi2LastSuccessfulTime
+from fmpy.fmucontainer import create_fmu_container, read_recording
 import numpy as np
 
 
+w_ref = np.array([(0.5, 0), (1.5, 1), (2, 1), (3, 0)], dtype=[('time', 'f8'), ('w_ref', 'f8')])
+
+
+class CompiledConfigTest(unittest.TestCase):
+
+    def test_compiled_config_layout(self):
+        """ The records written by write_compiled_config() must match the structs in FMUContainer.c """
+
+        from fmpy.fmucontainer import CONFIG_ID, CONFIG_VERSION, CONFIG_BYTE_ORDER, CONFIG_FORMATS
+
+        with open(os.path.join(os.path.dirname(fmpy.__file__), 'fmucontainer', 'sources', 'FMUContainer.c')) as f:
+            source = f.read()
+
+        self.assertEqual(CONFIG_ID.decode('ascii'), re.search(r'#define CONFIG_ID\s+"(\w+)"', source).group(1))
+        self.assertEqual(CONFIG_VERSION, int(re.search(r'#define CONFIG_VERSION\s+(\d+)', source).group(1)))
+        self.assertEqual(CONFIG_BYTE_ORDER, int(re.search(r'#define CONFIG_BYTE_ORDER\s+(0x[0-9A-Fa-f]+)', source).group(1), 16))
+
+        types = {'char': 'c', 'uint8_t': 'B', 'uint32_t': 'I', 'fmi2ValueReference': 'I', 'uint64_t': 'Q', 'double': 'd'}
+
+        for name, format in CONFIG_FORMATS.items():
+            body = re.search(r'typedef struct \{([^}]*)\} %s;' % name, source).group(1)
+            fields = re.findall(r'^\s*(\w+) \w+(?:\[(\d+)\])?;', body, re.MULTILINE)
+            c_format = '<' + ''.join(length + 's' if length else types[type] for type, length in fields)
+            self.assertEqual(format, c_format, name)
+            # the structs must not contain padding
+            self.assertEqual(struct.calcsize(format), struct.calcsize('@' + format[1:]), name)
+
+
+class ContainerTestCase(unittest.TestCase):
+
+    def instantiate(self, filename, start_values):
+        """ Instantiate and initialize a container and return the instance and the value references """
+
+        model_description = read_model_description(filename)
+
+        unzipdir = extract(filename)
+
+        fmu = FMU2Slave(guid=model_description.guid,
+                        unzipDirectory=unzipdir,
+                        modelIdentifier=model_description.coSimulation.modelIdentifier)
+
+        vrs = dict((v.name, v.valueReference) for v in model_description.modelVariables)
+
+        fmu.instantiate()
+        fmu.setupExperiment(startTime=0)
+        fmu.setReal([vrs[name] for name in start_values], list(start_values.values()))
+        fmu.enterInitializationMode()
+        fmu.exitInitializationMode()
+
+        self.addCleanup(rmtree, unzipdir, ignore_errors=True)
+
+        return fmu, vrs
+
+    def compile_test_fmu(self, name):
+        """ Create the source FMU from tests/resources/<name> and compile its platform binary """
+
+        shutil.make_archive(name, 'zip', os.path.join(os.path.dirname(__file__), 'resources', name))
+        os.replace(name + '.zip', name + '.fmu')
+        compile_platform_binary(name + '.fmu')
+
+        return name + '.fmu'
+
+    def disable_capability(self, filename, capability):
+        """ Copy an FMU and set the capability flag in the model description to false """
+
+        name, _ = os.path.splitext(filename)
+        outfilename = '%sWithout%s.fmu' % (name, capability[0].upper() + capability[1:])
+
+        with zipfile.ZipFile(filename) as zin, zipfile.ZipFile(outfilename, 'w', zipfile.ZIP_DEFLATED) as zout:
+            for item in zin.infolist():
+                data = zin.read(item.filename)
+                if item.filename == 'modelDescription.xml':
+                    data = data.replace(b'%s="true"' % capability.encode(), b'%s="false"' % capability.encode())
+                zout.writestr(item, data)
+
+        return outfilename
+
+
 @unittest.skipIf('SSP_STANDARD_DEV' not in os.environ, "Environment variable SSP_STANDARD_DEV must point to the clone of https://github.com/modelica/ssp-standard-dev")
-class FMUContainerTest(unittest.TestCase):
+class FMUContainerTest(ContainerTestCase):
+
+    def setUp(self):
+        self.examples = os.path.join(os.environ['SSP_STANDARD_DEV'], 'SystemStructureDescription', 'examples')
+
+    def controlled_drivetrain(self):
+        """ Configuration of a container with a controller and a drivetrain connected in a feedback loop """
+
+        return {
+            'variables': {
+                'controller.PI.k': {'name': 'k'},
+                'controller.u_s': {'name': 'w_ref'},
+                'drivetrain.w': {'name': 'w'},
+            },
+            'components': [
+                {'filename': os.path.join(self.examples, 'Controller.fmu'), 'name': 'controller', 'variables': ['u_s', 'PI.k']},
+                {'filename': os.path.join(self.examples, 'Drivetrain.fmu'), 'name': 'drivetrain', 'variables': ['w']},
+            ],
+            'connections': [
+                ('drivetrain', 'w', 'controller', 'u_m'),
+                ('controller', 'y', 'drivetrain', 'tau'),
+            ],
+        }
 
     def test_create_fmu_container(self):
 
@@ -43,7 +153,7 @@ class FMUContainerTest(unittest.TestCase):
             # connections between the FMU instances
             'connections':
                 [
-                    # <from_instance>, <from_variable>, <to_instance>, <to_variable>
+                    # <from_instance>, <from_variable>, <to_instance>, <to_variable>[, <options>]
                     ('drivetrain', 'w', 'controller', 'u_m'),
                     ('controller', 'y', 'drivetrain', 'tau'),
                 ]
@@ -54,6 +164,1027 @@ class FMUContainerTest(unittest.TestCase):
 
         create_fmu_container(configuration, filename)
 
-        w_ref = np.array([(0.5, 0), (1.5, 1), (2, 1), (3, 0)], dtype=[('time', 'f8'), ('w_ref', 'f8')])
-
         result = simulate_fmu(filename, start_values={'k': 20}, input=w_ref, output=['w_ref', 'w'], stop_time=4)
+
+    def test_nested_container(self):
+
+        import msgpack
+
+        # the controlled drivetrain as a nested container that records the motor speed
+        inner = self.controlled_drivetrain()
+        inner['recorder'] = {'filename': 'NestedRecording.npy', 'variables': ['w']}
+
+        create_fmu_container(inner, 'Inner.fmu')
+
+        del inner['recorder']
+
+        # a container with the nested container and an observer of its output
+        configuration = {
+            'variables': {
+                'system.k': {'name': 'k'},
+                'system.w_ref': {'name': 'w_ref'},
+                'system.w': {'name': 'w'},
+                'observer.y': {'name': 'y'},
+            },
+            'components': [
+                {'filename': 'Inner.fmu', 'name': 'system', 'variables': ['k', 'w_ref', 'w']},
+                {'filename': os.path.join(self.examples, 'Controller.fmu'), 'name': 'observer', 'variables': ['y']},
+            ],
+            'connections': [
+                ('system', 'w', 'observer', 'u_m'),
+            ],
+        }
+
+        create_fmu_container(configuration, 'Nested.fmu')
+
+        # the same system without the nested container
+        flat = self.controlled_drivetrain()
+        flat['variables']['observer.y'] = {'name': 'y'}
+        flat['components'].append(configuration['components'][1])
+        flat['connections'].append(('drivetrain', 'w', 'observer', 'u_m'))
+
+        create_fmu_container(flat, 'Flat.fmu')
+
+        # the nested components and connections are flattened into the schedule of the container
+        with zipfile.ZipFile('Nested.fmu') as zf:
+            data = msgpack.unpackb(zf.read('resources/config.mp'))
+            names = zf.namelist()
+
+        components = [component['name'] for component in data['components']]
+
+        self.assertEqual(['system.controller', 'system.drivetrain', 'observer'], components)
+        self.assertFalse(any(name.startswith('resources/FMUContainer') for name in names))
+
+        # and the connection from the nested container starts at the innermost FMU
+        connection = data['connections'][-1]
+        self.assertEqual((1, 2), (connection['startComponent'], connection['endComponent']))
+
+        # with the same results
+        for rate in [1, 2]:
+
+            with self.subTest(rate=rate):
+
+                configuration['components'][0]['rate'] = rate
+                flat['components'][0]['rate'] = rate
+                flat['components'][1]['rate'] = rate
+
+                create_fmu_container(configuration, 'Nested.fmu')
+                create_fmu_container(flat, 'Flat.fmu')
+
+                nested_result = simulate_fmu('Nested.fmu', start_values={'k': 20}, input=w_ref, output=['w', 'y'], stop_time=4)
+                flat_result = simulate_fmu('Flat.fmu', start_values={'k': 20}, input=w_ref, output=['w', 'y'], stop_time=4)
+
+                self.assertTrue(np.array_equal(flat_result['w'], nested_result['w']))
+                self.assertTrue(np.array_equal(flat_result['y'], nested_result['y']))
+
+                # the variables recorded by the nested container are recorded by the container
+                recording = read_recording('NestedRecording.npy')
+
+                self.assertEqual(('time', 'system.w'), recording.dtype.names)
+                self.assertEqual(nested_result['w'][-1], recording['system.w'][-1])
+
+        # the algorithms must match
+        configuration['algorithm'] = 'gauss-seidel'
+
+        with self.assertRaises(Exception):
+            create_fmu_container(configuration, 'Nested.fmu')
+
+    def test_parallel_do_step(self):
+
+        # two independent drivetrains with different gains
+        configuration = self.controlled_drivetrain()
+        configuration['variables'].update({
+            'controller2.PI.k': {'name': 'k2'},
+            'controller2.u_s': {'name': 'w_ref2'},
+            'drivetrain2.w': {'name': 'w2'},
+        })
+        configuration['components'] += [
+            {'filename': os.path.join(self.examples, 'Controller.fmu'), 'name': 'controller2', 'variables': ['u_s', 'PI.k']},
+            {'filename': os.path.join(self.examples, 'Drivetrain.fmu'), 'name': 'drivetrain2', 'variables': ['w']},
+        ]
+        configuration['connections'] += [
+            ('drivetrain2', 'w', 'controller2', 'u_m'),
+            ('controller2', 'y', 'drivetrain2', 'tau'),
+        ]
+
+        def simulate():
+            create_fmu_container(configuration, 'ParallelDoStep.fmu')
+            result = simulate_fmu('ParallelDoStep.fmu', start_values={'k': 20, 'w_ref': 1, 'k2': 5, 'w_ref2': 2}, output=['w', 'w2'], stop_time=2)
+            return np.stack([result['w'], result['w2']])
+
+        sequential = simulate()
+
+        # the drivetrains have different results
+        self.assertFalse(np.allclose(sequential[0], sequential[1]))
+
+        # the components are stepped in parallel with the same results
+        configuration['parallelDoStep'] = True
+
+        self.assertTrue(np.array_equal(sequential, simulate()))
+
+        # also on fewer threads than components
+        configuration['threads'] = 2
+
+        self.assertTrue(np.array_equal(sequential, simulate()))
+
+        # and with a component that is not thread-safe and always stepped on the same thread
+        configuration['components'][1]['threadSafe'] = False
+
+        self.assertTrue(np.array_equal(sequential, simulate()))
+
+    def test_parallel_instantiation(self):
+
+        # three controlled drivetrains, the last one with private copies of the shared libraries
+        configuration = self.controlled_drivetrain()
+
+        for i in [2, 3]:
+            configuration['variables'].update({
+                'controller%d.PI.k' % i: {'name': 'k%d' % i},
+                'controller%d.u_s' % i: {'name': 'w_ref%d' % i},
+                'drivetrain%d.w' % i: {'name': 'w%d' % i},
+            })
+            configuration['components'] += [
+                {'filename': os.path.join(self.examples, 'Controller.fmu'), 'name': 'controller%d' % i, 'variables': ['u_s', 'PI.k'], 'isolate': i == 3},
+                {'filename': os.path.join(self.examples, 'Drivetrain.fmu'), 'name': 'drivetrain%d' % i, 'variables': ['w'], 'isolate': i == 3},
+            ]
+            configuration['connections'] += [
+                ('drivetrain%d' % i, 'w', 'controller%d' % i, 'u_m'),
+                ('controller%d' % i, 'y', 'drivetrain%d' % i, 'tau'),
+            ]
+
+        start_values = {'k': 20, 'w_ref': 1, 'k2': 10, 'w_ref2': 2, 'k3': 5, 'w_ref3': 3}
+
+        def simulate():
+            create_fmu_container(configuration, 'ParallelInstantiation.fmu')
+            result = simulate_fmu('ParallelInstantiation.fmu', start_values=start_values, output=['w', 'w2', 'w3'], stop_time=2)
+            return np.stack([result['w'], result['w2'], result['w3']])
+
+        sequential = simulate()
+
+        # load and instantiate the components concurrently (repeatedly to catch races)
+        configuration['parallelInstantiation'] = True
+
+        for _ in range(5):
+            self.assertTrue(np.array_equal(sequential, simulate()))
+
+    def test_compiled_config(self):
+
+        base = self.controlled_drivetrain()
+
+        # Gauss-Seidel with different rates and the options of the connections
+        options = self.controlled_drivetrain()
+        options['algorithm'] = 'gauss-seidel'
+        options['components'][1].update({'rate': 4, 'interpolation': True})
+        options['connections'] = [
+            ('drivetrain', 'w', 'controller', 'u_m', {'break': True, 'order': 1}),
+            ('controller', 'y', 'drivetrain', 'tau', {'factor': 0.5, 'offset': 0.1}),
+        ]
+
+        # an iterated loop
+        loop = self.controlled_drivetrain()
+        loop['loops'] = [{'components': ['controller', 'drivetrain'], 'method': 'broyden', 'tolerance': 1e-10}]
+
+        for name, configuration in [('base', base), ('options', options), ('loop', loop)]:
+
+            with self.subTest(configuration=name):
+
+                create_fmu_container(configuration, 'CompiledConfig.fmu')
+
+                reference = simulate_fmu('CompiledConfig.fmu', start_values={'k': 5}, input=w_ref, output=['w'], stop_time=4)
+
+                configuration['compileConfig'] = True
+
+                create_fmu_container(configuration, 'CompiledConfig.fmu')
+
+                # remove config.mp so the container can only read config.bin
+                with zipfile.ZipFile('CompiledConfig.fmu') as zin, zipfile.ZipFile('CompiledConfigOnly.fmu', 'w') as zout:
+                    names = zin.namelist()
+                    for item in zin.infolist():
+                        if item.filename != 'resources/config.mp':
+                            zout.writestr(item, zin.read(item.filename))
+
+                self.assertIn('resources/config.bin', names)
+
+                result = simulate_fmu('CompiledConfigOnly.fmu', start_values={'k': 5}, input=w_ref, output=['w'], stop_time=4)
+
+                self.assertTrue(np.array_equal(reference['w'], result['w']))
+
+    def test_transfer_plan(self):
+
+        configuration = self.controlled_drivetrain()
+
+        create_fmu_container(configuration, 'TransferPlan.fmu')
+
+        result = simulate_fmu('TransferPlan.fmu', start_values={'k': 20}, input=w_ref, output=['w'], stop_time=4)
+
+        # the transfers are grouped by component so the order of the connections does not matter
+        configuration['connections'].reverse()
+
+        # an output can be connected to several inputs
+        configuration['components'].append({'filename': os.path.join(self.examples, 'Controller.fmu'), 'name': 'observer', 'variables': ['y']})
+        configuration['connections'] += [('drivetrain', 'w', 'observer', 'u_m'), ('controller', 'y', 'observer', 'u_s')]
+
+        create_fmu_container(configuration, 'TransferPlan.fmu')
+
+        transfer_result = simulate_fmu('TransferPlan.fmu', start_values={'k': 20}, input=w_ref, output=['w', 'observer.y'], stop_time=4)
+
+        self.assertTrue(np.array_equal(result['w'], transfer_result['w']))
+        self.assertNotEqual(0, np.max(np.abs(transfer_result['observer.y'])))
+
+    def test_multi_rate(self):
+
+        configuration = self.controlled_drivetrain()
+
+        create_fmu_container(configuration, 'SingleRate.fmu')
+
+        reference = simulate_fmu('SingleRate.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.01)
+
+        # two steps of all components per communication step are the same as half the communication step
+        for component in configuration['components']:
+            component['rate'] = 2
+
+        create_fmu_container(configuration, 'MultiRate.fmu')
+
+        result = simulate_fmu('MultiRate.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.02)
+
+        self.assertTrue(np.allclose(result['w'], reference['w'][::2]))
+
+        # and so are fixed step sizes
+        for component in configuration['components']:
+            del component['rate']
+            component['stepSize'] = 0.01
+
+        create_fmu_container(configuration, 'MultiRate.fmu')
+
+        result = simulate_fmu('MultiRate.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.02)
+
+        self.assertTrue(np.allclose(result['w'], reference['w'][::2]))
+
+        # a step size that does not divide the communication step size is changed with a warning
+        messages = []
+
+        def logger(componentEnvironment, instanceName, status, category, message):
+            messages.append(message.decode('utf-8'))
+
+        for component in configuration['components']:
+            component['stepSize'] = 0.004
+
+        create_fmu_container(configuration, 'MultiRate.fmu')
+
+        result = simulate_fmu('MultiRate.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.01, logger=logger)
+
+        self.assertEqual(2, len([m for m in messages if 'does not divide the communication step size' in m]))
+
+        # and the nearest step size that divides it is used (three steps per communication step)
+        for component in configuration['components']:
+            del component['stepSize']
+            component['rate'] = 3
+
+        create_fmu_container(configuration, 'MultiRate.fmu')
+
+        expected = simulate_fmu('MultiRate.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.01)
+
+        self.assertTrue(np.allclose(result['w'], expected['w']))
+
+        # step sizes that require too many micro steps are rejected
+        configuration['components'][1]['stepSize'] = 1e-12
+        del configuration['components'][1]['rate']
+
+        create_fmu_container(configuration, 'MultiRate.fmu')
+
+        with self.assertRaises(Exception):
+            simulate_fmu('MultiRate.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.02)
+
+    def test_different_rates(self):
+
+        configuration = self.controlled_drivetrain()
+
+        def simulate(output_interval=0.01):
+            create_fmu_container(configuration, 'DifferentRates.fmu')
+            result = simulate_fmu('DifferentRates.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=output_interval)
+            return result['w'][::int(round(0.01 / output_interval))]
+
+        reference = simulate(output_interval=0.0001)
+
+        single_rate = simulate()
+
+        # ten steps of the drivetrain per step of the controller
+        configuration['components'][1]['rate'] = 10
+
+        multi_rate = simulate()
+
+        self.assertLess(np.max(np.abs(multi_rate - reference)), 0.5 * np.max(np.abs(single_rate - reference)))
+
+        # which is the same as a step size of 0.001
+        del configuration['components'][1]['rate']
+        configuration['components'][1]['stepSize'] = 0.001
+
+        self.assertTrue(np.allclose(simulate(), multi_rate))
+
+    def test_interpolation(self):
+
+        # an open loop in which the controller output is a ramp
+        configuration = self.controlled_drivetrain()
+        configuration['connections'] = [('controller', 'y', 'drivetrain', 'tau')]
+
+        def simulate(output_interval=0.01):
+            create_fmu_container(configuration, 'Interpolation.fmu')
+            result = simulate_fmu('Interpolation.fmu', start_values={'k': 20, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=output_interval)
+            return result['w'][::int(round(0.01 / output_interval))]
+
+        reference = simulate(output_interval=0.0001)
+
+        # the faster drivetrain holds the controller output for ten steps
+        configuration['components'][1]['rate'] = 10
+
+        hold = simulate()
+
+        # or interpolates it
+        configuration['components'][1]['interpolation'] = True
+
+        interpolated = simulate()
+
+        self.assertLess(np.max(np.abs(interpolated - reference)), 0.5 * np.max(np.abs(hold - reference)))
+
+    def test_fmu_state(self):
+
+        create_fmu_container(self.controlled_drivetrain(), 'FMUState.fmu')
+
+        model_description = read_model_description('FMUState.fmu')
+
+        if not model_description.coSimulation.canGetAndSetFMUstate:
+            self.skipTest("The components do not support FMU states.")
+
+        fmu, vrs = self.instantiate('FMUState.fmu', {'k': 20, 'w_ref': 1})
+
+        def simulate(start_time, stop_time, step_size=0.01):
+            for i in range(int(round((stop_time - start_time) / step_size))):
+                fmu.doStep(currentCommunicationPoint=start_time + i * step_size, communicationStepSize=step_size)
+            return fmu.getReal([vrs['w']])[0]
+
+        simulate(0, 1)
+
+        state = fmu.getFMUstate()
+
+        w = simulate(1, 2)
+
+        # restore the state and repeat the steps
+        fmu.setFMUstate(state)
+
+        self.assertEqual(w, simulate(1, 2))
+
+        if model_description.coSimulation.canSerializeFMUstate:
+
+            serialized_state = fmu.serializeFMUstate(state)
+
+            fmu.freeFMUstate(state)
+
+            state = fmu.deSerializeFMUstate(serialized_state)
+
+            fmu.setFMUstate(state)
+
+            self.assertEqual(w, simulate(1, 2))
+
+        fmu.freeFMUstate(state)
+        fmu.terminate()
+        fmu.freeInstance()
+
+    def test_profiling(self):
+
+        configuration = self.controlled_drivetrain()
+        configuration['components'][1]['rate'] = 2
+
+        create_fmu_container(configuration, 'Profiling.fmu')
+
+        os.environ['FMU_CONTAINER_TRACE'] = os.path.abspath('Profiling.json')
+        self.addCleanup(os.environ.pop, 'FMU_CONTAINER_TRACE')
+
+        fmu, vrs = self.instantiate('Profiling.fmu', {'k': 20, 'w_ref': 1})
+
+        if not hasattr(fmu.dll, 'FMUContainerGetProfile'):
+            fmu.freeInstance()
+            self.skipTest("The FMU container has been built without FMU_CONTAINER_PROFILING.")
+
+        for i in range(100):
+            fmu.doStep(currentCommunicationPoint=i * 0.01, communicationStepSize=0.01)
+
+        # number of calls of fmi2DoStep() of the components (kind = 0x1000 + component * 4 + category)
+        self.assertEqual(100, fmu.getIntegerStatus(0x1000).value)
+        self.assertEqual(200, fmu.getIntegerStatus(0x1000 + 4).value)
+        self.assertGreaterEqual(fmu.getRealStatus(0x1000).value, 0)
+
+        fmu.terminate()
+        fmu.freeInstance()
+
+        with open('Profiling.json') as f:
+            trace = json.load(f)
+
+        names = [event['args']['name'] for event in trace['traceEvents'] if event['ph'] == 'M']
+        do_steps = [event['tid'] for event in trace['traceEvents'] if event['ph'] == 'X' and event['name'] == 'doStep']
+
+        self.assertEqual(['controller', 'drivetrain'], names)
+        self.assertEqual([100, 200], [do_steps.count(0), do_steps.count(1)])
+
+    def test_shared_library(self):
+
+        configuration = self.controlled_drivetrain()
+
+        create_fmu_container(configuration, 'SharedLibrary.fmu')
+
+        reference = simulate_fmu('SharedLibrary.fmu', start_values={'k': 20}, input=w_ref, output=['w'], stop_time=4)
+
+        # a second controlled drivetrain with instances of the same FMUs
+        configuration['variables']['drivetrain2.w'] = {'name': 'w2'}
+        configuration['components'] += [
+            {'filename': os.path.join(self.examples, 'Controller.fmu'), 'name': 'controller2', 'variables': ['PI.k']},
+            {'filename': os.path.join(self.examples, 'Drivetrain.fmu'), 'name': 'drivetrain2', 'variables': ['w']},
+        ]
+        configuration['connections'] += [
+            ('drivetrain2', 'w', 'controller2', 'u_m'),
+            ('controller2', 'y', 'drivetrain2', 'tau'),
+        ]
+
+        start_values = {'k': 20, 'controller2.PI.k': 20}
+        input = np.array([(t, w, w) for t, w in w_ref], dtype=[('time', 'f8'), ('w_ref', 'f8'), ('controller2.u_s', 'f8')])
+
+        for isolate in [False, True]:
+
+            with self.subTest(isolate=isolate):
+
+                # load a private copy of the shared library for the second controller
+                configuration['components'][2]['isolate'] = isolate
+                configuration['components'][0]['variables'] = ['u_s', 'PI.k']
+                configuration['components'][2]['variables'] = ['u_s', 'PI.k']
+
+                create_fmu_container(configuration, 'SharedLibrary.fmu')
+
+                result = simulate_fmu('SharedLibrary.fmu', start_values=start_values, input=input, output=['w', 'w2'], stop_time=4)
+
+                self.assertTrue(np.array_equal(reference['w'], result['w']))
+                self.assertTrue(np.array_equal(reference['w'], result['w2']))
+
+    def test_loop(self):
+
+        configuration = self.controlled_drivetrain()
+
+        create_fmu_container(configuration, 'Loop.fmu')
+
+        reference = simulate_fmu('Loop.fmu', start_values={'k': 5, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.001)
+        result = simulate_fmu('Loop.fmu', start_values={'k': 5, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.1)
+
+        # iterate the feedback loop in every step
+        configuration['loops'] = [{'components': ['controller', 'drivetrain'], 'tolerance': 1e-10, 'maxIterations': 100}]
+
+        create_fmu_container(configuration, 'Loop.fmu')
+
+        loop_result = simulate_fmu('Loop.fmu', start_values={'k': 5, 'w_ref': 1}, output=['w'], stop_time=2, output_interval=0.1)
+
+        # the iterations remove the delay of one step in the loop
+        error = np.max(np.abs(result['w'] - reference['w'][::100]))
+        loop_error = np.max(np.abs(loop_result['w'] - reference['w'][::100]))
+
+        self.assertLess(loop_error, error)
+
+    def test_loop_statistics(self):
+
+        # status kinds of the statistics of loop i: 0x100000 + i * 4 + (steps, iterations, max. iterations per step, failures)
+        def simulate(**options):
+            configuration = self.controlled_drivetrain()
+            configuration['loops'] = [dict(components=['controller', 'drivetrain'], tolerance=1e-10, **options)]
+            create_fmu_container(configuration, 'LoopStatistics.fmu')
+            fmu, vrs = self.instantiate('LoopStatistics.fmu', {'k': 5, 'w_ref': 1})
+            statuses = set()
+            for i in range(20):
+                # call fmi2DoStep() directly to get the warning of a loop that did not converge
+                statuses.add(fmu.dll.fmi2DoStep(fmu.component, i * 0.1, 0.1, fmi2True))
+            statistics = [fmu.getIntegerStatus(0x100000 + i).value for i in range(4)]
+            w, = fmu.getReal([vrs['w']])
+            fmu.terminate()
+            fmu.freeInstance()
+            return statuses, statistics, w
+
+        statuses, (steps, iterations, max_iterations, failures), w = simulate(maxIterations=100)
+
+        self.assertEqual({fmi2OK}, statuses)
+        self.assertEqual(20, steps)
+        self.assertEqual(0, failures)
+        self.assertGreater(max_iterations, 1)
+        self.assertLessEqual(iterations, steps * max_iterations)
+
+        # Broyden's method converges to the same solution in fewer iterations
+        broyden_statuses, broyden_statistics, broyden_w = simulate(maxIterations=100, method='broyden')
+
+        self.assertEqual({fmi2OK}, broyden_statuses)
+        self.assertEqual(0, broyden_statistics[3])
+        self.assertLess(broyden_statistics[1], iterations)
+        self.assertAlmostEqual(w, broyden_w, places=8)
+
+        # a loop that does not converge returns a warning for every step
+        statuses, (steps, iterations, max_iterations, failures), _ = simulate(maxIterations=2)
+
+        self.assertEqual({fmi2Warning}, statuses)
+        self.assertEqual([20, 40, 2, 20], [steps, iterations, max_iterations, failures])
+
+    def test_directional_derivative(self):
+
+        configuration = self.controlled_drivetrain()
+        configuration['variables']['controller.y'] = {'name': 'y'}
+        configuration['components'][0]['variables'].append('y')
+
+        create_fmu_container(configuration, 'DirectionalDerivative.fmu')
+
+        model_description = read_model_description('DirectionalDerivative.fmu')
+
+        self.assertTrue(model_description.coSimulation.providesDirectionalDerivative)
+        self.assertEqual(['y', 'w'], [unknown.variable.name for unknown in model_description.outputs])
+
+        fmu, vrs = self.instantiate('DirectionalDerivative.fmu', {'k': 20, 'w_ref': 1})
+
+        fmu.doStep(currentCommunicationPoint=0, communicationStepSize=0.1)
+
+        dy_dw_ref, = fmu.getDirectionalDerivative(vUnknown_ref=[vrs['y']], vKnown_ref=[vrs['w_ref']], dvKnown=[1.0])
+
+        # central difference quotient
+        fmu.setReal([vrs['w_ref']], [1 - 1e-4])
+        y1, = fmu.getReal([vrs['y']])
+
+        fmu.setReal([vrs['w_ref']], [1 + 1e-4])
+        y2, = fmu.getReal([vrs['y']])
+
+        self.assertAlmostEqual((y2 - y1) / 2e-4, dy_dw_ref, delta=1e-4 * abs(dy_dw_ref) + 1e-6)
+
+        fmu.terminate()
+        fmu.freeInstance()
+
+    def test_linear_transformation(self):
+
+        configuration = self.controlled_drivetrain()
+
+        create_fmu_container(configuration, 'LinearTransformation.fmu')
+
+        reference = simulate_fmu('LinearTransformation.fmu', start_values={'k': 20}, input=w_ref, output=['w'], stop_time=4)
+
+        # negate the measured speed, the reference and the control signal
+        configuration['connections'] = [
+            ('drivetrain', 'w', 'controller', 'u_m', {'factor': -1}),
+            ('controller', 'y', 'drivetrain', 'tau', {'factor': -1}),
+        ]
+
+        create_fmu_container(configuration, 'LinearTransformation.fmu')
+
+        negated_w_ref = w_ref.copy()
+        negated_w_ref['w_ref'] = -w_ref['w_ref']
+
+        result = simulate_fmu('LinearTransformation.fmu', start_values={'k': 20}, input=negated_w_ref, output=['w'], stop_time=4)
+
+        self.assertTrue(np.array_equal(reference['w'], result['w']))
+
+        # the offset is added after the scaling
+        configuration['components'][0]['variables'].append('u_m')
+        configuration['connections'][0] = ('drivetrain', 'w', 'controller', 'u_m', {'factor': 2, 'offset': 1})
+
+        create_fmu_container(configuration, 'LinearTransformation.fmu')
+
+        result = simulate_fmu('LinearTransformation.fmu', start_values={'k': 20}, input=w_ref, output=['w', 'controller.u_m'], stop_time=4)
+
+        # the outputs are transferred before the next step
+        self.assertTrue(np.allclose(2 * result['w'][:-1] + 1, result['controller.u_m'][1:]))
+
+    def test_async_do_step(self):
+
+        results = []
+
+        for async_do_step in [False, True]:
+
+            configuration = self.controlled_drivetrain()
+            configuration['asyncDoStep'] = async_do_step
+
+            create_fmu_container(configuration, 'AsyncDoStep.fmu')
+
+            fmu, vrs = self.instantiate('AsyncDoStep.fmu', {'k': 20, 'w_ref': 1})
+
+            w = []
+
+            for i in range(100):
+
+                # call fmi2DoStep() directly because FMU2Slave.doStep() raises an exception for fmi2Pending
+                status = fmu.dll.fmi2DoStep(fmu.component, i * 0.01, 0.01, fmi2True)
+
+                self.assertEqual(fmi2Pending if async_do_step else fmi2OK, status)
+
+                while async_do_step and fmu.getStatus(fmi2DoStepStatus).value == fmi2Pending:
+                    time.sleep(1e-4)
+
+                self.assertAlmostEqual((i + 1) * 0.01, fmu.getRealStatus(fmi2LastSuccessfulTime).value)
+
+                w += fmu.getReal([vrs['w']])
+
+            results.append(w)
+
+            fmu.terminate()
+            fmu.freeInstance()
+
+        self.assertEqual(results[0], results[1])
+
+
+    def test_cancel_step(self):
+
+        configuration = self.controlled_drivetrain()
+        configuration['asyncDoStep'] = True
+
+        # a step with many micro steps
+        configuration['components'][1]['rate'] = 10000000
+
+        create_fmu_container(configuration, 'CancelStep.fmu')
+
+        fmu, vrs = self.instantiate('CancelStep.fmu', {'k': 20, 'w_ref': 1})
+
+        self.assertEqual(fmi2Pending, fmu.dll.fmi2DoStep(fmu.component, 0.0, 1.0, fmi2True))
+
+        # only fmi2GetStatus() and fmi2CancelStep() can be called while the step is pending
+        with self.assertRaises(Exception):
+            fmu.getReal([vrs['w']])
+
+        fmu.cancelStep()
+
+        # the step is aborted after the current micro step
+        self.assertEqual(fmi2Error, fmu.getStatus(fmi2DoStepStatus).value)
+        self.assertLess(fmu.getRealStatus(fmi2LastSuccessfulTime).value, 1.0)
+
+        fmu.freeInstance()
+
+class FMI2ComponentTest(ContainerTestCase):
+
+    @unittest.skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_access_plans(self):
+
+        # three components with y = k * u (see resources/Integrator2)
+        filename = self.compile_test_fmu('Integrator2')
+
+        names = ['a', 'b', 'c']
+
+        configuration = {
+            'variables': {},
+            'components': [{'filename': filename, 'name': name, 'variables': ['u', 'k', 'y', 'nDirectionalDerivatives']} for name in names],
+            'connections': [],
+        }
+
+        create_fmu_container(configuration, 'AccessPlans.fmu')
+
+        fmu, vrs = self.instantiate('AccessPlans.fmu', {'a.k': 2, 'b.k': 3, 'c.k': 5})
+
+        fmu.setReal([vrs['a.u'], vrs['b.u'], vrs['c.u']], [7, 11, 13])
+
+        reals = [name + '.' + variable for name in names for variable in ['u', 'k', 'y']]
+
+        expected = dict((name, fmu.getReal([vrs[name]])[0]) for name in reals)
+
+        self.assertEqual(14, expected['a.y'])
+
+        # repeated and interleaved value references of several components in more lists than the cache holds
+        rng = np.random.default_rng(0)
+
+        lists = [['a.y', 'b.y', 'a.k', 'c.y', 'b.k', 'a.y'], ['c.u', 'a.u', 'c.u', 'b.y']]
+        lists += [list(rng.choice(reals, size=rng.integers(1, 12))) for _ in range(40)]
+
+        for _ in range(2):
+            for variables in lists:
+                values = fmu.getReal([vrs[name] for name in variables])
+                self.assertEqual([expected[name] for name in variables], values)
+
+        # the last of repeated value references is set (in the caller's order within a component)
+        fmu.setReal([vrs['a.u'], vrs['b.u'], vrs['c.u'], vrs['a.u'], vrs['b.k']], [1, 2, 3, 4, 6])
+
+        self.assertEqual([4, 12, 15, 4], fmu.getReal([vrs['a.u'], vrs['b.y'], vrs['c.y'], vrs['a.u']]))
+        self.assertEqual([8], fmu.getReal([vrs['a.y']]))
+
+        # integers share the plans of the value references
+        self.assertEqual([0, 0, 0], fmu.getInteger([vrs['a.nDirectionalDerivatives'], vrs['c.nDirectionalDerivatives'], vrs['a.nDirectionalDerivatives']]))
+
+        # unknown value references are rejected
+        with self.assertRaises(Exception):
+            fmu.getReal([vrs['a.y'], len(vrs) + 1])
+
+        fmu.terminate()
+        fmu.freeInstance()
+
+    @unittest.skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_connection_order(self):
+
+        # integrator that integrates polynomial inputs exactly (see resources/Integrator2)
+        filename = self.compile_test_fmu('Integrator2')
+
+        # the same FMU without canInterpolateInputs that gets the extrapolated input in the middle of the step
+        hold = self.disable_capability(filename, 'canInterpolateInputs')
+
+        for filename, input_derivatives in [(filename, True), (hold, False)]:
+
+            with self.subTest(filename=filename):
+
+                errors = []
+
+                for order in [0, 1, 2]:
+
+                    # harmonic oscillator der(x) = v, der(v) = -x split into two components
+                    configuration = {
+                        'variables': {
+                            'a.x0': {'name': 'x0'},
+                            'b.k': {'name': 'k'},
+                        },
+                        'components': [
+                            {'filename': filename, 'name': 'a', 'variables': ['x', 'x0', 'nInputDerivatives']},
+                            {'filename': filename, 'name': 'b', 'variables': ['x', 'k']},
+                        ],
+                        'connections': [
+                            ('b', 'x', 'a', 'u', {'order': order}),
+                            ('a', 'x', 'b', 'u', {'order': order}),
+                        ],
+                    }
+
+                    create_fmu_container(configuration, 'Oscillator.fmu')
+
+                    result = simulate_fmu('Oscillator.fmu', start_values={'x0': 1, 'k': -1}, output=['a.x', 'a.nInputDerivatives'], stop_time=10, output_interval=0.1)
+
+                    # error after the first steps that have too few samples for the extrapolation
+                    t = result['time']
+                    errors.append(np.max(np.abs(result['a.x'] - np.cos(t))[t > 1]))
+
+                    # the derivatives are only set for connections of order > 0 to components that can interpolate inputs
+                    self.assertEqual(input_derivatives and order > 0, result['a.nInputDerivatives'][-1] > 0)
+
+                # the extrapolation reduces the coupling error
+                self.assertLess(errors[1], 0.1 * errors[0])
+                self.assertLess(errors[2], 0.2 * errors[1])
+
+
+    @unittest.skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_directional_derivative_chain(self):
+
+        # y = k * u with directional derivatives (see resources/Integrator2)
+        filename = self.compile_test_fmu('Integrator2')
+
+        # the same FMU that is differentiated with finite differences by the container
+        finite_differences = self.disable_capability(filename, 'providesDirectionalDerivative')
+
+        for filename, directional_derivatives in [(filename, True), (finite_differences, False)]:
+
+            with self.subTest(filename=filename):
+
+                # b.y = k_b * 2 * k_a * u depends on u through the scaled connection from a.y to b.u
+                configuration = {
+                    'variables': {
+                        'a.u': {'name': 'u'},
+                        'a.k': {'name': 'k_a'},
+                        'b.k': {'name': 'k_b'},
+                        'b.y': {'name': 'y'},
+                        'a.nDirectionalDerivatives': {'name': 'n_a'},
+                        'b.nDirectionalDerivatives': {'name': 'n_b'},
+                    },
+                    'components': [
+                        {'filename': filename, 'name': 'a', 'variables': ['u', 'k', 'nDirectionalDerivatives']},
+                        {'filename': filename, 'name': 'b', 'variables': ['k', 'y', 'nDirectionalDerivatives']},
+                    ],
+                    'connections': [
+                        ('a', 'y', 'b', 'u', {'factor': 2}),
+                    ],
+                }
+
+                create_fmu_container(configuration, 'Chain.fmu')
+
+                fmu, vrs = self.instantiate('Chain.fmu', {'u': 1.5, 'k_a': 3, 'k_b': 5})
+
+                fmu.doStep(currentCommunicationPoint=0, communicationStepSize=0.1)
+
+                dy_du, = fmu.getDirectionalDerivative(vUnknown_ref=[vrs['y']], vKnown_ref=[vrs['u']], dvKnown=[1.0])
+                dy_dk_a, = fmu.getDirectionalDerivative(vUnknown_ref=[vrs['y']], vKnown_ref=[vrs['k_a']], dvKnown=[1.0])
+
+                self.assertAlmostEqual(30, dy_du, delta=0 if directional_derivatives else 1e-5)
+                self.assertAlmostEqual(15, dy_dk_a, delta=0 if directional_derivatives else 1e-5)
+
+                # the components' directional derivatives are only called if they are provided
+                n_a, n_b = fmu.getInteger([vrs['n_a'], vrs['n_b']])
+                self.assertEqual(directional_derivatives, n_a > 0 and n_b > 0)
+                self.assertEqual(directional_derivatives, n_a + n_b > 0)
+
+                # and the inputs are restored after the finite differences
+                self.assertEqual(1.5, fmu.getReal([vrs['u']])[0])
+
+                fmu.terminate()
+                fmu.freeInstance()
+
+
+    @unittest.skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_recorder(self):
+
+        # a.x = t and b.y = 2 * a.x (see resources/Integrator2)
+        filename = self.compile_test_fmu('Integrator2')
+
+        configuration = {
+            'variables': {
+                'a.u': {'name': 'u'},
+                'a.x': {'name': 'x'},
+                'b.y': {'name': 'y'},
+                'b.nInputDerivatives': {'name': 'n'},
+            },
+            'components': [
+                {'filename': filename, 'name': 'a', 'variables': ['u', 'x']},
+                {'filename': filename, 'name': 'b', 'variables': ['y', 'nInputDerivatives']},
+            ],
+            # the input derivatives are counted by b.nInputDerivatives
+            'connections': [('a', 'x', 'b', 'u', {'order': 1})],
+            'recorder': {'filename': 'Recording.npy', 'interval': 0.25, 'variables': ['x', 'y', 'n']},
+        }
+
+        create_fmu_container(configuration, 'Recorder.fmu')
+
+        result = simulate_fmu('Recorder.fmu', start_values={'u': 1}, output=['x', 'y', 'n'], stop_time=1, output_interval=0.05)
+
+        recording = read_recording('Recording.npy')
+
+        self.assertEqual(('time', 'x', 'y', 'n'), recording.dtype.names)
+
+        # a sample at the start and every 0.25 s
+        self.assertTrue(np.allclose([0, 0.25, 0.5, 0.75, 1], recording['time']))
+        self.assertTrue(np.allclose(recording['time'], recording['x']))
+
+        # with the same values as the outputs at these times
+        for name in ['x', 'y', 'n']:
+            self.assertTrue(np.array_equal(result[name][::5], recording[name]), name)
+
+        self.assertEqual(20, recording['n'][-1])
+
+        # without an interval every micro step is recorded
+        configuration['components'][0]['rate'] = 2
+        configuration['recorder'] = {'filename': 'Recording.npy', 'variables': ['x']}
+
+        create_fmu_container(configuration, 'Recorder.fmu')
+
+        simulate_fmu('Recorder.fmu', start_values={'u': 1}, output=['x'], stop_time=1, output_interval=0.05)
+
+        recording = read_recording('Recording.npy')
+
+        self.assertEqual(41, len(recording))
+        self.assertTrue(np.allclose(np.linspace(0, 1, 41), recording['time']))
+        self.assertTrue(np.allclose(recording['time'], recording['x']))
+
+    @unittest.skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_gauss_seidel(self):
+
+        # b.y = b.u = a.x = t (see resources/Integrator2)
+        filename = self.compile_test_fmu('Integrator2')
+
+        configuration = {
+            'variables': {
+                'a.u': {'name': 'u'},
+                'a.x': {'name': 'x'},
+                'b.y': {'name': 'y'},
+            },
+            'components': [
+                {'filename': filename, 'name': 'a', 'variables': ['u', 'x']},
+                {'filename': filename, 'name': 'b', 'variables': ['y']},
+            ],
+            'connections': [
+                ('a', 'x', 'b', 'u'),
+            ],
+        }
+
+        def simulate(algorithm, **options):
+            configuration['algorithm'] = algorithm
+            configuration.update(options)
+            create_fmu_container(configuration, 'GaussSeidel.fmu')
+            result = simulate_fmu('GaussSeidel.fmu', start_values={'u': 1}, output=['x', 'y'], stop_time=1, output_interval=0.1)
+            self.assertTrue(np.allclose(result['time'], result['x']))
+            return result
+
+        # the Jacobi algorithm steps b with the output of a from the previous step
+        result = simulate('jacobi')
+        self.assertTrue(np.allclose(result['x'][:-1], result['y'][1:]))
+
+        # the Gauss-Seidel algorithm steps a in the first level and b with its new output in the second
+        result = simulate('gauss-seidel')
+        self.assertTrue(np.allclose(result['x'], result['y']))
+
+        # also if the components of the levels are stepped in parallel
+        result = simulate('gauss-seidel', parallelDoStep=True)
+        self.assertTrue(np.allclose(result['x'], result['y']))
+
+        # a broken connection does not order the components
+        configuration['connections'] = [('a', 'x', 'b', 'u', {'break': True})]
+        result = simulate('gauss-seidel', parallelDoStep=False)
+        self.assertTrue(np.allclose(result['x'][:-1], result['y'][1:]))
+
+        # unknown algorithms are rejected
+        configuration['algorithm'] = 'gauss'
+
+        with self.assertRaises(Exception):
+            create_fmu_container(configuration, 'GaussSeidel.fmu')
+
+
+class FMI3ComponentTest(ContainerTestCase):
+
+    def test_fmi3_component(self):
+
+        v = '0.0.4'  # Reference FMUs version
+
+        download_file(url='https://github.com/modelica/Reference-FMUs/releases/download/v' + v + '/Reference-FMUs-' + v + '.zip',
+                      checksum='ed4b2346782c44937a411037c19a32ac2bd09cd43a5fce9bb0fddc571723fc3a')
+
+        extract('Reference-FMUs-' + v + '.zip', 'Reference-FMUs-dist')
+
+        # the same model as FMI 2.0 and FMI 3.0 component
+        configuration = {
+            'variables': {
+                'dahlquist2.x': {'name': 'x2'},
+                'dahlquist3.x': {'name': 'x3'},
+            },
+            'components': [
+                {'filename': os.path.join('Reference-FMUs-dist', '2.0', 'Dahlquist.fmu'), 'name': 'dahlquist2', 'variables': ['x']},
+                {'filename': os.path.join('Reference-FMUs-dist', '3.0', 'Dahlquist.fmu'), 'name': 'dahlquist3', 'variables': ['x']},
+            ],
+            'connections': [],
+        }
+
+        create_fmu_container(configuration, 'Dahlquist.fmu')
+
+        result = simulate_fmu('Dahlquist.fmu', output=['x2', 'x3'])
+
+        self.assertLess(result['x3'][-1], result['x3'][0])
+        self.assertTrue(np.allclose(result['x2'], result['x3']))
+
+    @unittest.skipIf(platform.startswith('win'), "The test FMU is compiled with GCC")
+    def test_fmi3_arrays_and_events(self):
+
+        # FMI 3.0 test FMU with an array input and output and a time event at t = 0.55 (see resources/Integrator3)
+        self.compile_test_fmu('Integrator3')
+
+        configuration = {
+            'variables': {},
+            'components': [
+                {'filename': 'Integrator3.fmu', 'name': 'a', 'variables': ['sum', 'nEvents']},
+                {'filename': 'Integrator3.fmu', 'name': 'b', 'variables': ['k', 'y', 'usum', 'nEvents', 'nDerivatives']},
+            ],
+            # Float64[3] array transferred with a single call
+            'connections': [('a', 'x', 'b', 'u')],
+        }
+
+        results = []
+
+        for event_mode in [False, True]:
+
+            with self.subTest(event_mode=event_mode):
+
+                for component in configuration['components']:
+                    component['eventMode'] = event_mode
+
+                create_fmu_container(configuration, 'Integrator3Container.fmu')
+
+                result = simulate_fmu('Integrator3Container.fmu', output=['a.sum', 'a.nEvents', 'b.usum'], stop_time=1, output_interval=0.1)
+
+                # the steps that return early at the event are resumed to the end of the step
+                t = result['time']
+                self.assertTrue(np.allclose(14 * t + 10 * (t > 0.55), result['a.sum']))
+
+                # the elements arrive in the right order (the outputs are transferred before the next step)
+                self.assertTrue(np.allclose(result['a.sum'][:-1], result['b.usum'][1:]))
+
+                # the event is handled in event mode if requested
+                self.assertEqual(1 if event_mode else 0, result['a.nEvents'][-1])
+
+                results.append(result['a.sum'])
+
+        self.assertTrue(np.array_equal(results[0], results[1]))
+
+        # the FMI 3.0 capabilities are advertised by the container
+        model_description = read_model_description('Integrator3Container.fmu')
+
+        self.assertTrue(model_description.coSimulation.canGetAndSetFMUstate)
+        self.assertTrue(model_description.coSimulation.canSerializeFMUstate)
+
+        fmu, vrs = self.instantiate('Integrator3Container.fmu', {})
+
+        def simulate(start_time, stop_time, step_size=0.1):
+            for i in range(int(round((stop_time - start_time) / step_size))):
+                fmu.doStep(currentCommunicationPoint=start_time + i * step_size, communicationStepSize=step_size)
+            return fmu.getReal([vrs['a.sum'], vrs['b.usum']])
+
+        simulate(0, 0.5)
+
+        state = fmu.getFMUstate()
+
+        # restore the state before the event and repeat the steps
+        values = simulate(0.5, 1)
+
+        fmu.setFMUstate(state)
+
+        self.assertEqual(values, simulate(0.5, 1))
+
+        fmu.freeFMUstate(state)
+
+        # the directional derivative of the component is used instead of finite differences
+        dy_dk, = fmu.getDirectionalDerivative(vUnknown_ref=[vrs['b.y']], vKnown_ref=[vrs['b.k']], dvKnown=[1.0])
+
+        self.assertEqual(3, dy_dk)
+        self.assertEqual([1], fmu.getInteger([vrs['b.nDerivatives']]))
+
+        fmu.terminate()
+        fmu.freeInstance()